@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "CLI/CLI11.hpp"
+#include "timbre/config.h"
+#include "timbre/pipeline.h"
+#include "timbre/reader.h"
+#include "timbre/timbre.h"
+#include "timbre/version.h"
+
+/**
+ * Throughput benchmarks for timbre
+ *
+ * Generates a synthetic log corpus and measures the matcher on its own,
+ * process_line into real level files, and the whole reader -> files path,
+ * for the default config and a 50 pattern config. Results go out as JSON.
+ */
+
+using namespace timbre;
+
+namespace {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct GeneratorOptions {
+    // Share of lines per level, the remainder carries no level at all
+    double error = 0.05;
+    double warn = 0.10;
+    double info = 0.50;
+    double debug = 0.25;
+    std::size_t min_length = 40;
+    std::size_t mean_length = 120;
+    std::size_t max_length = 4096;
+    double ansi = 0.10;  // share of lines with colour escapes
+    double keyword = 0.20;  // share of lines that mention a rule keyword
+    std::uint64_t seed = 42;
+};
+
+struct Result {
+    std::string config;
+    std::string benchmark;
+    std::size_t threads;
+    std::size_t lines;
+    std::size_t bytes;
+    double seconds;
+};
+
+// Words for the 50 pattern config, the generator sprinkles them in
+const std::vector<std::string> KEYWORDS = {
+    "timeout", "refused", "deadlock", "oom", "panic", "retry", "throttled", "evicted", "rollback", "checksum",
+    "handshake", "expired", "quota", "backoff", "segfault", "corrupt", "unreachable", "overflow", "stale", "leak",
+    "failover", "degraded", "replica", "partition", "rebalance", "compaction", "snapshot", "migration", "heartbeat", "lease",
+    "cert", "token", "denied", "forbidden", "conflict", "duplicate", "orphan", "zombie", "saturated", "spill",
+    "latency", "jitter", "drift", "skew", "queue", "shed", "circuit", "breaker", "canary", "hotfix",
+};
+
+const std::vector<std::string> FILLER = {
+    "request", "handled", "user", "session", "GET", "POST", "/api/v1/items", "/healthz", "status=200", "status=404",
+    "took", "12ms", "340ms", "bytes=5120", "client", "10.0.3.17", "worker-7", "shard=3", "cache", "hit",
+    "miss", "upstream", "db", "query", "rows=42", "commit", "tx=9f3a", "job", "scheduled", "done",
+};
+
+std::string build_line(const GeneratorOptions& options, std::mt19937_64& rng) {
+    static const char* const ERROR_FORMS[] = {"ERROR", "[error]", "level=error", "Exception:", "request failed"};
+    static const char* const WARN_FORMS[] = {"WARN", "[warning]", "level=warn", "Warning:"};
+    static const char* const INFO_FORMS[] = {"INFO", "[info]", "level=info", "I"};
+    static const char* const DEBUG_FORMS[] = {"DEBUG", "[debug]", "level=debug", "D"};
+    static const char* const COLOURS[] = {"\x1b[31m", "\x1b[33m", "\x1b[32m", "\x1b[36m", "\x1b[1;35m"};
+
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::exponential_distribution<double> extra(1.0 / static_cast<double>(
+        std::max<std::size_t>(1, options.mean_length - std::min(options.mean_length, options.min_length))));
+    const bool ansi = unit(rng) < options.ansi;
+    auto pick = [&rng](const auto& list) {
+        return list[std::uniform_int_distribution<std::size_t>(0, std::size(list) - 1)(rng)];
+    };
+
+    std::string line = "2025-01-01T12:00:00.000Z ";
+    const double roll = unit(rng);
+    const char* level = nullptr;
+    if (roll < options.error) level = pick(ERROR_FORMS);
+    else if (roll < options.error + options.warn) level = pick(WARN_FORMS);
+    else if (roll < options.error + options.warn + options.info) level = pick(INFO_FORMS);
+    else if (roll < options.error + options.warn + options.info + options.debug) level = pick(DEBUG_FORMS);
+    if (level != nullptr) {
+        if (ansi) line += pick(COLOURS);
+        line += level;
+        if (ansi) line += "\x1b[0m";
+        line += ' ';
+    }
+    if (unit(rng) < options.keyword) {
+        line += pick(KEYWORDS);
+        line += ' ';
+    }
+
+    const std::size_t target = std::min(options.max_length,
+        options.min_length + static_cast<std::size_t>(extra(rng)));
+    while (line.size() < target) {
+        if (ansi && unit(rng) < 0.1) {
+            line += pick(COLOURS);
+            line += pick(FILLER);
+            line += "\x1b[0m ";
+        } else {
+            line += pick(FILLER);
+            line += ' ';
+        }
+    }
+    line.resize(target);
+    return line;
+}
+
+std::string generate_corpus(const GeneratorOptions& options, std::size_t bytes) {
+    std::mt19937_64 rng(options.seed);
+    std::string corpus;
+    corpus.reserve(bytes + options.max_length + 1);
+    while (corpus.size() < bytes) {
+        corpus += build_line(options, rng);
+        corpus += '\n';
+    }
+    return corpus;
+}
+
+std::vector<std::string_view> split_lines(const std::string& corpus) {
+    std::vector<std::string_view> lines;
+    const char* p = corpus.data();
+    const char* end = p + corpus.size();
+    while (p < end) {
+        const char* nl = find_newline(p, end);
+        lines.emplace_back(p, static_cast<std::size_t>(nl - p));
+        p = nl + 1;
+    }
+    return lines;
+}
+
+// One level per keyword, mixing literals, alternations, classes and optional suffixes
+std::string large_config_toml(const fs::path& log_dir) {
+    std::ostringstream toml;
+    toml << "[timbre]\nlog_dir = \"" << log_dir.generic_string() << "\"\n\n[log_level]\n";
+    for (std::size_t i = 0; i < KEYWORDS.size(); ++i) {
+        const std::string& keyword = KEYWORDS[i];
+        const std::string& other = KEYWORDS[(i * 7 + 3) % KEYWORDS.size()];
+        std::string pattern;
+        switch (i % 5) {
+            case 0: pattern = keyword; break;
+            case 1: pattern = "(" + keyword + "|" + other + ")"; break;
+            case 2: pattern = keyword + "[=: ][0-9a-z]+"; break;
+            case 3: pattern = keyword + "(ed|ing|s)?"; break;
+            default: pattern = "(^|[^a-z])" + keyword + "([^a-z]|$)"; break;
+        }
+        toml << "rule" << (i < 10 ? "0" : "") << i << " = \"" << pattern << "\"\n";
+    }
+    return toml.str();
+}
+
+template <typename Fn>
+double best_of(std::size_t repeat, Fn&& fn) {
+    double best = 0.0;
+    for (std::size_t i = 0; i < repeat; ++i) {
+        const auto start = Clock::now();
+        fn();
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+void report(const Result& result) {
+    const double mb = static_cast<double>(result.bytes) / (1024.0 * 1024.0);
+    std::fprintf(stderr, "%-8s %-14s threads=%-3zu %12.0f lines/s %9.1f MB/s\n",
+        result.config.c_str(), result.benchmark.c_str(), result.threads,
+        static_cast<double>(result.lines) / result.seconds, mb / result.seconds);
+}
+
+std::string to_json(const GeneratorOptions& options, std::size_t corpus_bytes, const std::vector<Result>& results) {
+    std::ostringstream json;
+    json.precision(6);
+    json << std::fixed;
+    json << "{\n";
+    json << "  \"version\": \"" << TIMBRE_VERSION_MAJOR << "." << TIMBRE_VERSION_MINOR << "."
+         << TIMBRE_VERSION_PATCH << "\",\n";
+    json << "  \"commit\": \"" << TIMBRE_VERSION_SHA << "\",\n";
+    json << "  \"timestamp\": " << static_cast<long long>(std::time(nullptr)) << ",\n";
+    json << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    json << "  \"corpus\": {\"bytes\": " << corpus_bytes
+         << ", \"seed\": " << options.seed
+         << ", \"error\": " << options.error << ", \"warn\": " << options.warn
+         << ", \"info\": " << options.info << ", \"debug\": " << options.debug
+         << ", \"ansi\": " << options.ansi << ", \"keyword\": " << options.keyword
+         << ", \"min_length\": " << options.min_length << ", \"mean_length\": " << options.mean_length
+         << ", \"max_length\": " << options.max_length << "},\n";
+    json << "  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        const double mb = static_cast<double>(r.bytes) / (1024.0 * 1024.0);
+        json << "    {\"config\": \"" << r.config << "\", \"benchmark\": \"" << r.benchmark << "\""
+             << ", \"threads\": " << r.threads << ", \"lines\": " << r.lines << ", \"bytes\": " << r.bytes
+             << ", \"seconds\": " << r.seconds
+             << ", \"lines_per_sec\": " << static_cast<double>(r.lines) / r.seconds
+             << ", \"mb_per_sec\": " << mb / r.seconds << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+    return json.str();
+}
+
+void run_suite(
+    const std::string& name,
+    UserConfig& config,
+    const std::string& corpus,
+    const std::vector<std::string_view>& lines,
+    const fs::path& input_path,
+    std::size_t repeat,
+    std::size_t threads,
+    std::vector<Result>& results) {
+
+    const Matcher& matcher = config.get_matcher();
+    std::fprintf(stderr, "%s: %zu levels, %zu on the std::regex fallback\n",
+        name.c_str(), matcher.size(), matcher.fallback_count());
+    std::size_t matched = 0;
+    const double match_seconds = best_of(repeat, [&]() {
+        matched = 0;
+        for (const auto line : lines) matched += matcher.match(line) != Matcher::NO_MATCH;
+    });
+    results.push_back({name, "match", 1, lines.size(), corpus.size(), match_seconds});
+    report(results.back());
+
+    const double process_seconds = best_of(repeat, [&]() {
+        SinkTable log_files = open_log_files(config, false);
+        for (const auto line : lines) process_line(config, line, log_files, true);
+        close_log_files(log_files);
+    });
+    results.push_back({name, "process_line", 1, lines.size(), corpus.size(), process_seconds});
+    report(results.back());
+
+    std::vector<std::size_t> thread_counts = {1};
+    if (threads > 1) thread_counts.push_back(threads);
+    for (const std::size_t n : thread_counts) {
+        const double seconds = best_of(repeat, [&]() {
+            std::FILE* input = std::fopen(input_path.string().c_str(), "rb");
+            if (input == nullptr) return;
+            SinkTable log_files = open_log_files(config, false);
+            LineReader reader(fileno(input));
+            if (n > 1) {
+                run_pipeline(config, reader, log_files, n, true);
+            } else {
+                std::string_view line;
+                while (reader.next(line)) process_line(config, line, log_files, true);
+            }
+            close_log_files(log_files);
+            std::fclose(input);
+        });
+        results.push_back({name, "end_to_end", n, lines.size(), corpus.size(), seconds});
+        report(results.back());
+    }
+
+    if (matched == 0) std::fprintf(stderr, "%s: no line matched any level\n", name.c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    CLI::App app{"::timbre:: throughput benchmarks"};
+
+    GeneratorOptions options;
+    std::size_t size_mb = 64;
+    std::size_t repeat = 3;
+    std::size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    std::string output;
+    std::string extra_config;
+
+    app.add_option("-s,--size", size_mb, "Corpus size in MiB");
+    app.add_option("-r,--repeat", repeat, "Runs per benchmark, the fastest is reported")->check(CLI::PositiveNumber);
+    app.add_option("-j,--threads", threads, "Worker threads for the pipelined end-to-end run");
+    app.add_option("-o,--output", output, "Write JSON results to this file instead of stdout");
+    app.add_option("-c,--config", extra_config, "Also benchmark this TOML configuration");
+    app.add_option("--seed", options.seed, "Generator seed");
+    app.add_option("--error", options.error, "Share of error lines")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--warn", options.warn, "Share of warning lines")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--info", options.info, "Share of info lines")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--debug", options.debug, "Share of debug lines")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--ansi", options.ansi, "Share of lines with ANSI colour codes")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--keyword", options.keyword, "Share of lines mentioning a 50-pattern keyword")->check(CLI::Range(0.0, 1.0));
+    app.add_option("--min-length", options.min_length, "Shortest line");
+    app.add_option("--mean-length", options.mean_length, "Mean line length, the tail is exponential");
+    app.add_option("--max-length", options.max_length, "Longest line");
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return app.exit(e);
+    }
+    if (options.error + options.warn + options.info + options.debug > 1.0) {
+        std::cerr << "Level shares add up to more than 1" << std::endl;
+        return 1;
+    }
+    options.min_length = std::min(options.min_length, options.max_length);
+
+    const fs::path work = fs::temp_directory_path()
+        / ("timbre-bench-" + std::to_string(Clock::now().time_since_epoch().count()));
+    fs::create_directories(work);
+
+    std::fprintf(stderr, "Generating %zu MiB corpus...\n", size_mb);
+    const std::string corpus = generate_corpus(options, size_mb * 1024 * 1024);
+    const std::vector<std::string_view> lines = split_lines(corpus);
+    const fs::path input_path = work / "input.log";
+    std::ofstream(input_path, std::ios::binary).write(corpus.data(), static_cast<std::streamsize>(corpus.size()));
+
+    std::vector<Result> results;
+
+    UserConfig default_config;
+    default_config.set_log_dir((work / "default").string());
+    run_suite("default", default_config, corpus, lines, input_path, repeat, threads, results);
+
+    const fs::path large_path = work / "large.toml";
+    std::ofstream(large_path) << large_config_toml(work / "large");
+    UserConfig large_config;
+    if (large_config.load(large_path.string())) {
+        run_suite("large", large_config, corpus, lines, input_path, repeat, threads, results);
+    }
+
+    if (!extra_config.empty()) {
+        UserConfig user_config;
+        if (!user_config.load(extra_config)) {
+            std::cerr << "Failed to load configuration from: " << extra_config << std::endl;
+        } else {
+            user_config.set_log_dir((work / "user").string());
+            run_suite("user", user_config, corpus, lines, input_path, repeat, threads, results);
+        }
+    }
+
+    std::error_code ec;
+    fs::remove_all(work, ec);
+
+    const std::string json = to_json(options, corpus.size(), results);
+    if (output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(output) << json;
+    }
+    return 0;
+}
@@ -7,6 +7,32 @@
 const std = @import("std");
 const builtin = @import("builtin");
 
+// Every translation unit but the entry points, shared by the executable, the
+// tests, the static analysis steps and the benchmarks
+const sources = [_][]const u8{
+    "src/timbre.cpp",
+    "src/config.cpp",
+    "src/log.cpp",
+    "src/reader.cpp",
+    "src/matcher.cpp",
+    "src/pipeline.cpp",
+    "src/sink.cpp",
+    "src/uring.cpp",
+    "src/stats.cpp",
+    "src/cache.cpp",
+    "src/reload.cpp",
+    "src/compress.cpp",
+    "src/rotate.cpp",
+    "src/repeat.cpp",
+    "src/throttle.cpp",
+    "src/templates.cpp",
+    "src/index.cpp",
+    "src/query.cpp",
+    "src/trigram.cpp",
+    "src/multiline.cpp",
+    "src/structured.cpp",
+};
+
 const targets: []const std.Target.Query = &.{
     .{ .cpu_arch = .aarch64, .os_tag = .macos },
     .{ .cpu_arch = .x86_64, .os_tag = .macos },
@@ -22,6 +48,11 @@ pub fn build(b: *std.Build) void {
 
     const enable_clang_tidy = b.option(bool, "clang-tidy", "Enable clang-tidy static analysis (checks: clang-analyzer-*, portability-*)") orelse false;
     const enable_cppcheck = b.option(bool, "cppcheck", "Enable cppcheck static analysis with third-party library exclusions") orelse false;
+    // Compression codecs link against the system libraries, so they are opt-in and native only
+    const codecs = Codecs{
+        .zlib = b.option(bool, "zlib", "Link zlib for gzip compression of log files") orelse false,
+        .zstd = b.option(bool, "zstd", "Link libzstd for zstd compression of log files") orelse false,
+    };
 
     const exe = b.addExecutable(.{
         .name = "timbre",
@@ -36,6 +67,7 @@ pub fn build(b: *std.Build) void {
         enable_cppcheck,
         getFlags(.cpp, optimize, target.result.os.tag, target.result.cpu.arch),
     );
+    addCodecs(exe, codecs);
     b.installArtifact(exe);
 
     // Add run step for native build
@@ -101,11 +133,7 @@ pub fn build(b: *std.Build) void {
     zig_tests.addIncludePath(.{ .cwd_relative = "inc" }); // Still need the main include directory
 
     zig_tests.addCSourceFiles(.{
-        .files = &.{
-            "src/timbre.cpp",
-            "src/config.cpp",
-            "src/log.cpp",
-        },
+        .files = &(sources ++ [_][]const u8{"tests/bridge.cpp"}),
         .flags = getFlags(.cpp, optimize, target.result.os.tag, target.result.cpu.arch),
     });
 
@@ -117,9 +145,50 @@ pub fn build(b: *std.Build) void {
     });
 
     zig_tests.linkLibCpp();
+    addCodecs(zig_tests, codecs);
 
     const run_zig_tests = b.addRunArtifact(zig_tests);
     test_step.dependOn(&run_zig_tests.step);
+
+    // Benchmarks are always built optimized, numbers from debug builds are meaningless
+    const bench_step = b.step("bench", "Run throughput benchmarks (JSON results on stdout)");
+
+    const bench_exe = b.addExecutable(.{
+        .name = "timbre-bench",
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    bench_exe.addCSourceFiles(.{
+        .files = &([_][]const u8{"bench/bench.cpp"} ++ sources),
+        .flags = getFlags(.cpp, .ReleaseFast, target.result.os.tag, target.result.cpu.arch),
+    });
+
+    bench_exe.addIncludePath(.{ .cwd_relative = "inc" });
+    bench_exe.linkLibCpp();
+    addCodecs(bench_exe, codecs);
+
+    const run_bench = b.addRunArtifact(bench_exe);
+    if (b.args) |args| {
+        run_bench.addArgs(args);
+    }
+    bench_step.dependOn(&run_bench.step);
+}
+
+const Codecs = struct {
+    zlib: bool,
+    zstd: bool,
+};
+
+fn addCodecs(exe: *std.Build.Step.Compile, codecs: Codecs) void {
+    if (codecs.zlib) {
+        exe.root_module.addCMacro("TIMBRE_HAVE_ZLIB", "1");
+        exe.linkSystemLibrary("z");
+    }
+    if (codecs.zstd) {
+        exe.root_module.addCMacro("TIMBRE_HAVE_ZSTD", "1");
+        exe.linkSystemLibrary("zstd");
+    }
 }
 
 const Language = enum {
@@ -219,22 +288,17 @@ fn addSources(exe: *std.Build.Step.Compile, enable_clang_tidy: bool, enable_cppc
     flags.appendSlice(platform_flags) catch unreachable;
 
     if (enable_clang_tidy) {
-        const clang_tidy = exe.step.owner.addSystemCommand(&.{
-            "clang-tidy",
-            "src/main.cpp",
-            "src/timbre.cpp",
-            "src/config.cpp",
-            "src/log.cpp",
+        const clang_tidy = exe.step.owner.addSystemCommand(&([_][]const u8{ "clang-tidy", "src/main.cpp" } ++ sources ++ [_][]const u8{
             "--checks=-*,clang-analyzer-*,portability-*",
             "--",
             "-I./inc",
             "-std=c++17",
-        });
+        }));
         exe.step.dependOn(&clang_tidy.step);
     }
 
     if (enable_cppcheck) {
-        const cppcheck = exe.step.owner.addSystemCommand(&.{
+        const cppcheck = exe.step.owner.addSystemCommand(&([_][]const u8{
             "cppcheck",
             "--suppress=toomanyconfigs",
             "-I",
@@ -243,20 +307,12 @@ fn addSources(exe: *std.Build.Step.Compile, enable_clang_tidy: bool, enable_cppc
             "--suppress=*:./inc/CLI/*",
             "--suppress=*:./tests/*",
             "src/main.cpp",
-            "src/timbre.cpp",
-            "src/config.cpp",
-            "src/log.cpp",
-        });
+        } ++ sources));
         exe.step.dependOn(&cppcheck.step);
     }
 
     exe.addCSourceFiles(.{
-        .files = &.{
-            "src/main.cpp",
-            "src/timbre.cpp",
-            "src/config.cpp",
-            "src/log.cpp",
-        },
+        .files = &([_][]const u8{"src/main.cpp"} ++ sources),
         .flags = flags.items,
     });
 
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "timbre/config.h"
+
+namespace timbre {
+
+/**
+ * On-disk cache of compiled configurations.
+ *
+ * Entries are keyed by a hash of the TOML file's bytes and of the timbre
+ * build, and hold the [timbre] settings, every level's pattern, file,
+ * rotation and compression settings, and the serialized matcher program. A hit skips TOML
+ * parsing and regex compilation entirely; only levels that need the
+ * std::regex fallback compile their pattern. Anything that does not check
+ * out is a miss.
+ */
+class ConfigCache {
+private:
+    std::string _dir;
+
+    std::string entry_path(std::uint64_t key) const;
+public:
+    static constexpr std::uint32_t FORMAT_VERSION = 12;
+
+    explicit ConfigCache(const std::string& dir);
+
+    // $XDG_CACHE_HOME/timbre, else ~/.cache/timbre, else .timbre-cache next to
+    // the config file: the log_dir it sets is only known once it is parsed
+    static std::string default_dir(const std::string& config_path);
+
+    bool enabled() const { return !_dir.empty(); }
+    bool load(const std::string& toml_path, UserConfig& config) const;
+    bool store(const std::string& toml_path, const UserConfig& config) const;
+    // load(), or parse and compile the file and store() the result
+    bool load_or_compile(const std::string& toml_path, UserConfig& config) const;
+};
+
+} // namespace timbre
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace timbre {
+
+/**
+ * Output compression codecs. Each is optional at build time: zig build
+ * -Dzlib=true links zlib for gzip and -Dzstd=true links libzstd, which
+ * define TIMBRE_HAVE_ZLIB and TIMBRE_HAVE_ZSTD respectively.
+ */
+enum class Codec : std::uint8_t { NONE, GZIP, ZSTD };
+
+bool parse_codec(const std::string& name, Codec& codec);
+const char* codec_name(Codec codec);
+const char* codec_extension(Codec codec);  // ".gz", ".zst" or ""
+bool codec_available(Codec codec);
+// Highest compression level of codec: 9 for gzip, 22 for zstd
+int codec_max_level(Codec codec);
+
+/**
+ * Streaming compressor producing concatenated gzip members or zstd
+ * frames. finish() ends the current member/frame, so everything written
+ * up to that point decompresses on its own with the stock tools.
+ */
+class Compressor {
+private:
+    Codec _codec;
+    void* _stream;
+
+    void release();
+public:
+    Compressor();
+    ~Compressor();
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // level 0 picks the codec's default, a level past codec_max_level() its highest
+    bool init(Codec codec, int level = 0);
+    Codec codec() const { return _codec; }
+
+    // Append the compressed form of data to out
+    bool update(std::string_view data, std::string& out);
+    bool finish(std::string& out);
+};
+
+/**
+ * Streaming decompressor for what Compressor (or gzip/zstd) produced,
+ * including any number of concatenated members or frames.
+ */
+class Decompressor {
+private:
+    Codec _codec;
+    void* _stream;
+    bool _in_frame;
+
+    void release();
+public:
+    Decompressor();
+    ~Decompressor();
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    bool init(Codec codec);
+    Codec codec() const { return _codec; }
+
+    // Consume all of data, appending the decompressed bytes to out
+    bool update(std::string_view data, std::string& out);
+    // True if the input ended in the middle of a member/frame
+    bool truncated() const { return _in_frame; }
+};
+
+// Codec whose magic bytes head starts with, NONE when it is not compressed
+Codec detect_codec(std::string_view head);
+// Whether head is the start of a magic number, too short to tell either way
+bool magic_incomplete(std::string_view head);
+
+// Decompress data, the whole of a gzip or zstd file, into out; false on
+// errors or a truncated end, out then holds what could be decompressed
+bool decompress_all(std::string_view data, std::string& out);
+
+// Compress src into dst (written aside and renamed), false on any error
+bool compress_file(const std::string& src, const std::string& dst, Codec codec);
+
+} // namespace timbre
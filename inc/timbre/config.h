@@ -5,27 +5,77 @@
 #include <regex>
 #include <fstream>
 #include "timbre/log.h"
+#include "timbre/matcher.h"
+#include "timbre/multiline.h"
+#include "timbre/repeat.h"
+#include "timbre/rotate.h"
+#include "timbre/stats.h"
+#include "timbre/structured.h"
+#include "timbre/throttle.h"
 
 namespace timbre {
 
+std::regex _re_compile(const std::string& pattern);
+
 struct UserLevel {
-    std::regex pattern;
+    std::string expr;
+    std::regex pattern;  // NOTE: empty for levels restored from the config cache
     std::string path;
-    std::size_t count;
+    Counter count;
+    bool valid = true;   // false when expr failed to compile, the level never matches
+    Rotation rotation;
+    Codec compress = Codec::NONE;  // the file is written compressed, path carries the extension
+    int compress_level = 0;
+    std::int64_t priority = 0;  // higher wins under first-match routing, ties go by name
+    Throttle throttle;
+    std::uint32_t collapse_window = 0;  // repeated line collapse over this many lines, 0 = off
+    Counter dropped;  // lines turned away by throttle
 };
 
 class UserConfig {
 private:
     std::string _log_dir;
+    std::size_t _flush_interval;
+    std::string _io_backend;
+    Routing _routing;
+    bool _throttle_stdout;
+    bool _index;
+    bool _trigram_index;
+    Multiline _multiline;
+    LevelField _level_field;
     std::map<std::string, UserLevel> _levels;
+    Matcher _matcher;
     std::map<std::string, UserLevel> default_levels();
 public:
-    UserConfig(): _log_dir(".timbre"), _levels(default_levels()) {};
+    UserConfig(): _log_dir(".timbre"), _flush_interval(200), _io_backend("sync"), _routing(Routing::FIRST), _throttle_stdout(false), _index(true), _trigram_index(false), _levels(default_levels()), _matcher(_levels, _routing) {};
     bool load(const std::string& filename);
     const std::string& get_log_dir() const { return _log_dir; }
+    std::size_t get_flush_interval() const { return _flush_interval; }
+    const std::string& get_io_backend() const { return _io_backend; }
+    Routing get_routing() const { return _routing; }
+    bool get_throttle_stdout() const { return _throttle_stdout; }
+    bool get_index() const { return _index; }
+    bool get_trigram_index() const { return _trigram_index; }
+    const Multiline& get_multiline() const { return _multiline; }
+    const LevelField& get_level_field() const { return _level_field; }
     std::map<std::string, UserLevel>& get_log_levels() { return _levels; }
+    const std::map<std::string, UserLevel>& get_log_levels() const { return _levels; }
+    const Matcher& get_matcher() const { return _matcher; }
     void set_log_dir(const std::string& dir) { _log_dir = dir; }
-    void set_log_levels(const std::map<std::string, UserLevel>& levels) { _levels = levels; }
+    void set_flush_interval(std::size_t ms) { _flush_interval = ms; }
+    void set_io_backend(const std::string& backend) { _io_backend = backend; }
+    void set_throttle_stdout(bool throttle) { _throttle_stdout = throttle; }
+    void set_index(bool index) { _index = index; }
+    void set_trigram_index(bool index) { _trigram_index = index; }
+    void set_multiline(Multiline multiline) { _multiline = std::move(multiline); }
+    void set_level_field(LevelField field) { _level_field = std::move(field); }
+    void set_routing(Routing routing) { _routing = routing; _matcher = Matcher(_levels, _routing); }
+    void set_log_levels(const std::map<std::string, UserLevel>& levels) { _levels = levels; _matcher = Matcher(_levels, _routing); }
+    void set_compiled_levels(std::map<std::string, UserLevel> levels, Matcher matcher) {
+        _routing = matcher.routing();
+        _levels = std::move(levels);
+        _matcher = std::move(matcher);
+    }
 };
 
 } // namespace timbre
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "timbre/trigram.h"
+
+namespace timbre {
+
+/**
+ * One point of a level file's sidecar index: the byte offset where a line
+ * starts, its 1-based line number and the time it carries, if any.
+ */
+struct IndexEntry {
+    std::uint64_t offset;
+    std::uint64_t line;
+    std::int64_t time_ms;  // NO_TIME when the line has no timestamp
+
+    static constexpr std::int64_t NO_TIME = std::numeric_limits<std::int64_t>::min();
+};
+
+// Milliseconds since the epoch of a leading ISO 8601 style timestamp, e.g.
+// "2024-01-31 14:03:00", "[2024-01-31T14:03:00.123Z]" or "2024/01/31 14:03".
+// Times without a zone are taken as written, as if they were UTC.
+bool parse_timestamp(std::string_view text, std::int64_t& ms);
+
+// A time given on the command line: anything parse_timestamp() takes, or a
+// bare HH:MM[:SS] for its last occurrence at or before latest
+bool parse_time_arg(std::string_view text, std::int64_t latest, std::int64_t& ms);
+
+/**
+ * Writes the sidecar index of one level file, FILE.idx next to it.
+ *
+ * The sink reports every line it buffers; an entry is taken every
+ * INTERVAL_LINES lines or INTERVAL_BYTES bytes, whichever comes first, so
+ * the per line cost is a counter and two compares. Entries are queued and
+ * only appended to the sidecar by written(), after the sink has handed the
+ * data they point at to the kernel.
+ *
+ * Appending to an existing file picks up from the last entry of its index,
+ * or indexes the whole file if it has none, so line numbers stay right.
+ *
+ * Given a TrigramIndexer, every span between two entries is also queued
+ * there as a block once settled() reports it on disk. The block after the
+ * last entry stays open until the file is rotated, queries scan it.
+ */
+class IndexWriter {
+private:
+    std::FILE* _file;
+    std::string _path;
+    std::vector<IndexEntry> _pending;
+    std::uint64_t _lines;  // lines buffered so far
+    std::uint64_t _next_line;
+    std::uint64_t _next_offset;
+    std::string _log_path;
+    TrigramIndexer* _trigrams;  // null when not building a trigram index
+    std::shared_ptr<TrigramIndexer::File> _tri;
+    std::deque<std::uint64_t> _bounds;  // entries written, from the start of block _block on
+    std::uint64_t _block;
+
+    void record(std::uint64_t offset, std::string_view text);
+    bool create();
+    bool write_entries(const std::vector<IndexEntry>& entries);
+    void reset();
+    void disable();
+    void open_trigrams(std::uint64_t max_blocks);
+public:
+    static constexpr std::uint64_t INTERVAL_LINES = 4096;
+    static constexpr std::uint64_t INTERVAL_BYTES = 256 * 1024;
+
+    IndexWriter();
+    ~IndexWriter();
+    IndexWriter(const IndexWriter&) = delete;
+    IndexWriter& operator=(const IndexWriter&) = delete;
+
+    // Index the file at log_path, holding file_bytes already when appending
+    bool open(const std::string& log_path, bool append, std::uint64_t file_bytes,
+              TrigramIndexer* trigrams = nullptr);
+    bool is_open() const { return _file != nullptr; }
+
+    // A line about to be buffered at offset
+    void line(std::uint64_t offset, std::string_view text) {
+        if (++_lines < _next_line && offset < _next_offset) return;
+        record(offset, text);
+    }
+    // Everything buffered so far has been written out
+    void written();
+    // The first bytes of the file are on disk and can be read back
+    void settled(std::uint64_t bytes);
+    // The log file was renamed to segment after bytes_out bytes and restarts
+    // with what the sink still has buffered
+    void rotate(const std::string& segment, std::uint64_t bytes_out, std::string_view buffered);
+    void close();
+};
+
+/**
+ * Sidecar index of a level file, read back for `timbre seek`. A missing or
+ * unreadable index is rebuilt in memory by scanning the file.
+ */
+class LogIndex {
+private:
+    std::vector<IndexEntry> _entries;
+    std::vector<std::size_t> _timed;  // positions of the entries with a timestamp
+public:
+    bool load(const std::string& idx_path, std::uint64_t file_size);
+    void build(std::string_view contents);
+    const std::vector<IndexEntry>& entries() const { return _entries; }
+
+    // The last entry at or before line, or null if there is none
+    const IndexEntry* find_line(std::uint64_t line) const;
+    // The last timestamped entry strictly before time_ms, or null
+    const IndexEntry* find_time(std::int64_t time_ms) const;
+    // The first timestamped entry strictly after time_ms, or null
+    const IndexEntry* find_time_after(std::int64_t time_ms) const;
+    // Latest timestamp in the index, NO_TIME if none
+    std::int64_t last_time() const;
+};
+
+// The time of the last stamped line near the end of text, the time of the
+// last timed entry of index if none is close to the end; what a bare HH:MM
+// is resolved against
+std::int64_t latest_time(std::string_view text, const LogIndex* index);
+
+/**
+ * Print the lines of path from a line number (line > 0) or from the first
+ * line stamped at or after time, at most count of them (0 = to the end).
+ * time takes anything parse_timestamp() does, or a bare HH:MM[:SS] for its
+ * last occurrence in the file. A compressed segment is decompressed into
+ * memory first. Returns a process exit code.
+ */
+int seek_log(const std::string& path, std::uint64_t line, const std::string& time, std::uint64_t count);
+
+} // namespace timbre
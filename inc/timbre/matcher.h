@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace timbre {
+
+struct UserLevel;
+class ByteReader;
+class ByteWriter;
+
+// Where a line matching several levels goes, [timbre] routing in the config
+enum class Routing : std::uint8_t {
+    FIRST,  // only the highest priority level
+    ALL,    // every matching level
+};
+
+bool parse_routing(const std::string& name, Routing& routing);
+
+// Lowercased literals of which at least one occurs in every match of the
+// extended regex expr, or none if no such set could be found
+std::vector<std::string> required_literals(std::string_view expr);
+
+/**
+ * Multi-pattern matcher over all configured levels.
+ *
+ * Every level pattern is parsed as a POSIX extended regex and compiled into
+ * one combined NFA, which is scanned through a lazily built DFA so each line
+ * is walked exactly once. Levels are numbered by descending priority, ties
+ * in name order, and match() reports the lowest numbered level that matches
+ * anywhere in the line. With Routing::ALL the DFA keeps every level's
+ * threads alive instead and match_all() reports the whole match set from
+ * the same single pass. Patterns using constructs the DFA does not model
+ * fall back to std::regex for that level only, keeping `extended | icase`
+ * semantics.
+ *
+ * The compiled program is immutable and shared between copies; DFA state
+ * caches are kept per thread, so a Matcher can be used from many threads.
+ */
+class Matcher {
+public:
+    static constexpr int NO_MATCH = -1;
+    struct Program;
+
+    Matcher();
+    explicit Matcher(const std::map<std::string, UserLevel>& levels, Routing routing = Routing::FIRST);
+
+    int match(std::string_view line) const;
+    // Every matching level in id order; just the first unless routing is ALL
+    void match_all(std::string_view line, std::vector<int>& ids) const;
+    Routing routing() const;
+    const std::string& level_name(int id) const;
+    std::size_t size() const;
+    std::size_t fallback_count() const;
+
+    // Compiled form for the config cache, load() rejects malformed input
+    void save(ByteWriter& out) const;
+    bool load(ByteReader& in);
+private:
+    std::shared_ptr<const Program> _prog;
+};
+
+} // namespace timbre
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "timbre/matcher.h"
+
+namespace timbre {
+
+/**
+ * Grouping of physical lines into events, [multiline] in the config. A line
+ * continues the event before it when it matches continuation, or when it
+ * doesn't match start; only one of the two is set. Patterns are matched
+ * like level patterns, case-insensitively. An event ends after max_lines
+ * lines, or when a continuation line comes more than timeout ms after the
+ * line before it; that line then starts an event of its own.
+ */
+struct Multiline {
+    std::string start;
+    std::string continuation;
+    std::uint32_t max_lines = 500;
+    std::uint64_t timeout = 1000;  // ms, 0 = no limit
+    Matcher matcher;  // for the pattern that is set
+
+    bool enabled() const { return !start.empty() || !continuation.empty(); }
+    // Compile the pattern that is set, false if it is not a valid regex
+    bool compile();
+    // Whether line would continue the event before it
+    bool continues(std::string_view line) const {
+        const bool matched = matcher.match(line) != Matcher::NO_MATCH;
+        return start.empty() ? matched : !matched;
+    }
+};
+
+/**
+ * The event being written. Only its first line is classified; the lines
+ * continuing it go to the levels that kept the first one, so a stack trace
+ * lands in one file as it arrives. Nothing is held back, neither the tee
+ * nor the level files wait for an event to end.
+ */
+class EventGrouper {
+private:
+    std::vector<int> _levels;  // that kept the first line
+    bool _routed;  // the first line matched a level, kept or not
+    std::uint32_t _lines;  // in the event so far, 0 when there is none
+    std::chrono::steady_clock::time_point _last;
+public:
+    EventGrouper() : _routed(false), _lines(0) {}
+
+    // Whether a line that continues() the event before it, arriving at now,
+    // joins it; it is counted in if so
+    bool join(const Multiline& policy, std::chrono::steady_clock::time_point now);
+    // A line starts an event, route() tells where it went
+    void start(std::chrono::steady_clock::time_point now) {
+        _levels.clear();
+        _routed = false;
+        _lines = 1;
+        _last = now;
+    }
+    void route(int level, bool kept) {
+        _routed = true;
+        if (kept) _levels.push_back(level);
+    }
+    // Level ids change with a reload, the next line starts afresh
+    void reset() { _lines = 0; }
+
+    const std::vector<int>& levels() const { return _levels; }
+    bool routed() const { return _routed; }
+};
+
+} // namespace timbre
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include "timbre/config.h"
+#include "timbre/reader.h"
+#include "timbre/sink.h"
+
+namespace timbre {
+
+class ConfigReloader;
+
+/**
+ * Multi-threaded classification.
+ *
+ * A reader thread cuts the input into line-aligned batches, a pool of
+ * worker threads classifies every line of a batch, and the calling thread
+ * writes stdout and the level files strictly in input order. Stages are
+ * connected by bounded lock-free queues; a fixed pool of recycled batches
+ * bounds memory and applies backpressure to the reader.
+ *
+ * With [multiline] grouping, workers leave the lines that continue an
+ * event unclassified and the writer sends them where their event went.
+ *
+ * With a reloader, reloaded rules take effect from the next batch read;
+ * batches already in flight finish on the rules they started with.
+ *
+ * Returns the number of lines processed.
+ */
+std::size_t run_pipeline(
+    UserConfig& config,
+    LineReader& reader,
+    SinkTable& log_files,
+    std::size_t threads,
+    bool quiet = false,
+    const ConfigReloader* reloader = nullptr);
+
+/**
+ * Classify a memory-mapped file in place.
+ *
+ * The mapping is cut into chunks at newline boundaries and the chunks are
+ * fed through the same stages as run_pipeline without being copied. With
+ * one thread the lines go straight through process_line. Output is the
+ * same as piping the file through stdin.
+ *
+ * Returns the number of lines processed.
+ */
+std::size_t run_mapped(
+    UserConfig& config,
+    const MappedFile& file,
+    SinkTable& log_files,
+    std::size_t threads,
+    bool quiet = false);
+
+} // namespace timbre
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "timbre/config.h"
+
+namespace timbre {
+
+/**
+ * A `timbre query` search over stored level files.
+ *
+ * The pattern is compiled by the same Matcher that classifies lines, so it
+ * is a POSIX extended regex matched case-insensitively anywhere in a line;
+ * fixed turns it into a literal. since and until take what `timbre seek
+ * --time` does and bound the search by each line's timestamp, or that of
+ * the nearest stamped line before it.
+ */
+struct Query {
+    std::string pattern;
+    bool fixed = false;
+    std::string since;  // empty = from the start
+    std::string until;  // empty = to the end, inclusive otherwise
+    std::size_t threads = 0;  // 0 = every core
+};
+
+// Level files for the named levels, or every level's, each level's rotated
+// segments oldest first ahead of its live file; false on an unknown name
+bool query_files(const UserConfig& config, const std::vector<std::string>& levels, std::vector<std::string>& files);
+
+/**
+ * Search files one after another. Each is memory-mapped, or decompressed
+ * into memory if it is a compressed segment, narrowed to the time range
+ * through its sidecar index where there is one, less the blocks its
+ * trigram index rules out, and cut into line-aligned chunks that a pool of
+ * threads scans in parallel. Matching
+ * lines are written to stdout in file order, prefixed with the file name
+ * when there are several files, while later chunks are still scanned.
+ *
+ * Returns 0 if any line matched, 1 if none did and 2 on errors, like grep.
+ */
+int run_query(const Query& query, const std::vector<std::string>& files);
+
+} // namespace timbre
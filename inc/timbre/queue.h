@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+namespace timbre {
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue (Vyukov).
+ *
+ * Each cell carries a sequence number that tells producers and consumers
+ * whether it is free for the current lap, so push and pop only contend on
+ * a single compare-and-swap of the head or tail index. Capacity is rounded
+ * up to a power of two.
+ */
+template <typename T>
+class BoundedQueue {
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    std::size_t _mask;
+    alignas(64) std::atomic<std::size_t> _tail;
+    alignas(64) std::atomic<std::size_t> _head;
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t cap = 2;
+        while (cap < n) cap <<= 1;
+        return cap;
+    }
+
+public:
+    explicit BoundedQueue(std::size_t capacity)
+        : _cells(new Cell[round_up(capacity)]), _mask(round_up(capacity) - 1), _tail(0), _head(0) {
+        for (std::size_t i = 0; i <= _mask; ++i) {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool try_push(const T& value) {
+        std::size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = _cells[pos & _mask];
+            const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        std::size_t pos = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = _cells[pos & _mask];
+            const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.seq.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const T& value) {
+        for (unsigned spins = 0; !try_push(value); ++spins) backoff(spins);
+    }
+
+    void pop(T& value) {
+        for (unsigned spins = 0; !try_pop(value); ++spins) backoff(spins);
+    }
+
+    // Spin briefly, then yield, then sleep so an idle stage doesn't burn a core
+    static void backoff(unsigned spins) {
+        if (spins < 64) return;
+        if (spins < 256) {
+            std::this_thread::yield();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+};
+
+} // namespace timbre
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "timbre/compress.h"
+
+namespace timbre {
+
+/**
+ * Block-based line reader.
+ *
+ * Pulls large blocks from a file descriptor with read(2) into a reusable
+ * buffer and hands out lines as string_views into that buffer. A view is
+ * only valid until the next call to next(). Lines that span blocks are
+ * stitched by compacting the tail to the front of the buffer, and lines
+ * longer than the buffer grow it.
+ *
+ * next_block() hands out everything up to the last complete line that is
+ * buffered, for callers that split lines themselves. The idle hook runs
+ * whenever the reader is about to block waiting for more input.
+ *
+ * On Linux, when both input and output are pipes, enable_tee() duplicates
+ * the input into the output pipe with tee(2) inside the kernel before each
+ * block is read, so the pass-through copy never touches userspace.
+ * disable_tee() ends that at the first block boundary that falls between
+ * lines; teed() tells whether the last line or block handed out was teed.
+ *
+ * detect_compression() looks at the first bytes of input before anything
+ * else is read, waiting for more while they could still start a magic
+ * number and the input hasn't ended. Gzip or zstd input is then decompressed on a background
+ * thread that keeps a few blocks ahead of the caller, and lines are cut
+ * from the decompressed text as usual. Compressed input is never teed.
+ */
+class LineReader {
+private:
+    struct Inflating;
+
+    int _fd;
+    int _tee_fd;
+    bool _teed;
+    bool _untee;  // stop teeing once no partial line is buffered
+    std::size_t _teed_end;  // buffer offset up to which input was teed
+    bool _last_teed;
+    std::vector<char> _buffer;
+    std::size_t _begin;
+    std::size_t _end;
+    bool _eof;
+    std::function<void()> _on_idle;
+    std::unique_ptr<Inflating> _inflating;
+    bool fill();
+    long tee_block(char* buf, std::size_t len);
+public:
+    static constexpr std::size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+    static constexpr std::size_t INFLATED_AHEAD = 4;
+
+    explicit LineReader(int fd, std::size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~LineReader();
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    // Call before the first read; returns the codec the input is decompressed with
+    Codec detect_compression();
+    bool next(std::string_view& line);
+    bool next_block(std::string_view& block);
+    void set_idle_hook(std::function<void()> hook) { _on_idle = std::move(hook); }
+    bool enable_tee(int out_fd);
+    void disable_tee() { _untee = true; }
+    bool teeing() const { return _tee_fd >= 0; }
+    bool teed() const { return _last_teed; }
+};
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * Lets already captured logs be classified in place through string_views
+ * instead of being copied through a read buffer. An empty file maps to an
+ * empty view.
+ */
+class MappedFile {
+private:
+    const char* _data;
+    std::size_t _size;
+    std::string _path;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    std::string_view view() const { return std::string_view(_data, _size); }
+    const std::string& path() const { return _path; }
+};
+
+const char* find_newline(const char* begin, const char* end);
+const char* find_last_newline(const char* begin, const char* end);
+
+} // namespace timbre
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include "timbre/config.h"
+
+namespace timbre {
+
+/**
+ * Rebuilds the configuration in the background on SIGHUP, or when the
+ * config file is rewritten if watching is enabled (inotify, Linux only).
+ *
+ * Each successful rebuild is published as a new immutable UserConfig with
+ * an RCU style pointer swap and a bump of generation(). Readers check the
+ * generation once per line or batch and pick up current() when it moves;
+ * whatever was already classified finishes on the rules it was classified
+ * with, since it holds a reference to them. A rebuild that fails keeps the
+ * current rules.
+ *
+ * The apply hook re-applies command line overrides to every new config.
+ * io_backend is only honoured at startup. A reload that sets
+ * throttle_stdout ends the tee(2) pass-through; one that clears it keeps
+ * echoing lines from userspace.
+ */
+class ConfigReloader {
+private:
+    std::string _path;
+    std::string _cache_dir;
+    std::function<void(UserConfig&)> _apply;
+    std::shared_ptr<UserConfig> _current;  // only touched with std::atomic_load/store
+    std::atomic<std::uint64_t> _generation;
+    std::thread _thread;
+    int _wake[2];
+    int _watch;
+
+    void run();
+public:
+    ConfigReloader(const std::string& path, const std::string& cache_dir, std::function<void(UserConfig&)> apply);
+    ~ConfigReloader();
+    ConfigReloader(const ConfigReloader&) = delete;
+    ConfigReloader& operator=(const ConfigReloader&) = delete;
+
+    // Install the SIGHUP handler (one reloader per process) and start the thread
+    bool start(bool watch);
+    void stop();
+
+    // Rebuild now on the calling thread, true if a new config was published
+    bool reload();
+
+    // 0 until the first reload, the config the caller started with
+    std::uint64_t generation() const { return _generation.load(std::memory_order_acquire); }
+    std::shared_ptr<UserConfig> current() const { return std::atomic_load(&_current); }
+};
+
+} // namespace timbre
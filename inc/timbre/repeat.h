@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace timbre {
+
+class Sink;
+
+// Fast 64-bit non-cryptographic hash, 8 bytes at a time
+std::uint64_t hash_line(std::string_view line);
+
+/**
+ * Repeated line collapse in front of one Sink, like syslog's "last message
+ * repeated N times". The last `window` distinct lines written are kept with
+ * their hashes; a line equal to one of them is only counted. A run of the
+ * line written last is reported as soon as any other line arrives, as
+ * "last message repeated"; other counts are written as a record once their
+ * line leaves the window, REPEAT_INTERVAL after its first repeat, or on
+ * flush(), so every line is still accounted for. Such a record comes after
+ * lines that arrived between the repeats, and doesn't say where they were:
+ * a window trades their order for fewer records. Lines are compared in
+ * full, a hash collision never drops a line.
+ */
+class RepeatCollapser {
+private:
+    struct Entry {
+        bool used = false;
+        std::uint64_t hash = 0;
+        std::string text;
+        std::uint64_t repeats = 0;
+        std::chrono::steady_clock::time_point since;  // of the first uncounted repeat
+    };
+
+    Sink* _sink;
+    std::vector<Entry> _window;
+    std::size_t _next;  // slot to fill next, the oldest line once the window is full
+    std::size_t _last;  // slot of the line written last, NONE once another line arrives
+
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+    void emit(std::size_t slot);
+public:
+    static constexpr std::size_t MAX_WINDOW = 64;
+    static constexpr std::chrono::seconds REPEAT_INTERVAL{30};
+
+    RepeatCollapser(Sink& sink, std::size_t window);
+
+    std::size_t window() const { return _window.size(); }
+    void write_line(std::string_view line);
+    // Written as is, for lines that aren't log content such as throttle markers
+    void write_verbatim(std::string_view line);
+    void flush_if_due(std::chrono::steady_clock::time_point now);
+    // Write every outstanding count
+    void flush();
+};
+
+} // namespace timbre
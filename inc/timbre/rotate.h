@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "timbre/compress.h"
+
+namespace timbre {
+
+/**
+ * Per level rotation policy from the config. A file is rotated before a
+ * line would take it past max_size, or once it was opened more than
+ * max_age seconds ago. A compressed file is rotated on its size on disk,
+ * checked whenever the sink hands its buffer over, so it can overshoot
+ * max_size by what one buffer compresses to.
+ */
+struct Rotation {
+    std::uint64_t max_size = 0;  // bytes, 0 = no size limit
+    std::uint64_t max_age = 0;   // seconds, 0 = no age limit
+    std::uint32_t keep = 0;      // rotated segments to keep, 0 = all of them
+    Codec compress = Codec::NONE;
+
+    bool enabled() const { return max_size > 0 || max_age > 0; }
+};
+
+// base.YYYYmmdd-HHMMSS, with a -N suffix if that segment already exists;
+// a .gz or .zst extension of base stays at the end
+std::string rotated_name(const std::string& base);
+// The rotated segments of base on disk, compressed or not, oldest first
+std::vector<std::string> rotated_segments(const std::string& base);
+
+/**
+ * Background worker for rotated segments: compresses each one and prunes
+ * the oldest beyond the policy's keep count. The sink only renames and
+ * reopens its file, so the write path never waits on compression. The
+ * thread is started on the first segment and runs at low priority.
+ */
+class Archiver {
+private:
+    struct Job {
+        std::string segment;
+        std::string base;
+        Rotation policy;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<Job> _jobs;
+    std::thread _thread;
+    bool _stop;
+
+    void run();
+    static void archive(const Job& job);
+    static void prune(const std::string& base, std::uint32_t keep);
+public:
+    Archiver();
+    ~Archiver();
+    Archiver(const Archiver&) = delete;
+    Archiver& operator=(const Archiver&) = delete;
+
+    void submit(const std::string& segment, const std::string& base, const Rotation& policy);
+    // Finish every queued segment and stop the thread
+    void stop();
+};
+
+} // namespace timbre
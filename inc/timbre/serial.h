@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace timbre {
+
+/**
+ * Minimal binary encoding for on-disk caches.
+ *
+ * Values are stored in host byte order and layout; caches are only ever
+ * read back by the same build on the same machine, which the caller
+ * checks with a header before trusting the contents.
+ */
+class ByteWriter {
+private:
+    std::string& _out;
+public:
+    explicit ByteWriter(std::string& out) : _out(out) {}
+
+    template <typename T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "put() needs a trivially copyable type");
+        _out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void put(const std::string& value) {
+        put(static_cast<std::uint64_t>(value.size()));
+        _out.append(value);
+    }
+
+    template <typename T>
+    void put(const std::vector<T>& values) {
+        put(static_cast<std::uint64_t>(values.size()));
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            _out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        } else {
+            for (const auto& value : values) put(value);
+        }
+    }
+};
+
+/**
+ * Reads what ByteWriter wrote. Any overrun latches ok() to false and
+ * leaves the remaining reads as no-ops, so callers check once at the end.
+ */
+class ByteReader {
+private:
+    std::string_view _in;
+    std::size_t _pos;
+    bool _ok;
+
+    bool take(void* dst, std::size_t len) {
+        if (!_ok || _in.size() - _pos < len) {
+            _ok = false;
+            return false;
+        }
+        if (len > 0) std::memcpy(dst, _in.data() + _pos, len);
+        _pos += len;
+        return true;
+    }
+
+    bool take_size(std::uint64_t& size, std::size_t element) {
+        get(size);
+        // Reject sizes the remaining bytes could not possibly hold
+        if (_ok && element > 0 && size > (_in.size() - _pos) / element) _ok = false;
+        return _ok;
+    }
+public:
+    explicit ByteReader(std::string_view in) : _in(in), _pos(0), _ok(true) {}
+
+    bool ok() const { return _ok; }
+    bool done() const { return _ok && _pos == _in.size(); }
+
+    template <typename T>
+    bool get(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "get() needs a trivially copyable type");
+        return take(&value, sizeof(T));
+    }
+
+    bool get(std::string& value) {
+        std::uint64_t size = 0;
+        if (!take_size(size, 1)) return false;
+        value.assign(_in.data() + _pos, static_cast<std::size_t>(size));
+        _pos += static_cast<std::size_t>(size);
+        return true;
+    }
+
+    template <typename T>
+    bool get(std::vector<T>& values) {
+        std::uint64_t size = 0;
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            if (!take_size(size, sizeof(T))) return false;
+            values.resize(static_cast<std::size_t>(size));
+            return take(values.data(), values.size() * sizeof(T));
+        } else {
+            if (!take_size(size, 1)) return false;
+            values.resize(static_cast<std::size_t>(size));
+            for (auto& value : values) {
+                if (!get(value)) return false;
+            }
+            return true;
+        }
+    }
+};
+
+} // namespace timbre
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "timbre/compress.h"
+#include "timbre/config.h"
+#include "timbre/index.h"
+#include "timbre/multiline.h"
+#include "timbre/repeat.h"
+#include "timbre/rotate.h"
+#include "timbre/stats.h"
+#include "timbre/throttle.h"
+#include "timbre/trigram.h"
+#include "timbre/uring.h"
+
+namespace timbre {
+
+/**
+ * Buffered append-only writer for one file or descriptor.
+ *
+ * Lines are copied into a large aligned buffer that is handed to the kernel
+ * with write(2) only when it fills up or the flush interval has passed. A
+ * line that does not fit goes out together with the buffer in one writev(2).
+ *
+ * A sink opened on an IoRing instead submits full buffers as positioned
+ * writes and carries on filling a spare one, so up to MAX_IN_FLIGHT buffers
+ * per file can be waiting on slow storage without blocking the caller.
+ *
+ * With a rotation policy the sink renames its file aside and reopens it
+ * once it is due, then hands the segment to the Archiver. A line that would
+ * take a file past max_size starts the next segment, so plain segments stay
+ * within it unless a single line is larger.
+ *
+ * A compressed sink hands full buffers to its own compression thread
+ * instead, which writes one gzip member or zstd frame at least every
+ * FRAME_INTERVAL, so a crash loses no more than that plus the flush
+ * interval. Compressed sinks always write synchronously from that thread.
+ *
+ * An indexed sink keeps FILE.idx next to its file through an IndexWriter,
+ * which moves along with the file on rotation. Compressed files are not
+ * indexed, their offsets don't map to lines. Given a TrigramIndexer the
+ * IndexWriter also feeds it the blocks between entries, once they are
+ * written: right away for write(2), when their ring writes complete
+ * otherwise.
+ */
+class Sink {
+private:
+    struct AlignedDelete {
+        void operator()(char* p) const;
+    };
+    using Buffer = std::unique_ptr<char[], AlignedDelete>;
+    struct Pending;
+    struct Compressing;
+
+    int _fd;
+    bool _owned;
+    bool _failed;
+    std::string _path;
+    Buffer _buffer;
+    std::size_t _capacity;
+    std::size_t _size;
+    std::chrono::steady_clock::time_point _last_flush;
+    IoRing* _ring;
+    std::uint64_t _offset;
+    std::vector<Buffer> _spare;
+    std::size_t _pending;
+    Counter _written;
+    bool _lazy;
+    bool _append;
+    Rotation _rotation;
+    Archiver* _archiver;
+    std::uint64_t _file_bytes;
+    std::chrono::steady_clock::time_point _opened;
+    Codec _codec;
+    int _codec_level;
+    std::unique_ptr<Compressing> _compressing;
+    bool _indexed;
+    TrigramIndexer* _trigrams;
+    IndexWriter _index;
+
+    bool open_file(const std::string& path, bool append, IoRing* ring);
+    bool write_out(std::string_view extra);
+    bool write_sync(std::string_view extra);
+    bool write_ring(std::string_view extra);
+    bool write_compressed(std::string_view extra);
+    bool rotation_due() const;
+    bool rotate_before();
+    void rotate();
+    void release();
+    bool submit_buffer();
+    bool open_lazy();
+    void complete(Pending* op, int result);
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 1 << 20;
+    static constexpr std::size_t ALIGNMENT = 4096;
+    static constexpr std::size_t MAX_IN_FLIGHT = 8;
+    static constexpr std::chrono::milliseconds FRAME_INTERVAL{1000};
+
+    explicit Sink(std::size_t capacity = DEFAULT_CAPACITY);
+    ~Sink();
+    Sink(const Sink&) = delete;
+    Sink& operator=(const Sink&) = delete;
+
+    bool open(const std::string& path, bool append, IoRing* ring = nullptr);
+    // Like open(), but the file is only created once there is data to write
+    void defer_open(const std::string& path, bool append, IoRing* ring = nullptr);
+    void attach(int fd, const std::string& name);
+    void set_rotation(const Rotation& rotation, Archiver* archiver);
+    // Takes effect on the next open()
+    void set_compression(Codec codec, int level = 0);
+    // Takes effect on the next open(); trigrams, if given, outlives the sink
+    void set_index(bool indexed, TrigramIndexer* trigrams = nullptr) {
+        _indexed = indexed;
+        _trigrams = trigrams;
+    }
+    // Switch to new compression or index settings, reopening the file for
+    // appending on the next write; false if they are the ones in use
+    bool reconfigure(Codec codec, int level, bool indexed, TrigramIndexer* trigrams, IoRing* ring);
+    bool is_open() const { return _fd >= 0; }
+    const std::string& path() const { return _path; }
+    std::uint64_t bytes_written() const { return _written.load(); }
+
+    bool write(std::string_view data);
+    bool write_line(std::string_view line);
+    bool flush();
+    bool flush_if_due(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval);
+    void close();
+
+    // Submit queued writes, wait for at least wait_for and retire every finished one
+    static bool reap(IoRing& ring, unsigned wait_for);
+};
+
+/**
+ * Sinks for every level, indexed by the dense level id the matcher
+ * reports, plus the stdout tee. Levels that share a file share a Sink.
+ * With the uring backend the level files share one ring; stdout is always
+ * written synchronously.
+ *
+ * rebind() switches to a reloaded configuration: sinks for files that are
+ * still in use stay open, unless their compression or index settings
+ * changed and they are reopened for appending, new files are opened on
+ * first write and files no longer referenced are flushed and closed. Level counters carry over
+ * by name. Only the visit_* functions may be called from other threads.
+ *
+ * Levels with a throttle get a RateLimiter that admit() consults before a
+ * line reaches the sink; poll() writes a marker with the number of lines
+ * dropped into the level's file every RateLimiter::MARKER_INTERVAL, and
+ * close() writes the last one. The stdout tee is not throttled here.
+ *
+ * A file whose (first) level asks for collapse_repeats is written through a
+ * RepeatCollapser shared by every level writing to it.
+ *
+ * With [multiline] grouping, event() is the event being written; it is
+ * reset by rebind(), the level ids it holds belong to the old rules.
+ */
+class SinkTable {
+private:
+    struct Slot {
+        const std::string* name;
+        UserLevel* level;
+        Sink* sink;
+        RateLimiter* limiter;  // null for unthrottled levels
+        RepeatCollapser* collapser;  // null unless the file collapses repeats
+    };
+
+    std::unique_ptr<IoRing> _ring;  // outlives the sinks that submit to it
+    std::unique_ptr<Archiver> _archiver;  // likewise, for the segments they rotate out
+    std::unique_ptr<TrigramIndexer> _trigrams;  // and for the blocks they have written
+    std::vector<std::unique_ptr<Sink>> _files;
+    std::vector<Slot> _slots;
+    std::map<std::string, std::unique_ptr<RateLimiter>> _limiters;  // by level name
+    std::map<const Sink*, std::unique_ptr<RepeatCollapser>> _collapsers;
+    std::unique_ptr<Sink> _stdout;
+    std::chrono::milliseconds _interval;
+    unsigned _ticks;
+    bool _append;
+    void write_markers(bool force);
+    static void write_verbatim(const Slot& slot, std::string_view line);
+    std::shared_ptr<UserConfig> _bound;  // keeps a reloaded config alive while routed to
+    std::unique_ptr<std::mutex> _lock;  // guards _files and _slots against visitors
+    EventGrouper _event;
+public:
+    static constexpr unsigned TICKS_PER_CLOCK_CHECK = 1024;
+
+    SinkTable();
+    SinkTable(SinkTable&&) = default;
+
+    void open(UserConfig& config, bool append);
+    void rebind(std::shared_ptr<UserConfig> config);
+    bool empty() const { return _files.empty(); }
+    bool async() const { return _ring != nullptr; }
+    std::size_t size() const { return _slots.size(); }
+
+    UserLevel& level(int id) { return *_slots[static_cast<std::size_t>(id)].level; }
+    const std::string& level_name(int id) const { return *_slots[static_cast<std::size_t>(id)].name; }
+    Sink& sink(int id) { return *_slots[static_cast<std::size_t>(id)].sink; }
+    // Whether the level's throttle lets this line through, counting it as dropped if not
+    bool admit(int id) {
+        const Slot& slot = _slots[static_cast<std::size_t>(id)];
+        if (slot.limiter == nullptr || slot.limiter->admit()) return true;
+        ++slot.level->dropped;
+        return false;
+    }
+    void write_line(int id, std::string_view line) {
+        const Slot& slot = _slots[static_cast<std::size_t>(id)];
+        if (slot.collapser != nullptr) {
+            slot.collapser->write_line(line);
+        } else {
+            slot.sink->write_line(line);
+        }
+    }
+    Sink& out() { return *_stdout; }
+    EventGrouper& event() { return _event; }
+    const std::vector<std::unique_ptr<Sink>>& files() const { return _files; }
+
+    void visit_levels(const std::function<void(const std::string&, const UserLevel&)>& fn) const;
+    void visit_files(const std::function<void(const Sink&)>& fn) const;
+
+    void set_flush_interval(std::chrono::milliseconds interval) { _interval = interval; }
+    void tick();
+    void poll();
+    void flush();
+    void close();
+};
+
+} // namespace timbre
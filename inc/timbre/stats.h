@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace timbre {
+
+class SinkTable;
+
+/**
+ * Monotonic counter with a single writer and any number of readers.
+ *
+ * Increments are a relaxed load and store, not a locked add, so bumping it
+ * on every line costs no more than a plain integer. Copies take a snapshot
+ * so structs holding one stay copyable.
+ */
+class Counter {
+private:
+    std::atomic<std::uint64_t> _value;
+public:
+    Counter(std::uint64_t value = 0) : _value(value) {}
+    Counter(const Counter& other) : _value(other.load()) {}
+    Counter& operator=(const Counter& other) {
+        _value.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    Counter& operator+=(std::uint64_t n) {
+        _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        return *this;
+    }
+    Counter& operator++() { return *this += 1; }
+    std::uint64_t operator++(int) {
+        const std::uint64_t old = load();
+        *this += 1;
+        return old;
+    }
+    std::uint64_t load() const { return _value.load(std::memory_order_relaxed); }
+    operator std::uint64_t() const { return load(); }
+};
+
+/**
+ * Log-linear latency histogram in nanoseconds (HDR style).
+ *
+ * Every power of two is split into SUB_BUCKETS linear buckets, so any
+ * recorded value is reported within ~3% of its true value from a couple
+ * of cache lines per range. Recording is wait-free from any thread.
+ */
+class Histogram {
+public:
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr std::size_t SUB_BUCKETS = std::size_t{1} << SUB_BITS;
+    static constexpr std::size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    struct Summary {
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+        std::uint64_t p50 = 0;
+        std::uint64_t p90 = 0;
+        std::uint64_t p99 = 0;
+        std::uint64_t p999 = 0;
+    };
+
+    Histogram();
+    void record(std::uint64_t ns);
+    Summary summary() const;
+private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> _buckets;
+    std::atomic<std::uint64_t> _sum;
+    std::atomic<std::uint64_t> _max;
+
+    static std::size_t bucket(std::uint64_t value);
+    static std::uint64_t bucket_high(std::size_t index);
+};
+
+/**
+ * Process wide throughput and latency counters.
+ *
+ * Per level line counts live in UserLevel::count and bytes per file in the
+ * Sinks; these are the counters that belong to neither. Hot paths only
+ * touch them when Stats::enabled() is set.
+ */
+struct Stats {
+    Counter lines_in;   // bumped by the thread writing output
+    Counter bytes_in;   // bumped by the thread reading input
+    std::atomic<std::uint64_t> regex_evaluations{0};
+    Histogram classify_ns;
+    Histogram sink_write_ns;
+
+    // Only one in SAMPLE_EVERY classifications is timed, the clock isn't free
+    static constexpr std::uint64_t SAMPLE_EVERY = 64;
+
+    static inline bool active = false;
+    static bool enabled() { return active; }
+    static std::uint64_t now_ns() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Lines run through the level matcher, every thread's count added up,
+    // those of threads that have exited included
+    std::uint64_t classifications() const;
+    // The calling thread's count, bumped by it alone for as long as it runs
+    Counter& thread_classifications();
+private:
+    struct ThreadCount;
+    mutable std::mutex _classified_mutex;
+    std::vector<const Counter*> _classified_live;
+    std::uint64_t _classified_exited = 0;
+};
+
+Stats& stats();
+
+/**
+ * Background thread that periodically writes a snapshot of Stats, the
+ * level counters and the sink counters.
+ *
+ * The target is "stderr" (or "-") for JSON lines on stderr, a path ending
+ * in .prom for a Prometheus text file rewritten atomically for
+ * node_exporter's textfile collector, or any other path for JSON lines
+ * appended to that file. A final snapshot is written on stop().
+ */
+class StatsReporter {
+private:
+    enum class Format { JSON, PROMETHEUS };
+
+    SinkTable& _log_files;
+    std::string _target;
+    Format _format;
+    std::chrono::milliseconds _interval;
+    std::chrono::steady_clock::time_point _started;
+    std::chrono::steady_clock::time_point _last;
+    std::uint64_t _last_lines;
+    std::uint64_t _last_bytes;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stop;
+
+    std::string to_json();
+    std::string to_prometheus();
+    void write_snapshot();
+public:
+    StatsReporter(SinkTable& log_files, const std::string& target, std::chrono::milliseconds interval);
+    ~StatsReporter();
+    StatsReporter(const StatsReporter&) = delete;
+    StatsReporter& operator=(const StatsReporter&) = delete;
+
+    void start();
+    void stop();
+};
+
+} // namespace timbre
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace timbre {
+
+// Severity prefixes recognized at the start of a line, [timbre] level_prefixes
+enum class Prefix : std::uint8_t {
+    GLOG = 1,     // glog/klog "E0418 12:00:00.123456 ...", one of I W E F
+    SYSLOG = 2,   // "<3>", the severity of a syslog priority
+    BRACKET = 4,  // "[WARN] ...", a severity word in brackets
+};
+
+bool parse_prefix(const std::string& name, Prefix& prefix);
+
+// The default level a severity belongs to when it goes by another name,
+// "error" for "fatal", "CRIT" or "emerg"; empty for any other value
+std::string_view default_level(std::string_view severity);
+
+/**
+ * The level field of structured lines, [timbre] level_keys in the config.
+ *
+ * A line starting with '{' is read as a JSON object, any other as logfmt
+ * (key=value pairs). Neither is parsed: one SSE2 scan visits the quotes and
+ * equals signs of the line, skipping over quoted strings, until it finds
+ * one of the keys, so a level mentioned inside a message is never taken for
+ * the field. Numeric levels are named first, syslog severities 0-7 and the
+ * bunyan/pino 10-60 scale, e.g. 3 and 50 both read as "error".
+ *
+ * A severity prefix, when one is enabled, is looked for first: it takes
+ * the first few bytes of the line and no scan at all.
+ */
+class LevelField {
+private:
+    std::vector<std::string> _keys;
+    std::uint8_t _prefixes;  // Prefix bits
+public:
+    LevelField() : _prefixes(0) {}
+    LevelField(std::vector<std::string> keys, std::uint8_t prefixes) : _keys(std::move(keys)), _prefixes(prefixes) {}
+
+    bool enabled() const { return _prefixes != 0 || !_keys.empty(); }
+    const std::vector<std::string>& keys() const { return _keys; }
+    std::uint8_t prefixes() const { return _prefixes; }
+
+    // The severity prefix of line, or else the value of the first of the keys
+    // found in it; false if there is neither
+    bool find(std::string_view line, std::string_view& value) const;
+};
+
+} // namespace timbre
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace timbre {
+
+/**
+ * Online log template mining in the style of Drain, per level.
+ *
+ * A line is split on whitespace and numbers, hex strings, UUIDs and paths
+ * are masked. It then descends a fixed-depth parse tree, keyed by its token
+ * count and first two tokens, to a short list of templates and joins the
+ * most similar one, turning the positions that differ into <*>, or starts a
+ * new template when none shares at least SIMILARITY of its tokens. Each
+ * level keeps at most MAX_TEMPLATES, evicting the least recently matched;
+ * lines of evicted templates are still counted in the report.
+ *
+ * Every thread routing lines mines into trees of its own, a shard, so add()
+ * only takes a lock nobody else wants between reports. The report merges the
+ * shards' templates into one tree per level the same way lines are joined,
+ * and is written to stderr every interval from a thread of its own, and once
+ * more on stop(). A shard outlives its thread and is handed to the next one
+ * started. Hot paths only call add() when TemplateMiner::enabled() is set.
+ */
+class TemplateMiner {
+private:
+    struct Template {
+        std::vector<std::string> tokens;
+        std::uint64_t count = 0;
+        std::uint64_t leaf = 0;
+    };
+    struct Tree {
+        std::list<Template> lru;  // most recently matched first
+        std::unordered_map<std::uint64_t, std::vector<std::list<Template>::iterator>> leaves;
+        std::uint64_t lines = 0;
+        std::uint64_t evicted = 0;  // lines of templates no longer kept
+    };
+
+    struct Shard {
+        std::mutex mutex;  // taken by its thread for every line, by report() to read it
+        std::map<std::string, Tree> trees;
+        std::vector<std::string> tokens;  // scratch for add()
+        std::string last_level;
+        Tree* last_tree = nullptr;
+        bool taken = false;  // by a running thread, guarded by _mutex
+    };
+
+    std::mutex _mutex;  // guards _shards and _stop
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::size_t _top;
+    std::chrono::milliseconds _interval;
+    std::thread _thread;
+    std::condition_variable _wake;
+    bool _stop;
+
+    Shard& shard();
+    static void tokenize(std::string_view line, std::vector<std::string>& tokens);
+    static void add_tokens(Tree& tree, const std::vector<std::string>& tokens, std::uint64_t count);
+public:
+    static constexpr std::size_t MAX_TEMPLATES = 1024;
+    static constexpr double SIMILARITY = 0.5;
+
+    TemplateMiner();
+    ~TemplateMiner();
+    TemplateMiner(const TemplateMiner&) = delete;
+    TemplateMiner& operator=(const TemplateMiner&) = delete;
+
+    // Report the top templates per level every interval (0 = only on stop)
+    void start(std::size_t top, std::chrono::milliseconds interval);
+    void stop();
+
+    void add(const std::string& level, std::string_view line);
+    std::string report();
+
+    static inline bool active = false;
+    static bool enabled() { return active; }
+};
+
+TemplateMiner& templates();
+
+} // namespace timbre
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace timbre {
+
+/**
+ * Per level sampling and rate limit from the config. sample_rate keeps that
+ * fraction of the level's lines, max_lines_per_sec then caps what is left
+ * with a token bucket that allows bursts of up to one second's worth.
+ */
+struct Throttle {
+    double sample_rate = 1.0;            // 1 = keep every line
+    std::uint64_t max_lines_per_sec = 0; // 0 = no limit
+
+    bool enabled() const { return sample_rate < 1.0 || max_lines_per_sec > 0; }
+};
+
+/**
+ * Admission state for one throttled level. Sampling is an accumulator
+ * rather than a random draw, so the kept lines are spread evenly and the
+ * first line of a burst always gets through. Lines turned away are tallied
+ * until marker() reports them, at most once every MARKER_INTERVAL.
+ */
+class RateLimiter {
+private:
+    Throttle _policy;
+    double _credit;
+    double _tokens;
+    std::chrono::steady_clock::time_point _refilled;
+    std::uint64_t _unreported;
+    std::chrono::steady_clock::time_point _reported;
+public:
+    static constexpr std::chrono::seconds MARKER_INTERVAL{10};
+
+    explicit RateLimiter(const Throttle& policy);
+
+    // Keeps the bucket and the unreported tally, for a reloaded config
+    void set_policy(const Throttle& policy);
+    const Throttle& policy() const { return _policy; }
+
+    bool admit();
+
+    // Summary line for the lines dropped since the last one, empty when
+    // there are none or the interval hasn't passed and force is false
+    std::string marker(const std::string& level, std::chrono::steady_clock::time_point now, bool force = false);
+};
+
+} // namespace timbre
@@ -1,18 +1,35 @@
 #pragma once
 
+#include <chrono>
 #include <string>
-#include <fstream>
 #include <regex>
 #include <string_view>
-#include <map>
+#include <vector>
 #include "timbre/config.h"
+#include "timbre/sink.h"
 
 namespace timbre {
 
 void print_version();
 bool match(const std::string& line, const std::regex& pattern);
-void process_line(UserConfig& config, const std::string& line, std::map<std::string, std::ofstream>& log_files, bool quiet = false);
-std::map<std::string, std::ofstream> open_log_files(UserConfig& config, bool append);
-void close_log_files(std::map<std::string, std::ofstream>& log_files);
+bool match(std::string_view line, const std::regex& pattern);
+void process_line(UserConfig& config, const std::string& line, SinkTable& log_files, bool quiet = false);
+void process_line(UserConfig& config, std::string_view line, SinkTable& log_files, bool quiet = false);
+// A line is classified by its severity prefix or level field alone when that
+// names a level, by the whole line otherwise. Counted and
+// timed for the stats when they are enabled
+int classify_line(const Matcher& matcher, const LevelField& field, std::string_view line);
+void classify_line(const Matcher& matcher, const LevelField& field, std::string_view line, std::vector<int>& ids);
+bool route_line(int level, std::string_view line, SinkTable& log_files);
+// Classify one line and route it to its levels, telling event where it went
+void classify_and_route(const Matcher& matcher, const LevelField& field, std::string_view line, SinkTable& log_files,
+                        EventGrouper* event, bool& routed, bool& kept);
+// With [multiline]: a line that continues the open event goes where it went,
+// any other one starts an event and is classified
+void route_grouped(const Matcher& matcher, const LevelField& field, const Multiline& multiline, bool continues,
+                   std::chrono::steady_clock::time_point now, std::string_view line, SinkTable& log_files,
+                   bool& routed, bool& kept);
+SinkTable open_log_files(UserConfig& config, bool append);
+void close_log_files(SinkTable& log_files);
 
 } 
\ No newline at end of file
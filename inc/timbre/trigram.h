@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace timbre {
+
+/**
+ * Background builder of trigram indexes, FILE.tri next to a level file.
+ *
+ * The blocks of a file are the spans between consecutive entries of its
+ * .idx sidecar. Once a block is on disk the sink's IndexWriter queues it
+ * here, and the indexer thread reads it back through a descriptor of its
+ * own, which stays valid across rotation, noting which lowercased byte
+ * trigrams its lines contain. Blocks are grouped into runs of at most
+ * BLOCKS_PER_RUN, each written as the sorted trigrams of the run with the
+ * bitmap of the blocks holding them, delta and varint coded.
+ *
+ * A run is written out early once it holds MAX_RUN_POSTINGS trigram and
+ * block pairs, which bounds the memory per file however varied the text.
+ * The thread starts with the first block and runs at low priority, like
+ * the Archiver, so the write path only pays for queueing a block.
+ */
+class TrigramIndexer {
+public:
+    struct File;
+private:
+    struct Job {
+        std::shared_ptr<File> file;
+        std::uint64_t block;
+        std::uint64_t begin;
+        std::uint64_t end;
+        bool finish;  // no more blocks, write the last run and close
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::deque<Job> _jobs;
+    std::vector<const File*> _active;  // opened and not finished yet
+    std::thread _thread;
+    bool _stop;
+    std::vector<std::uint64_t> _seen;  // bitmap over every trigram, for the block being read
+    std::vector<std::uint32_t> _found;  // trigrams set in _seen
+    std::vector<char> _buffer;
+
+    void submit(Job job);
+    void run();
+    void index_block(File& file, std::uint64_t block, std::uint64_t begin, std::uint64_t end);
+    static bool write_run(File& file);
+    static void close_file(File& file);
+public:
+    static constexpr std::uint32_t BLOCKS_PER_RUN = 64;
+    static constexpr std::size_t MAX_RUN_POSTINGS = 1 << 21;
+    static constexpr std::size_t READ_SIZE = 64 * 1024;
+
+    TrigramIndexer();
+    ~TrigramIndexer();
+    TrigramIndexer(const TrigramIndexer&) = delete;
+    TrigramIndexer& operator=(const TrigramIndexer&) = delete;
+
+    // FILE.tri for the log file at log_path, null on errors. An existing one
+    // covering no more than max_blocks blocks is carried on, blocks is set to
+    // the number it covers; anything else is started over.
+    std::shared_ptr<File> open(const std::string& log_path, std::uint64_t max_blocks, std::uint64_t& blocks);
+    // Index bytes [begin, end) of the file as the given block; blocks come in order
+    void add(const std::shared_ptr<File>& file, std::uint64_t block, std::uint64_t begin, std::uint64_t end);
+    // The log file was renamed to segment, its index follows it
+    void rename(const std::shared_ptr<File>& file, const std::string& segment);
+    void finish(const std::shared_ptr<File>& file);
+    // Finish every queued block and stop the thread
+    void stop();
+};
+
+/**
+ * A FILE.tri read back for `timbre query`, which then only scans the
+ * blocks that can hold a match. Blocks no run covers, like those written
+ * since the last run, are always candidates.
+ */
+class TrigramIndex {
+private:
+    struct Run {
+        std::uint64_t first_block;
+        std::uint32_t block_count;
+        std::uint32_t trigram_count;
+        std::size_t offset;  // of the postings in _data
+        std::size_t size;
+    };
+    std::string _data;
+    std::vector<Run> _runs;
+    std::uint64_t _bytes = 0;
+public:
+    bool load(const std::string& tri_path);
+    // Blocks covered by the runs, which start at block 0 and follow each other
+    std::uint64_t blocks() const { return _runs.empty() ? 0 : _runs.back().first_block + _runs.back().block_count; }
+    // Length of the well formed part of the file, less a torn last run
+    std::uint64_t bytes() const { return _bytes; }
+
+    // Clear the flags of candidates (one per block) for covered blocks that
+    // contain none of literals, the lowercased strings of which any match
+    // holds one. Without literals, or with one shorter than a trigram,
+    // every block stays a candidate.
+    void filter(const std::vector<std::string>& literals, std::vector<bool>& candidates) const;
+};
+
+} // namespace timbre
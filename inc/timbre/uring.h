@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace timbre {
+
+/**
+ * Minimal io_uring submission/completion ring for positioned writes.
+ *
+ * Talks to the kernel through the raw syscalls so there is no liburing
+ * dependency. Writes are queued with an opaque tag and handed to the kernel
+ * in one io_uring_enter(2); completions are reaped in batches. On platforms
+ * or kernels without io_uring, init() fails and callers fall back to
+ * write(2).
+ */
+class IoRing {
+public:
+    struct Completion {
+        std::uint64_t tag;
+        int result;  // bytes written or -errno
+    };
+
+    static constexpr unsigned DEFAULT_ENTRIES = 64;
+
+    IoRing();
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    static bool supported();
+
+    bool init(unsigned entries = DEFAULT_ENTRIES);
+    bool ready() const { return _fd >= 0; }
+    std::size_t in_flight() const { return _in_flight; }
+    std::size_t capacity() const { return _cq_entries; }
+
+    // Queue a write at an explicit file offset, false if the ring is full
+    bool write(int fd, const char* data, std::size_t len, std::uint64_t offset, std::uint64_t tag);
+    // Submit queued writes and reap at least wait_for completions
+    bool submit(unsigned wait_for = 0);
+    // The writes finished since the last call, valid until the next one
+    const std::vector<Completion>& reap();
+private:
+    int _fd;
+    void* _sq_ring;
+    void* _cq_ring;
+    void* _sqes;
+    std::size_t _sq_ring_size;
+    std::size_t _cq_ring_size;
+    std::size_t _sqes_size;
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    void* _cqes;
+    unsigned _sq_entries;
+    unsigned _cq_entries;
+    unsigned _queued;
+    std::size_t _in_flight;
+    std::vector<Completion> _completions;  // reused by reap()
+
+    void release();
+};
+
+} // namespace timbre
@@ -0,0 +1,253 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "timbre/cache.h"
+#include "timbre/log.h"
+#include "timbre/serial.h"
+#include "timbre/version.h"
+
+namespace timbre {
+
+namespace {
+
+constexpr char MAGIC[8] = {'T', 'I', 'M', 'B', 'R', 'E', 'C', 'C'};
+
+#define TIMBRE_STRINGIFY_(x) #x
+#define TIMBRE_STRINGIFY(x) TIMBRE_STRINGIFY_(x)
+// Any other build may lay the program out differently, never share entries
+constexpr const char* BUILD_ID =
+    TIMBRE_STRINGIFY(TIMBRE_VERSION_MAJOR) "." TIMBRE_STRINGIFY(TIMBRE_VERSION_MINOR) "."
+    TIMBRE_STRINGIFY(TIMBRE_VERSION_PATCH) "-" TIMBRE_VERSION_SHA;
+
+std::uint64_t fnv1a(std::string_view data, std::uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (const char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool read_file(const std::string& path, std::string& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    out = buffer.str();
+    return true;
+}
+
+std::uint64_t cache_key(const std::string& toml) {
+    std::uint64_t key = fnv1a(BUILD_ID);
+    const std::uint32_t layout[] = {ConfigCache::FORMAT_VERSION, static_cast<std::uint32_t>(sizeof(void*))};
+    key = fnv1a(std::string_view(reinterpret_cast<const char*>(layout), sizeof(layout)), key);
+    return fnv1a(toml, key);
+}
+
+} // namespace
+
+ConfigCache::ConfigCache(const std::string& dir) : _dir(dir) {}
+
+std::string ConfigCache::default_dir(const std::string& config_path) {
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && xdg[0] != '\0') {
+        return std::string(xdg) + "/timbre";
+    }
+#ifdef _WIN32
+    const char* home = std::getenv("LOCALAPPDATA");
+#else
+    const char* home = std::getenv("HOME");
+#endif
+    if (home != nullptr && home[0] != '\0') {
+#ifdef _WIN32
+        return std::string(home) + "/timbre/cache";
+#else
+        return std::string(home) + "/.cache/timbre";
+#endif
+    }
+    const std::filesystem::path config_dir = std::filesystem::path(config_path).parent_path();
+    return ((config_dir.empty() ? std::filesystem::path(".") : config_dir) / ".timbre-cache").string();
+}
+
+std::string ConfigCache::entry_path(std::uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return _dir + "/" + name;
+}
+
+bool ConfigCache::load(const std::string& toml_path, UserConfig& config) const {
+    if (!enabled()) return false;
+    std::string toml;
+    if (!read_file(toml_path, toml)) return false;
+    const std::uint64_t key = cache_key(toml);
+    const std::string path = entry_path(key);
+
+    std::string entry;
+    if (!read_file(path, entry)) return false;
+    const std::size_t header = sizeof(MAGIC) + sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t);
+    if (entry.size() < header || entry.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) return false;
+
+    ByteReader in(std::string_view(entry).substr(sizeof(MAGIC)));
+    std::uint32_t version = 0;
+    std::uint64_t stored_key = 0;
+    std::uint64_t checksum = 0;
+    in.get(version);
+    in.get(stored_key);
+    in.get(checksum);
+    const std::string_view payload = std::string_view(entry).substr(header);
+    if (!in.ok() || version != FORMAT_VERSION || stored_key != key || checksum != fnv1a(payload)) {
+        log(LogLevel::DEBUG, "Config cache: ignoring stale entry " + path);
+        return false;
+    }
+
+    ByteReader body(payload);
+    std::string log_dir;
+    std::uint64_t flush_interval = 0;
+    std::string io_backend;
+    bool throttle_stdout = false;
+    bool index = true;
+    bool trigram_index = false;
+    Multiline multiline;
+    std::vector<std::string> level_keys;
+    std::uint8_t level_prefixes = 0;
+    std::uint64_t level_count = 0;
+    body.get(log_dir);
+    body.get(flush_interval);
+    body.get(io_backend);
+    body.get(throttle_stdout);
+    body.get(index);
+    body.get(trigram_index);
+    body.get(multiline.start);
+    body.get(multiline.continuation);
+    body.get(multiline.max_lines);
+    body.get(multiline.timeout);
+    body.get(level_keys);
+    body.get(level_prefixes);
+    body.get(level_count);
+    std::map<std::string, UserLevel> levels;
+    for (std::uint64_t i = 0; body.ok() && i < level_count; ++i) {
+        std::string name;
+        UserLevel level;
+        std::uint8_t valid = 0;
+        body.get(name);
+        body.get(level.expr);
+        body.get(level.path);
+        body.get(valid);
+        level.valid = valid != 0;
+        body.get(level.rotation.max_size);
+        body.get(level.rotation.max_age);
+        body.get(level.rotation.keep);
+        body.get(level.rotation.compress);
+        body.get(level.compress);
+        body.get(level.compress_level);
+        body.get(level.priority);
+        body.get(level.throttle.sample_rate);
+        body.get(level.throttle.max_lines_per_sec);
+        body.get(level.collapse_window);
+        levels[name] = std::move(level);
+    }
+    Matcher matcher;
+    bool consistent = body.ok() && matcher.load(body) && body.done() && matcher.size() == levels.size();
+    // Sinks are looked up by matcher id, every id must name a level
+    for (std::size_t id = 0; consistent && id < matcher.size(); ++id) {
+        consistent = levels.count(matcher.level_name(static_cast<int>(id))) > 0;
+    }
+    consistent = consistent && (!multiline.enabled() || multiline.compile());
+    if (!consistent) {
+        log(LogLevel::DEBUG, "Config cache: ignoring malformed entry " + path);
+        return false;
+    }
+
+    config.set_log_dir(log_dir);
+    config.set_flush_interval(static_cast<std::size_t>(flush_interval));
+    config.set_io_backend(io_backend);
+    config.set_throttle_stdout(throttle_stdout);
+    config.set_index(index);
+    config.set_trigram_index(trigram_index);
+    config.set_multiline(std::move(multiline));
+    config.set_level_field(LevelField(std::move(level_keys), level_prefixes));
+    config.set_compiled_levels(std::move(levels), std::move(matcher));
+    log(LogLevel::INFO, "Config: loaded compiled configuration from " + path);
+    return true;
+}
+
+bool ConfigCache::store(const std::string& toml_path, const UserConfig& config) const {
+    if (!enabled()) return false;
+    std::string toml;
+    if (!read_file(toml_path, toml)) return false;
+    const std::uint64_t key = cache_key(toml);
+
+    std::string payload;
+    ByteWriter body(payload);
+    body.put(config.get_log_dir());
+    body.put(static_cast<std::uint64_t>(config.get_flush_interval()));
+    body.put(config.get_io_backend());
+    body.put(config.get_throttle_stdout());
+    body.put(config.get_index());
+    body.put(config.get_trigram_index());
+    body.put(config.get_multiline().start);
+    body.put(config.get_multiline().continuation);
+    body.put(config.get_multiline().max_lines);
+    body.put(config.get_multiline().timeout);
+    body.put(config.get_level_field().keys());
+    body.put(config.get_level_field().prefixes());
+    body.put(static_cast<std::uint64_t>(config.get_log_levels().size()));
+    // NOLINTBEGIN: unassignedVariable
+    for (const auto& [name, level] : config.get_log_levels()) { // NOLINT
+        body.put(name);
+        body.put(level.expr);
+        body.put(level.path);
+        body.put(static_cast<std::uint8_t>(level.valid));
+        body.put(level.rotation.max_size);
+        body.put(level.rotation.max_age);
+        body.put(level.rotation.keep);
+        body.put(level.rotation.compress);
+        body.put(level.compress);
+        body.put(level.compress_level);
+        body.put(level.priority);
+        body.put(level.throttle.sample_rate);
+        body.put(level.throttle.max_lines_per_sec);
+        body.put(level.collapse_window);
+    }
+    // NOLINTEND
+    config.get_matcher().save(body);
+
+    std::string entry(MAGIC, sizeof(MAGIC));
+    ByteWriter out(entry);
+    out.put(FORMAT_VERSION);
+    out.put(key);
+    out.put(fnv1a(payload));
+    entry += payload;
+
+    // Write aside and rename, concurrent timbre runs may race for the same entry
+    std::error_code ec;
+    std::filesystem::create_directories(_dir, ec);
+    const std::string path = entry_path(key);
+    const std::string tmp = path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(entry.data(), static_cast<std::streamsize>(entry.size()));
+        if (!file) {
+            log(LogLevel::DEBUG, "Config cache: cannot write " + tmp);
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    log(LogLevel::DEBUG, "Config cache: stored " + path);
+    return true;
+}
+
+bool ConfigCache::load_or_compile(const std::string& toml_path, UserConfig& config) const {
+    if (load(toml_path, config)) return true;
+    if (!config.load(toml_path)) return false;
+    store(toml_path, config);
+    return true;
+}
+
+} // namespace timbre
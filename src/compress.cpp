@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <vector>
+#include "timbre/compress.h"
+#include "timbre/log.h"
+
+#ifdef TIMBRE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace timbre {
+
+namespace {
+
+constexpr std::size_t CHUNK = 64 * 1024;
+
+} // namespace
+
+bool parse_codec(const std::string& name, Codec& codec) {
+    if (name == "none") {
+        codec = Codec::NONE;
+    } else if (name == "gzip" || name == "gz") {
+        codec = Codec::GZIP;
+    } else if (name == "zstd" || name == "zst") {
+        codec = Codec::ZSTD;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* codec_name(Codec codec) {
+    switch (codec) {
+        case Codec::GZIP: return "gzip";
+        case Codec::ZSTD: return "zstd";
+        default: return "none";
+    }
+}
+
+const char* codec_extension(Codec codec) {
+    switch (codec) {
+        case Codec::GZIP: return ".gz";
+        case Codec::ZSTD: return ".zst";
+        default: return "";
+    }
+}
+
+bool codec_available(Codec codec) {
+    switch (codec) {
+        case Codec::NONE: return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: return true;
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: return true;
+#endif
+        default: return false;
+    }
+}
+
+int codec_max_level(Codec codec) {
+    switch (codec) {
+        case Codec::GZIP: return 9;
+        case Codec::ZSTD: return 22;
+        default: return 0;
+    }
+}
+
+Compressor::Compressor() : _codec(Codec::NONE), _stream(nullptr) {}
+
+Compressor::~Compressor() {
+    release();
+}
+
+void Compressor::release() {
+    if (_stream == nullptr) return;
+#ifdef TIMBRE_HAVE_ZLIB
+    if (_codec == Codec::GZIP) {
+        deflateEnd(static_cast<z_stream*>(_stream));
+        delete static_cast<z_stream*>(_stream);
+    }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+    if (_codec == Codec::ZSTD) ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(_stream));
+#endif
+    _stream = nullptr;
+}
+
+bool Compressor::init(Codec codec, int level) {
+    release();
+    _codec = codec;
+    level = std::min(level, codec_max_level(codec));
+    switch (codec) {
+        case Codec::NONE:
+            return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: {
+            auto* stream = new z_stream{};
+            // 15 + 16: maximum window, gzip header and trailer
+            if (deflateInit2(stream, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                             Z_DEFAULT_STRATEGY) != Z_OK) {
+                delete stream;
+                return false;
+            }
+            _stream = stream;
+            return true;
+        }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: {
+            ZSTD_CCtx* cctx = ZSTD_createCCtx();
+            if (cctx == nullptr) return false;
+            if (level > 0) ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+            _stream = cctx;
+            return true;
+        }
+#endif
+        default:
+            (void)level;
+            return false;
+    }
+}
+
+bool Compressor::update(std::string_view data, std::string& out) {
+    switch (_codec) {
+        case Codec::NONE:
+            out.append(data);
+            return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: {
+            auto* stream = static_cast<z_stream*>(_stream);
+            stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            stream->avail_in = static_cast<uInt>(data.size());
+            while (stream->avail_in > 0) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                stream->next_out = reinterpret_cast<Bytef*>(&out[start]);
+                stream->avail_out = static_cast<uInt>(CHUNK);
+                if (deflate(stream, Z_NO_FLUSH) == Z_STREAM_ERROR) return false;
+                out.resize(start + CHUNK - stream->avail_out);
+            }
+            return true;
+        }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: {
+            ZSTD_inBuffer in = {data.data(), data.size(), 0};
+            while (in.pos < in.size) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                ZSTD_outBuffer dst = {&out[start], CHUNK, 0};
+                const std::size_t rc = ZSTD_compressStream2(static_cast<ZSTD_CCtx*>(_stream), &dst, &in, ZSTD_e_continue);
+                out.resize(start + dst.pos);
+                if (ZSTD_isError(rc)) return false;
+            }
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+bool Compressor::finish(std::string& out) {
+    switch (_codec) {
+        case Codec::NONE:
+            return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: {
+            auto* stream = static_cast<z_stream*>(_stream);
+            stream->next_in = nullptr;
+            stream->avail_in = 0;
+            int rc = Z_OK;
+            while (rc != Z_STREAM_END) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                stream->next_out = reinterpret_cast<Bytef*>(&out[start]);
+                stream->avail_out = static_cast<uInt>(CHUNK);
+                rc = deflate(stream, Z_FINISH);
+                out.resize(start + CHUNK - stream->avail_out);
+                if (rc == Z_STREAM_ERROR) return false;
+            }
+            // The next update starts a new gzip member
+            return deflateReset(stream) == Z_OK;
+        }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: {
+            ZSTD_inBuffer in = {nullptr, 0, 0};
+            std::size_t remaining = 1;
+            while (remaining != 0) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                ZSTD_outBuffer dst = {&out[start], CHUNK, 0};
+                remaining = ZSTD_compressStream2(static_cast<ZSTD_CCtx*>(_stream), &dst, &in, ZSTD_e_end);
+                out.resize(start + dst.pos);
+                if (ZSTD_isError(remaining)) return false;
+            }
+            return true;
+        }
+#endif
+        default:
+            (void)out;
+            return false;
+    }
+}
+
+namespace {
+
+struct Magic {
+    Codec codec;
+    std::string_view bytes;
+};
+
+const Magic MAGICS[] = {
+    {Codec::GZIP, std::string_view("\x1f\x8b", 2)},
+    {Codec::ZSTD, std::string_view("\x28\xb5\x2f\xfd", 4)},
+};
+
+} // namespace
+
+Codec detect_codec(std::string_view head) {
+    for (const Magic& magic : MAGICS) {
+        if (head.substr(0, magic.bytes.size()) == magic.bytes) return magic.codec;
+    }
+    return Codec::NONE;
+}
+
+bool magic_incomplete(std::string_view head) {
+    for (const Magic& magic : MAGICS) {
+        if (head.size() < magic.bytes.size() && magic.bytes.substr(0, head.size()) == head) return true;
+    }
+    return false;
+}
+
+Decompressor::Decompressor() : _codec(Codec::NONE), _stream(nullptr), _in_frame(false) {}
+
+Decompressor::~Decompressor() {
+    release();
+}
+
+void Decompressor::release() {
+    if (_stream == nullptr) return;
+#ifdef TIMBRE_HAVE_ZLIB
+    if (_codec == Codec::GZIP) {
+        inflateEnd(static_cast<z_stream*>(_stream));
+        delete static_cast<z_stream*>(_stream);
+    }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+    if (_codec == Codec::ZSTD) ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(_stream));
+#endif
+    _stream = nullptr;
+}
+
+bool Decompressor::init(Codec codec) {
+    release();
+    _codec = codec;
+    _in_frame = false;
+    switch (codec) {
+        case Codec::NONE:
+            return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: {
+            auto* stream = new z_stream{};
+            // 15 + 32: maximum window, gzip or zlib header detected automatically
+            if (inflateInit2(stream, 15 + 32) != Z_OK) {
+                delete stream;
+                return false;
+            }
+            _stream = stream;
+            return true;
+        }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: {
+            ZSTD_DCtx* dctx = ZSTD_createDCtx();
+            if (dctx == nullptr) return false;
+            _stream = dctx;
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+bool Decompressor::update(std::string_view data, std::string& out) {
+    switch (_codec) {
+        case Codec::NONE:
+            out.append(data);
+            return true;
+#ifdef TIMBRE_HAVE_ZLIB
+        case Codec::GZIP: {
+            auto* stream = static_cast<z_stream*>(_stream);
+            stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            stream->avail_in = static_cast<uInt>(data.size());
+            while (stream->avail_in > 0) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                stream->next_out = reinterpret_cast<Bytef*>(&out[start]);
+                stream->avail_out = static_cast<uInt>(CHUNK);
+                const int rc = inflate(stream, Z_NO_FLUSH);
+                out.resize(start + CHUNK - stream->avail_out);
+                if (rc == Z_STREAM_END) {
+                    // Another member may follow, gzip allows any number of them
+                    _in_frame = false;
+                    if (inflateReset(stream) != Z_OK) return false;
+                    continue;
+                }
+                if (rc != Z_OK && rc != Z_BUF_ERROR) return false;
+                _in_frame = true;
+            }
+            return true;
+        }
+#endif
+#ifdef TIMBRE_HAVE_ZSTD
+        case Codec::ZSTD: {
+            ZSTD_inBuffer in = {data.data(), data.size(), 0};
+            while (in.pos < in.size) {
+                const std::size_t start = out.size();
+                out.resize(start + CHUNK);
+                ZSTD_outBuffer dst = {&out[start], CHUNK, 0};
+                const std::size_t rc = ZSTD_decompressStream(static_cast<ZSTD_DCtx*>(_stream), &dst, &in);
+                out.resize(start + dst.pos);
+                if (ZSTD_isError(rc)) return false;
+                _in_frame = rc != 0;  // 0 exactly at the end of a frame
+            }
+            return true;
+        }
+#endif
+        default:
+            (void)out;
+            return false;
+    }
+}
+
+bool decompress_all(std::string_view data, std::string& out) {
+    out.clear();
+    Decompressor decompressor;
+    if (!decompressor.init(detect_codec(data))) return false;
+    return decompressor.update(data, out) && !decompressor.truncated();
+}
+
+bool compress_file(const std::string& src, const std::string& dst, Codec codec) {
+    Compressor compressor;
+    if (!compressor.init(codec)) return false;
+    std::ifstream in(src, std::ios::binary);
+    if (!in) return false;
+
+    const std::string tmp = dst + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    std::vector<char> chunk(CHUNK);
+    std::string compressed;
+    bool ok = static_cast<bool>(out);
+    while (ok && in) {
+        in.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        const std::size_t n = static_cast<std::size_t>(in.gcount());
+        if (n == 0) break;
+        compressed.clear();
+        ok = compressor.update(std::string_view(chunk.data(), n), compressed);
+        out.write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+    }
+    compressed.clear();
+    ok = ok && !in.bad() && compressor.finish(compressed);
+    out.write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+    out.close();
+
+    std::error_code ec;
+    if (!ok || !out) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    std::filesystem::rename(tmp, dst, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+    return !ec;
+}
+
+} // namespace timbre
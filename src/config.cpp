@@ -1,5 +1,7 @@
+#include <cctype>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <regex>
 #include <filesystem>
 #include "timbre/config.h"
@@ -23,22 +25,26 @@ std::regex _re_compile(const std::string& pattern) {
 
 std::map<std::string, UserLevel> UserConfig::default_levels() {
     UserLevel error_config;
-    error_config.pattern = _re_compile("(error|exception|fail(ed|ure)?|critical)");
+    error_config.expr = "(error|exception|fail(ed|ure)?|critical)";
+    error_config.pattern = _re_compile(error_config.expr);
     error_config.path = "error.log";
     error_config.count = 0;
 
     UserLevel warn_config;
-    warn_config.pattern = _re_compile("(warn(ing)?)");
+    warn_config.expr = "(warn(ing)?)";
+    warn_config.pattern = _re_compile(warn_config.expr);
     warn_config.path = "warn.log";
     warn_config.count = 0;
 
     UserLevel info_config;
-    info_config.pattern = _re_compile("(info)");
+    info_config.expr = "(info)";
+    info_config.pattern = _re_compile(info_config.expr);
     info_config.path = "info.log";
     info_config.count = 0;
 
     UserLevel debug_config;
-    debug_config.pattern = _re_compile("(debug)");
+    debug_config.expr = "(debug)";
+    debug_config.pattern = _re_compile(debug_config.expr);
     debug_config.path = "debug.log";
     debug_config.count = 0;
 
@@ -80,6 +86,202 @@ bool create_directory(const std::string& path) {
     }
 }
 
+// A non-negative count, written as an integer or as a string of digits
+// followed by a unit, scaled by the unit's multiplier; nothing is stored
+// unless the whole value is valid and fits
+static bool parse_scaled(const toml::value& value, std::uint64_t (*multiplier)(const std::string& unit),
+                         std::uint64_t& result) {
+    if (value.is_integer()) {
+        if (value.as_integer() < 0) return false;
+        result = static_cast<std::uint64_t>(value.as_integer());
+        return true;
+    }
+    if (!value.is_string()) return false;
+    const std::string& text = value.as_string();
+    // stoull would take a sign or leading blanks, "-1M" wrapping around
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) return false;
+    std::uint64_t count = 0;
+    std::size_t end = 0;
+    try {
+        count = std::stoull(text, &end);
+    } catch (const std::exception&) {
+        return false;
+    }
+    const std::uint64_t scale = multiplier(text.substr(end));
+    if (scale == 0 || count > std::numeric_limits<std::uint64_t>::max() / scale) return false;
+    result = count * scale;
+    return true;
+}
+
+// Byte count, optionally with a K, M or G (binary) suffix: 1048576, "512K", "100M"
+static bool parse_size(const toml::value& value, std::uint64_t& bytes) {
+    return parse_scaled(value, [](const std::string& unit) -> std::uint64_t {
+        if (unit.empty() || unit == "B") return 1;
+        const std::string units = "KMG";
+        const std::size_t shift = units.find(static_cast<char>(std::toupper(static_cast<unsigned char>(unit[0]))));
+        if (shift == std::string::npos || (unit.size() > 1 && unit.substr(1) != "B" && unit.substr(1) != "iB")) return 0;
+        return std::uint64_t{1} << (10 * (shift + 1));
+    }, bytes);
+}
+
+// Seconds, optionally with an s, m, h or d suffix: 3600, "90m", "7d"
+static bool parse_duration(const toml::value& value, std::uint64_t& seconds) {
+    return parse_scaled(value, [](const std::string& unit) -> std::uint64_t {
+        if (unit.empty() || unit == "s") return 1;
+        if (unit == "m") return 60;
+        if (unit == "h") return 60 * 60;
+        if (unit == "d") return 24 * 60 * 60;
+        return 0;
+    }, seconds);
+}
+
+// Optional per level settings of the table form
+static void parse_level_options(const std::string& key, const toml::table& table, UserLevel& level) {
+    Rotation& rotation = level.rotation;
+    if (const auto it = table.find("max_size"); it != table.end() && !parse_size(it->second, rotation.max_size)) {
+        log(LogLevel::ERROR, "Config: log_level." + key + ".max_size must be a byte count like 1048576 or \"100M\"");
+    }
+    if (const auto it = table.find("max_age"); it != table.end() && !parse_duration(it->second, rotation.max_age)) {
+        log(LogLevel::ERROR, "Config: log_level." + key + ".max_age must be seconds or a duration like \"12h\" or \"7d\"");
+    }
+    if (const auto it = table.find("keep"); it != table.end()) {
+        if (it->second.is_integer() && it->second.as_integer() >= 0) {
+            rotation.keep = static_cast<std::uint32_t>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".keep must be a non-negative integer");
+        }
+    }
+    if (const auto it = table.find("priority"); it != table.end()) {
+        if (it->second.is_integer()) {
+            level.priority = it->second.as_integer();
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".priority must be an integer");
+        }
+    }
+    if (const auto it = table.find("sample_rate"); it != table.end()) {
+        const double rate = it->second.is_floating() ? it->second.as_floating()
+            : it->second.is_integer() ? static_cast<double>(it->second.as_integer()) : -1.0;
+        if (rate > 0.0 && rate <= 1.0) {
+            level.throttle.sample_rate = rate;
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".sample_rate must be a fraction in (0, 1]");
+        }
+    }
+    if (const auto it = table.find("max_lines_per_sec"); it != table.end()) {
+        if (it->second.is_integer() && it->second.as_integer() >= 0) {
+            level.throttle.max_lines_per_sec = static_cast<std::uint64_t>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".max_lines_per_sec must be a non-negative integer");
+        }
+    }
+    if (const auto it = table.find("collapse_repeats"); it != table.end()) {
+        if (it->second.is_boolean()) {
+            level.collapse_window = it->second.as_boolean() ? 1 : 0;
+        } else if (it->second.is_integer() && it->second.as_integer() >= 0
+                   && static_cast<std::uint64_t>(it->second.as_integer()) <= RepeatCollapser::MAX_WINDOW) {
+            level.collapse_window = static_cast<std::uint32_t>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".collapse_repeats must be true, false or a window of up to "
+                + std::to_string(RepeatCollapser::MAX_WINDOW) + " lines");
+        }
+    }
+    if (const auto it = table.find("rotate_compress"); it != table.end()) {
+        if (!it->second.is_string() || !parse_codec(it->second.as_string(), rotation.compress)) {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".rotate_compress must be \"gzip\", \"zstd\" or \"none\"");
+        } else if (!codec_available(rotation.compress)) {
+            log(LogLevel::WARNING, std::string("Config: this build has no ") + codec_name(rotation.compress)
+                + " support, rotated segments of " + key + " stay uncompressed");
+            rotation.compress = Codec::NONE;
+        }
+    }
+    if (const auto it = table.find("compress"); it != table.end()) {
+        if (!it->second.is_string() || !parse_codec(it->second.as_string(), level.compress)) {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".compress must be \"gzip\", \"zstd\" or \"none\"");
+        } else if (!codec_available(level.compress)) {
+            log(LogLevel::WARNING, std::string("Config: this build has no ") + codec_name(level.compress)
+                + " support, " + key + " is written uncompressed");
+            level.compress = Codec::NONE;
+        }
+    }
+    if (const auto it = table.find("compress_level"); it != table.end()) {
+        // Checked against the codec in use, zlib rejects levels over 9
+        const int max = level.compress != Codec::NONE ? codec_max_level(level.compress) : codec_max_level(Codec::ZSTD);
+        if (it->second.is_integer() && it->second.as_integer() >= 0 && it->second.as_integer() <= max) {
+            level.compress_level = static_cast<int>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: log_level." + key + ".compress_level must be between 0 (default) and "
+                + std::to_string(max) + " for " + codec_name(level.compress));
+        }
+    }
+    if (level.compress != Codec::NONE) {
+        const std::string extension = codec_extension(level.compress);
+        if (level.path.size() < extension.size()
+            || level.path.compare(level.path.size() - extension.size(), extension.size(), extension) != 0) {
+            level.path += extension;
+        }
+        log(LogLevel::INFO, "Config: log_level." + key + " is written " + codec_name(level.compress)
+            + " compressed to " + level.path);
+    }
+    if (level.throttle.enabled()) {
+        char rate[32];
+        std::snprintf(rate, sizeof(rate), "%g", level.throttle.sample_rate);
+        log(LogLevel::INFO, "Config: log_level." + key + " keeps " + rate + " of its lines, at most "
+            + std::to_string(level.throttle.max_lines_per_sec) + "/s (0 = unlimited)");
+    }
+    if (rotation.enabled()) {
+        log(LogLevel::INFO, "Config: log_level." + key + " rotates at " + std::to_string(rotation.max_size)
+            + " bytes / " + std::to_string(rotation.max_age) + "s, keeping " + std::to_string(rotation.keep)
+            + " (" + codec_name(rotation.compress) + ")");
+    }
+}
+
+// [multiline]: start or continuation, max_lines, timeout
+static void parse_multiline(const toml::table& table, Multiline& multiline) {
+    if (const auto it = table.find("start"); it != table.end()) {
+        if (it->second.is_string()) {
+            multiline.start = it->second.as_string();
+        } else {
+            log(LogLevel::ERROR, "Config: multiline.start must be a regex");
+        }
+    }
+    if (const auto it = table.find("continuation"); it != table.end()) {
+        if (it->second.is_string()) {
+            multiline.continuation = it->second.as_string();
+        } else {
+            log(LogLevel::ERROR, "Config: multiline.continuation must be a regex");
+        }
+    }
+    if (const auto it = table.find("max_lines"); it != table.end()) {
+        if (it->second.is_integer() && it->second.as_integer() > 0 && it->second.as_integer() <= std::numeric_limits<std::uint32_t>::max()) {
+            multiline.max_lines = static_cast<std::uint32_t>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: multiline.max_lines must be a positive integer");
+        }
+    }
+    if (const auto it = table.find("timeout"); it != table.end()) {
+        if (it->second.is_integer() && it->second.as_integer() >= 0) {
+            multiline.timeout = static_cast<std::uint64_t>(it->second.as_integer());
+        } else {
+            log(LogLevel::ERROR, "Config: multiline.timeout must be a non-negative number of milliseconds");
+        }
+    }
+    if (!multiline.start.empty() && !multiline.continuation.empty()) {
+        log(LogLevel::ERROR, "Config: multiline takes either start or continuation, not both; not grouping lines");
+        multiline = Multiline{};
+        return;
+    }
+    if (!multiline.enabled()) return;
+    if (!multiline.compile()) {
+        log(LogLevel::ERROR, "Config: invalid multiline pattern, not grouping lines");
+        multiline = Multiline{};
+        return;
+    }
+    log(LogLevel::INFO, "Config: multiline events " + (multiline.start.empty()
+        ? "continue with lines matching " + multiline.continuation
+        : "start with lines matching " + multiline.start)
+        + ", up to " + std::to_string(multiline.max_lines) + " lines");
+}
+
 bool UserConfig::load(const std::string& filename) {
     try {
         const auto data = toml::parse(filename);
@@ -91,9 +293,96 @@ bool UserConfig::load(const std::string& filename) {
                 if (const auto it = timbre_table.find("log_dir"); it != timbre_table.end() && it->second.is_string()) {
                     this->set_log_dir(it->second.as_string());
                 }
+                if (const auto it = timbre_table.find("flush_interval"); it != timbre_table.end() && it->second.is_integer()) {
+                    if (it->second.as_integer() < 0) {
+                        log(LogLevel::ERROR, "Config: timbre.flush_interval must not be negative");
+                    } else {
+                        this->set_flush_interval(static_cast<std::size_t>(it->second.as_integer()));
+                        log(LogLevel::INFO, "Config: timbre.flush_interval = " + std::to_string(_flush_interval) + "ms");
+                    }
+                }
+                if (const auto it = timbre_table.find("io_backend"); it != timbre_table.end() && it->second.is_string()) {
+                    const std::string& backend = it->second.as_string();
+                    if (backend != "sync" && backend != "uring") {
+                        log(LogLevel::ERROR, "Config: timbre.io_backend must be \"sync\" or \"uring\"");
+                    } else {
+                        this->set_io_backend(backend);
+                        log(LogLevel::INFO, "Config: timbre.io_backend = " + backend);
+                    }
+                }
+                if (const auto it = timbre_table.find("throttle_stdout"); it != timbre_table.end()) {
+                    if (it->second.is_boolean()) {
+                        this->set_throttle_stdout(it->second.as_boolean());
+                    } else {
+                        log(LogLevel::ERROR, "Config: timbre.throttle_stdout must be true or false");
+                    }
+                }
+                if (const auto it = timbre_table.find("index"); it != timbre_table.end()) {
+                    if (it->second.is_boolean()) {
+                        this->set_index(it->second.as_boolean());
+                    } else {
+                        log(LogLevel::ERROR, "Config: timbre.index must be true or false");
+                    }
+                }
+                if (const auto it = timbre_table.find("trigram_index"); it != timbre_table.end()) {
+                    if (it->second.is_boolean()) {
+                        this->set_trigram_index(it->second.as_boolean());
+                    } else {
+                        log(LogLevel::ERROR, "Config: timbre.trigram_index must be true or false");
+                    }
+                }
+                std::vector<std::string> keys;
+                if (const auto it = timbre_table.find("level_keys"); it != timbre_table.end()) {
+                    bool valid = it->second.is_array();
+                    if (valid) {
+                        for (const auto& key : it->second.as_array()) {
+                            valid = valid && key.is_string() && !key.as_string().empty();
+                            if (valid) keys.push_back(key.as_string());
+                        }
+                    }
+                    if (!valid) {
+                        log(LogLevel::ERROR, "Config: timbre.level_keys must be an array of key names");
+                        keys.clear();
+                    } else {
+                        log(LogLevel::INFO, "Config: timbre.level_keys set, " + std::to_string(keys.size()) + " key(s)");
+                    }
+                }
+                std::uint8_t prefixes = 0;
+                if (const auto it = timbre_table.find("level_prefixes"); it != timbre_table.end()) {
+                    bool valid = it->second.is_array();
+                    if (valid) {
+                        for (const auto& name : it->second.as_array()) {
+                            Prefix prefix = Prefix::GLOG;
+                            valid = valid && name.is_string() && parse_prefix(name.as_string(), prefix);
+                            if (valid) prefixes |= static_cast<std::uint8_t>(prefix);
+                        }
+                    }
+                    if (!valid) {
+                        log(LogLevel::ERROR, "Config: timbre.level_prefixes must name \"glog\", \"syslog\" or \"bracket\"");
+                        prefixes = 0;
+                    }
+                }
+                this->set_level_field(LevelField(std::move(keys), prefixes));
+                if (const auto it = timbre_table.find("routing"); it != timbre_table.end()) {
+                    if (!it->second.is_string() || !parse_routing(it->second.as_string(), _routing)) {
+                        log(LogLevel::ERROR, "Config: timbre.routing must be \"first\" or \"all\"");
+                    } else {
+                        log(LogLevel::INFO, "Config: timbre.routing = " + it->second.as_string());
+                    }
+                }
             }
         }
         
+        if (data.contains("multiline")) {
+            if (data.at("multiline").is_table()) {
+                Multiline multiline;
+                parse_multiline(data.at("multiline").as_table(), multiline);
+                this->set_multiline(std::move(multiline));
+            } else {
+                log(LogLevel::ERROR, "Config: multiline must be a table");
+            }
+        }
+
         std::map<std::string, UserLevel> levels;
         
         // Handle log_level section
@@ -107,7 +396,9 @@ bool UserConfig::load(const std::string& filename) {
                     if (value.is_string()) {
                         try {
                             std::string pattern_str = value.as_string();
+                            level.expr = pattern_str;
                             level.pattern = _re_compile(pattern_str);
+                            level.valid = (level.pattern.flags() & std::regex_constants::extended) != 0;
                             level.path = key + ".log";  // Use level name as filepath
                             levels[key] = std::move(level);
                             log(LogLevel::INFO, "Config: log_level." + key + ".pattern = " + pattern_str);
@@ -124,7 +415,9 @@ bool UserConfig::load(const std::string& filename) {
                             
                             if (const auto it = level_table.find("pattern"); it != level_table.end() && it->second.is_string()) {
                                 pattern_str = it->second.as_string();
+                                level.expr = pattern_str;
                                 level.pattern = _re_compile(pattern_str);
+                                level.valid = (level.pattern.flags() & std::regex_constants::extended) != 0;
                             } else {
                                 throw std::runtime_error("Missing or invalid 'pattern' field in log level config");
                             }
@@ -134,6 +427,7 @@ bool UserConfig::load(const std::string& filename) {
                             } else {
                                 level.path = key + ".log";  // Default to level name
                             }
+                            parse_level_options(key, level_table, level);
                             
                             levels[key] = std::move(level);
                             log(LogLevel::INFO, "Config: log_level." + key + ".pattern = " + pattern_str);
@@ -157,6 +451,7 @@ bool UserConfig::load(const std::string& filename) {
         } else {
             _levels = std::move(levels);
         }
+        _matcher = Matcher(_levels, _routing);
         return true;
     } catch (const toml::exception& e) {
         log(LogLevel::ERROR, "Failed to parse TOML configuration: " + std::string(e.what()));
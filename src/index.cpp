@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "timbre/compress.h"
+#include "timbre/index.h"
+#include "timbre/log.h"
+#include "timbre/reader.h"
+
+namespace timbre {
+
+namespace {
+
+// Sidecar layout: MAGIC, FORMAT_VERSION, sizeof(IndexEntry), then entries
+// back to back in host byte order, like the config cache
+constexpr char MAGIC[8] = {'T', 'I', 'M', 'B', 'R', 'I', 'D', 'X'};
+constexpr std::uint32_t FORMAT_VERSION = 1;
+constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(std::uint32_t);
+constexpr std::int64_t DAY_MS = 24 * 60 * 60 * 1000;
+constexpr std::size_t LATEST_LOOKBACK = 1024;  // lines searched back for the latest time of a file
+
+static_assert(sizeof(IndexEntry) == 24, "index entries are written as is");
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Reads exactly n digits at pos
+bool read_number(std::string_view text, std::size_t& pos, std::size_t n, int& value) {
+    if (text.size() - pos < n) return false;
+    value = 0;
+    for (std::size_t end = pos + n; pos < end; ++pos) {
+        if (!is_digit(text[pos])) return false;
+        value = value * 10 + (text[pos] - '0');
+    }
+    return true;
+}
+
+bool read_char(std::string_view text, std::size_t& pos, char c) {
+    if (pos >= text.size() || text[pos] != c) return false;
+    ++pos;
+    return true;
+}
+
+// HH:MM[:SS][.fff] at pos, in milliseconds since midnight
+bool read_clock(std::string_view text, std::size_t& pos, std::int64_t& ms) {
+    int hour = 0;
+    int minute = 0;
+    int second = 0;
+    if (!read_number(text, pos, 2, hour) || !read_char(text, pos, ':') || !read_number(text, pos, 2, minute)) {
+        return false;
+    }
+    if (read_char(text, pos, ':') && !read_number(text, pos, 2, second)) return false;
+    if (hour > 23 || minute > 59 || second > 60) return false;
+    int millis = 0;
+    if (pos < text.size() && (text[pos] == '.' || text[pos] == ',')) {
+        ++pos;
+        int scale = 100;
+        for (; pos < text.size() && is_digit(text[pos]); ++pos) {
+            millis += (text[pos] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    ms = ((hour * 60 + minute) * 60 + second) * 1000LL + millis;
+    return true;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+std::int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2 ? 1 : 0;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int year_of_era = year - era * 400;
+    const int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097LL + day_of_era - 719468;
+}
+
+// Calls fn(offset, line) for every complete line of contents from offset on
+template <typename Fn>
+void for_each_line(std::string_view contents, std::uint64_t offset, Fn fn) {
+    const char* const base = contents.data();
+    const char* const end = base + contents.size();
+    for (const char* p = base + offset; p < end;) {
+        const char* nl = find_newline(p, end);
+        if (nl == end) return;  // an unfinished last line
+        fn(static_cast<std::uint64_t>(p - base), std::string_view(p, static_cast<std::size_t>(nl - p)));
+        p = nl + 1;
+    }
+}
+
+// Offset of the line after the one starting at offset
+std::uint64_t next_line(std::string_view contents, std::uint64_t offset) {
+    const char* end = contents.data() + contents.size();
+    const char* nl = find_newline(contents.data() + offset, end);
+    return nl == end ? contents.size() : static_cast<std::uint64_t>(nl + 1 - contents.data());
+}
+
+IndexEntry entry_at(std::uint64_t offset, std::uint64_t line, std::string_view text) {
+    std::int64_t time_ms = 0;
+    return IndexEntry{offset, line, parse_timestamp(text, time_ms) ? time_ms : IndexEntry::NO_TIME};
+}
+
+} // namespace
+
+bool parse_timestamp(std::string_view text, std::int64_t& ms) {
+    std::size_t pos = 0;
+    read_char(text, pos, '[');
+    int year = 0;
+    int month = 0;
+    int day = 0;
+    if (!read_number(text, pos, 4, year) || pos >= text.size() || (text[pos] != '-' && text[pos] != '/')) {
+        return false;
+    }
+    const char separator = text[pos++];
+    if (!read_number(text, pos, 2, month) || !read_char(text, pos, separator) || !read_number(text, pos, 2, day)) {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31) return false;
+    if (!read_char(text, pos, 'T') && !read_char(text, pos, ' ')) return false;
+    std::int64_t clock = 0;
+    if (!read_clock(text, pos, clock)) return false;
+
+    std::int64_t zone_ms = 0;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+        const bool east = text[pos] == '+';
+        std::size_t at = pos + 1;
+        int hours = 0;
+        int minutes = 0;
+        if (read_number(text, at, 2, hours)) {
+            read_char(text, at, ':');
+            if (read_number(text, at, 2, minutes)) zone_ms = (hours * 60 + minutes) * 60 * 1000LL * (east ? 1 : -1);
+        }
+    }
+    ms = days_from_civil(year, month, day) * DAY_MS + clock - zone_ms;
+    return true;
+}
+
+bool parse_time_arg(std::string_view text, std::int64_t latest, std::int64_t& ms) {
+    if (parse_timestamp(text, ms)) return true;
+    std::size_t pos = 0;
+    std::int64_t clock = 0;
+    if (!read_clock(text, pos, clock) || pos != text.size() || latest == IndexEntry::NO_TIME) return false;
+    ms = latest - ((latest % DAY_MS) + DAY_MS) % DAY_MS + clock;
+    if (ms > latest) ms -= DAY_MS;
+    return true;
+}
+
+std::int64_t latest_time(std::string_view text, const LogIndex* index) {
+    std::size_t end = text.size();
+    for (std::size_t n = 0; end > 0 && n < LATEST_LOOKBACK; ++n) {
+        const std::size_t nl = end > 1 ? text.rfind('\n', end - 2) : std::string_view::npos;
+        const std::size_t begin = nl == std::string_view::npos ? 0 : nl + 1;
+        std::int64_t time_ms = 0;
+        if (parse_timestamp(text.substr(begin, end - begin), time_ms)) return time_ms;
+        end = begin;
+    }
+    return index != nullptr ? index->last_time() : IndexEntry::NO_TIME;
+}
+
+IndexWriter::IndexWriter() : _file(nullptr), _trigrams(nullptr), _block(0) {
+    reset();
+}
+
+IndexWriter::~IndexWriter() {
+    close();
+}
+
+void IndexWriter::reset() {
+    _pending.clear();
+    _lines = 0;
+    // Nothing is recorded until open()
+    _next_line = std::numeric_limits<std::uint64_t>::max();
+    _next_offset = std::numeric_limits<std::uint64_t>::max();
+}
+
+bool IndexWriter::create() {
+    _file = std::fopen(_path.c_str(), "wb");
+    const std::uint32_t header[2] = {FORMAT_VERSION, static_cast<std::uint32_t>(sizeof(IndexEntry))};
+    if (_file == nullptr || std::fwrite(MAGIC, sizeof(MAGIC), 1, _file) != 1
+        || std::fwrite(header, sizeof(header), 1, _file) != 1) {
+        log(LogLevel::WARNING, "Failed to create index " + _path + ", not indexing it");
+        disable();
+        return false;
+    }
+    return true;
+}
+
+bool IndexWriter::open(const std::string& log_path, bool append, std::uint64_t file_bytes,
+                       TrigramIndexer* trigrams) {
+    close();
+    _path = log_path + ".idx";
+    _log_path = log_path;
+    _trigrams = trigrams;
+    _next_line = 1;
+    _next_offset = 0;
+    std::vector<IndexEntry> kept;
+    bool resumed = false;
+    if (append && file_bytes > 0) {
+        // Resume at the last entry of the existing index, taking it again
+        std::uint64_t from = 0;
+        LogIndex existing;
+        if (existing.load(_path, file_bytes)) {
+            resumed = true;
+            kept = existing.entries();
+            const IndexEntry last = kept.back();
+            kept.pop_back();
+            _lines = last.line - 1;
+            _next_line = last.line;
+            _next_offset = last.offset;
+            from = last.offset;
+        } else {
+            log(LogLevel::INFO, "Indexing existing log file " + log_path);
+        }
+        MappedFile file;
+        if (file.open(log_path)) {
+            const std::string_view contents = file.view().substr(0, static_cast<std::size_t>(file_bytes));
+            for_each_line(contents, from, [this](std::uint64_t offset, std::string_view text) { line(offset, text); });
+        }
+        kept.insert(kept.end(), _pending.begin(), _pending.end());
+        _pending.clear();
+    }
+    // Blocks of a trigram index only carry on along with the entries they span
+    std::error_code ec;
+    if (!resumed) std::filesystem::remove(log_path + ".tri", ec);
+    if (!create() || !write_entries(kept)) return false;
+    if (_trigrams != nullptr) open_trigrams(_bounds.empty() ? 0 : _bounds.size() - 1);
+    return true;
+}
+
+void IndexWriter::open_trigrams(std::uint64_t max_blocks) {
+    std::uint64_t covered = 0;
+    _tri = _trigrams->open(_log_path, max_blocks, covered);
+    if (!_tri) {
+        _trigrams = nullptr;
+        _bounds.clear();
+        return;
+    }
+    for (_block = 0; _block < covered; ++_block) _bounds.pop_front();
+}
+
+void IndexWriter::record(std::uint64_t offset, std::string_view text) {
+    _pending.push_back(entry_at(offset, _lines, text));
+    _next_line = _lines + INTERVAL_LINES;
+    _next_offset = offset + INTERVAL_BYTES;
+}
+
+bool IndexWriter::write_entries(const std::vector<IndexEntry>& entries) {
+    if (_file == nullptr) return false;
+    if (std::fwrite(entries.data(), sizeof(IndexEntry), entries.size(), _file) != entries.size()
+        || std::fflush(_file) != 0) {
+        log(LogLevel::WARNING, "Failed to write index " + _path + ", no longer indexing it");
+        disable();
+        return false;
+    }
+    if (_trigrams != nullptr) {
+        for (const auto& entry : entries) _bounds.push_back(entry.offset);
+    }
+    return true;
+}
+
+void IndexWriter::written() {
+    if (_pending.empty()) return;
+    write_entries(_pending);
+    _pending.clear();
+}
+
+void IndexWriter::settled(std::uint64_t bytes) {
+    if (_file == nullptr || _trigrams == nullptr) return;
+    if (!_tri) open_trigrams(0);  // the first blocks since a rotation
+    for (; _tri && _bounds.size() >= 2 && _bounds[1] <= bytes; _bounds.pop_front()) {
+        _trigrams->add(_tri, _block++, _bounds[0], _bounds[1]);
+    }
+}
+
+void IndexWriter::rotate(const std::string& segment, std::uint64_t bytes_out, std::string_view buffered) {
+    if (_file == nullptr) return;
+    std::fclose(_file);
+    _file = nullptr;
+    std::error_code ec;
+    std::filesystem::rename(_path, segment + ".idx", ec);
+    if (ec) log(LogLevel::WARNING, "Failed to move index " + _path + " along with its log: " + ec.message());
+    if (_tri) {
+        // The segment is complete, its last block included
+        if (!_bounds.empty() && _bounds.back() < bytes_out) _bounds.push_back(bytes_out);
+        for (; _bounds.size() >= 2; _bounds.pop_front()) _trigrams->add(_tri, _block++, _bounds[0], _bounds[1]);
+        _trigrams->rename(_tri, segment);
+        _trigrams->finish(_tri);
+        _tri.reset();
+    }
+    _bounds.clear();
+    _block = 0;
+
+    // What is still pending describes the buffer, which goes into the new file
+    const auto buffered_lines = static_cast<std::uint64_t>(std::count(buffered.begin(), buffered.end(), '\n'));
+    const std::uint64_t base = _lines - buffered_lines;
+    for (auto& entry : _pending) {
+        entry.offset -= bytes_out;
+        entry.line -= base;
+    }
+    _lines = buffered_lines;
+    _next_line -= base;
+    _next_offset = _next_offset > bytes_out ? _next_offset - bytes_out : 0;
+    // The new file gets an entry for its first line like any other
+    if (buffered_lines == 0) {
+        _next_line = 1;
+        _next_offset = 0;
+    } else if (_pending.empty() || _pending.front().offset > 0) {
+        _pending.insert(_pending.begin(), entry_at(0, 1, buffered.substr(0, buffered.find('\n'))));
+    }
+    create();
+}
+
+void IndexWriter::close() {
+    if (_file != nullptr) written();
+    disable();
+}
+
+void IndexWriter::disable() {
+    if (_file != nullptr) std::fclose(_file);
+    _file = nullptr;
+    if (_tri) _trigrams->finish(_tri);
+    _tri.reset();
+    _bounds.clear();
+    _block = 0;
+    reset();
+}
+
+bool LogIndex::load(const std::string& idx_path, std::uint64_t file_size) {
+    _entries.clear();
+    _timed.clear();
+    std::ifstream in(idx_path, std::ios::binary);
+    if (!in) return false;
+    const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::uint32_t header[2] = {0, 0};
+    if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) return false;
+    std::memcpy(header, data.data() + sizeof(MAGIC), sizeof(header));
+    if (header[0] != FORMAT_VERSION || header[1] != sizeof(IndexEntry)) return false;
+
+    // A crash can leave a torn last entry, and the file may be shorter than what was indexed
+    const std::size_t count = (data.size() - HEADER_SIZE) / sizeof(IndexEntry);
+    _entries.resize(count);
+    std::memcpy(_entries.data(), data.data() + HEADER_SIZE, count * sizeof(IndexEntry));
+    while (!_entries.empty() && _entries.back().offset >= file_size) _entries.pop_back();
+    for (std::size_t i = 0; i < _entries.size(); ++i) {
+        const bool ordered = i == 0
+            ? _entries[i].offset == 0 && _entries[i].line == 1
+            : _entries[i].offset > _entries[i - 1].offset && _entries[i].line > _entries[i - 1].line;
+        if (!ordered) {
+            _entries.clear();
+            return false;
+        }
+        if (_entries[i].time_ms != IndexEntry::NO_TIME) _timed.push_back(i);
+    }
+    return !_entries.empty();
+}
+
+void LogIndex::build(std::string_view contents) {
+    _entries.clear();
+    _timed.clear();
+    std::uint64_t lines = 0;
+    std::uint64_t next_line = 1;
+    std::uint64_t next_offset = 0;
+    for_each_line(contents, 0, [&](std::uint64_t offset, std::string_view text) {
+        if (++lines < next_line && offset < next_offset) return;
+        _entries.push_back(entry_at(offset, lines, text));
+        if (_entries.back().time_ms != IndexEntry::NO_TIME) _timed.push_back(_entries.size() - 1);
+        next_line = lines + IndexWriter::INTERVAL_LINES;
+        next_offset = offset + IndexWriter::INTERVAL_BYTES;
+    });
+}
+
+const IndexEntry* LogIndex::find_line(std::uint64_t line) const {
+    const auto it = std::partition_point(_entries.begin(), _entries.end(),
+                                         [line](const IndexEntry& entry) { return entry.line <= line; });
+    return it == _entries.begin() ? nullptr : &*std::prev(it);
+}
+
+const IndexEntry* LogIndex::find_time(std::int64_t time_ms) const {
+    const auto it = std::partition_point(_timed.begin(), _timed.end(),
+                                         [&](std::size_t i) { return _entries[i].time_ms < time_ms; });
+    return it == _timed.begin() ? nullptr : &_entries[*std::prev(it)];
+}
+
+const IndexEntry* LogIndex::find_time_after(std::int64_t time_ms) const {
+    const auto it = std::partition_point(_timed.begin(), _timed.end(),
+                                         [&](std::size_t i) { return _entries[i].time_ms <= time_ms; });
+    return it == _timed.end() ? nullptr : &_entries[*it];
+}
+
+std::int64_t LogIndex::last_time() const {
+    return _timed.empty() ? IndexEntry::NO_TIME : _entries[_timed.back()].time_ms;
+}
+
+int seek_log(const std::string& path, std::uint64_t line, const std::string& time, std::uint64_t count) {
+    MappedFile file;
+    if (!file.open(path)) {
+        log(LogLevel::ERROR, "Failed to open " + path);
+        return 1;
+    }
+    std::string_view contents = file.view();
+    // A compressed segment keeps the index of its text
+    std::string inflated;
+    if (const Codec codec = detect_codec(contents); codec != Codec::NONE) {
+        if (!codec_available(codec)) {
+            log(LogLevel::ERROR, path + " is " + codec_name(codec) + " compressed, which this build can't read");
+            return 1;
+        }
+        if (!decompress_all(contents, inflated)) {
+            log(LogLevel::WARNING, "Failed to decompress all of " + path + ", seeking in what could be");
+        }
+        contents = inflated;
+    }
+    LogIndex index;
+    if (!index.load(path + ".idx", contents.size())) {
+        log(LogLevel::WARNING, "No usable index for " + path + ", scanning it");
+        index.build(contents);
+    }
+
+    std::uint64_t start = 0;
+    if (line > 0) {
+        const IndexEntry* entry = index.find_line(line);
+        std::uint64_t at = entry != nullptr ? entry->line : 1;
+        start = entry != nullptr ? entry->offset : 0;
+        for (; at < line && start < contents.size(); ++at) start = next_line(contents, start);
+    } else {
+        std::int64_t target = 0;
+        if (!parse_time_arg(time, latest_time(contents, &index), target)) {
+            log(LogLevel::ERROR, "Cannot use time \"" + time + "\" for " + path + ", expected YYYY-MM-DD HH:MM[:SS], "
+                "or HH:MM[:SS] in a file with timestamps");
+            return 1;
+        }
+        const IndexEntry* entry = index.find_time(target);
+        start = entry != nullptr ? entry->offset : 0;
+        // Lines without a stamp of their own belong to the event before them
+        while (start < contents.size()) {
+            const std::uint64_t end = next_line(contents, start);
+            std::int64_t stamp = 0;
+            if (parse_timestamp(contents.substr(start, end - start), stamp) && stamp >= target) break;
+            start = end;
+        }
+    }
+
+    std::uint64_t end = contents.size();
+    if (count > 0) {
+        end = start;
+        for (std::uint64_t n = 0; n < count && end < contents.size(); ++n) end = next_line(contents, end);
+    }
+    const std::size_t len = static_cast<std::size_t>(end - start);
+    if (std::fwrite(contents.data() + start, 1, len, stdout) != len) return 1;
+    return std::fflush(stdout) == 0 ? 0 : 1;
+}
+
+} // namespace timbre
@@ -1,10 +1,22 @@
 #include <iostream>
+#include <algorithm>
 #include <cstdio>
+#include <thread>
+#include <vector>
 #include <utility>  // for std::ignore
 #include "CLI/CLI11.hpp"
+#include "timbre/cache.h"
+#include "timbre/compress.h"
 #include "timbre/log.h"
 #include "timbre/timbre.h"
 #include "timbre/config.h"
+#include "timbre/index.h"
+#include "timbre/pipeline.h"
+#include "timbre/query.h"
+#include "timbre/reader.h"
+#include "timbre/reload.h"
+#include "timbre/stats.h"
+#include "timbre/templates.h"
 
 using namespace timbre;
 
@@ -15,6 +27,16 @@ int main(int argc, char** argv) {
     bool append = false;
     bool verbose = false;
     bool version = false;
+    bool no_config_cache = false;
+    bool watch_config = false;
+    std::size_t threads = 0;
+    std::size_t flush_interval = 0;
+    std::string io_backend;
+    std::string stats_target;
+    std::vector<std::string> inputs;
+    std::size_t stats_interval = 1000;
+    std::size_t template_top = 0;
+    std::size_t template_interval = 0;
     std::string log_dir = ".timbre";
     std::string config_file;
     
@@ -24,6 +46,40 @@ int main(int argc, char** argv) {
     app.add_flag("-V,--version", version, "Print version");
     app.add_option("-d,--log-dir", log_dir, "Directory for log files");
     app.add_option("-c,--config", config_file, "Path to TOML configuration file");
+    app.add_flag("--no-config-cache", no_config_cache, "Always parse and compile the configuration, don't use or update the cache");
+    app.add_flag("--watch-config", watch_config, "Reload the configuration when the file changes (SIGHUP always reloads)");
+    app.add_option("-j,--threads", threads, "Classify on N worker threads (0 or 1 = single threaded)");
+    app.add_option("-f,--flush-interval", flush_interval, "Flush buffered output at least every N milliseconds");
+    app.add_option("--io-backend", io_backend, "How log files are written: sync (write(2)) or uring (io_uring, Linux)")
+        ->check(CLI::IsMember({"sync", "uring"}));
+    app.add_option("-i,--input", inputs, "Classify these files (memory-mapped) instead of stdin")->check(CLI::ExistingFile);
+    app.add_option("--stats", stats_target, "Write live metrics to stderr, FILE (JSON lines) or FILE.prom (Prometheus)");
+    app.add_option("--stats-interval", stats_interval, "Milliseconds between metrics snapshots")->check(CLI::PositiveNumber);
+    app.add_option("--templates", template_top, "Mine message templates, report the N most frequent per level on stderr at exit");
+    app.add_option("--templates-interval", template_interval, "Also report templates every N milliseconds");
+
+    std::string seek_file;
+    std::string seek_time;
+    std::uint64_t seek_line = 0;
+    std::uint64_t seek_count = 0;
+    CLI::App* seek = app.add_subcommand("seek", "Print a level file from a time or line on, using its .idx sidecar");
+    seek->add_option("file", seek_file, "Level file, e.g. .timbre/info.log")->required()->check(CLI::ExistingFile);
+    auto* seek_time_option = seek->add_option("-t,--time", seek_time,
+                                              "First line stamped at or after YYYY-MM-DD HH:MM[:SS], or HH:MM[:SS]");
+    seek->add_option("-l,--line", seek_line, "Start at this line number (1 = first)")
+        ->check(CLI::PositiveNumber)->excludes(seek_time_option);
+    seek->add_option("-n,--count", seek_count, "Print at most N lines");
+
+    Query query;
+    std::vector<std::string> query_levels;
+    CLI::App* query_command = app.add_subcommand("query", "Search level files in parallel, using their .idx sidecars");
+    query_command->add_option("pattern", query.pattern, "Extended regex (case-insensitive), or a literal with -F")
+        ->required();
+    query_command->add_option("levels", query_levels, "Levels to search, all of them by default");
+    query_command->add_flag("-F,--fixed-strings", query.fixed, "Match the pattern as a literal string");
+    query_command->add_option("--since", query.since, "Only lines stamped at or after YYYY-MM-DD HH:MM[:SS] or HH:MM[:SS]");
+    query_command->add_option("--until", query.until, "Only lines stamped at or before this time");
+    query_command->add_option("-j,--threads", query.threads, "Scan on N threads (0 = every core)");
 
     try {
         app.parse(argc, argv);
@@ -37,22 +93,43 @@ int main(int argc, char** argv) {
     }
 
     set_log_level(app.count("-v"));
+
+    if (*seek) {
+        if (seek_line == 0 && seek_time.empty()) {
+            log(LogLevel::ERROR, "seek needs --time or --line");
+            return 1;
+        }
+        return seek_log(seek_file, seek_line, seek_time, seek_count);
+    }
     
+    // Command line settings win over the file, on every (re)load
+    const auto apply_overrides = [&](UserConfig& target) {
+        if (app.count("-d") > 0 || app.count("--log-dir") > 0) target.set_log_dir(log_dir);
+        if (app.count("--flush-interval") > 0) target.set_flush_interval(flush_interval);
+        if (app.count("--io-backend") > 0) target.set_io_backend(io_backend);
+    };
+
     UserConfig config;
+    const std::string cache_dir = no_config_cache ? "" : ConfigCache::default_dir(config_file);
     if (!config_file.empty()) {
         log(LogLevel::INFO, "Loading configuration from: " + config_file);
-        if (!config.load(config_file)) {
+        if (!ConfigCache(cache_dir).load_or_compile(config_file, config)) {
             log(LogLevel::ERROR, "Failed to load configuration from: " + config_file);
             return 1;
         }
     }
     
-    // Override log directory from config if specified on command line
+    apply_overrides(config);
     if (app.count("-d") > 0 || app.count("--log-dir") > 0) {
-        config.set_log_dir(log_dir);
         log(LogLevel::INFO, "Using log directory from command line: " + log_dir);
     }
 
+    if (*query_command) {
+        std::vector<std::string> files;
+        if (!query_files(config, query_levels, files)) return 2;
+        return run_query(query, files);
+    }
+
     // Set stdout to line buffered for tee-like behavior
     setvbuf(stdout, NULL, _IOLBF, 0);
 
@@ -63,26 +140,110 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (log_files.async()) {
+        log(LogLevel::INFO, "Writing log files through io_uring");
+    }
+    StatsReporter reporter(log_files, stats_target, std::chrono::milliseconds(stats_interval));
+    if (!stats_target.empty()) {
+        reporter.start();
+    }
+    if (template_top > 0) {
+        templates().start(template_top, std::chrono::milliseconds(template_interval));
+    }
     log(LogLevel::INFO, "Timbre started. Processing input...");
 
-    std::string line;
+    LineReader reader(fileno(stdin));
+    std::string_view line;
     size_t line_count = 0;
-    
-    while (std::getline(std::cin, line)) {
-        process_line(config, line, log_files, quiet);
-        line_count++;
+
+    // Captured files are finite, only a stream is worth reloading for
+    ConfigReloader reloader(config_file, cache_dir, apply_overrides);
+    if (inputs.empty() && !config_file.empty() && reloader.start(watch_config)) {
+        log(LogLevel::INFO, "Send SIGHUP to reload " + config_file);
     }
+
+    if (!inputs.empty()) {
+        // Captured logs: use every core unless told otherwise
+        const std::size_t workers = app.count("--threads") > 0
+            ? threads
+            : std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        for (const auto& input : inputs) {
+            MappedFile file;
+            if (!file.open(input)) {
+                log(LogLevel::ERROR, "Failed to map input file: " + input);
+                continue;
+            }
+            log(LogLevel::INFO, "Classifying " + input + " on " + std::to_string(workers) + " threads");
+            if (detect_codec(file.view()) == Codec::NONE) {
+                line_count += run_mapped(config, file, log_files, workers, quiet);
+                continue;
+            }
+            // Compressed captures can't be classified in place, stream them instead
+            std::FILE* compressed = std::fopen(input.c_str(), "rb");
+            if (compressed == nullptr) {
+                log(LogLevel::ERROR, "Failed to open input file: " + input);
+                continue;
+            }
+            {
+                LineReader inflated(fileno(compressed));
+                inflated.detect_compression();
+                if (workers > 1) {
+                    line_count += run_pipeline(config, inflated, log_files, workers, quiet);
+                } else {
+                    while (inflated.next(line)) {
+                        process_line(config, line, log_files, quiet);
+                        line_count++;
+                    }
+                }
+            }
+            std::fclose(compressed);
+        }
+    } else {
+        reader.detect_compression();
+        // Pipe to pipe: let the kernel tee input to stdout, unless it is throttled
+        if (!quiet && !config.get_throttle_stdout() && reader.enable_tee(fileno(stdout))) {
+            log(LogLevel::INFO, "Teeing stdin to stdout with tee(2)");
+        }
+
+        if (threads > 1) {
+            log(LogLevel::INFO, "Using " + std::to_string(threads) + " worker threads");
+            line_count = run_pipeline(config, reader, log_files, threads, quiet, &reloader);
+        } else {
+            // Nothing more to read right now, don't sit on buffered output
+            reader.set_idle_hook([&log_files]() { log_files.flush(); });
+            UserConfig* rules = &config;
+            std::uint64_t generation = 0;
+            while (reader.next(line)) {
+                if (reloader.generation() != generation) {
+                    generation = reloader.generation();
+                    auto next = reloader.current();
+                    rules = next.get();
+                    log_files.rebind(std::move(next));
+                    // Lines of a throttled stdout are echoed one by one, stop teeing them
+                    if (rules->get_throttle_stdout()) reader.disable_tee();
+                }
+                process_line(*rules, line, log_files, quiet || reader.teed());
+                line_count++;
+            }
+        }
+    }
+    reloader.stop();
     
     log(LogLevel::INFO, "Processing complete. Total lines processed: " + std::to_string(line_count));
     
-    // Log counts for each level
-    for (const auto& [level_name, level] : config.get_log_levels()) {
+    // Log counts for each level, of the rules in effect at the end
+    log_files.visit_levels([](const std::string& level_name, const UserLevel& level) {
         if (level.count > 0) {
             const std::string message = level_name + " lines logged: " + std::to_string(level.count);
             log(LogLevel::INFO, message);
         }
-    }
+        if (level.dropped > 0) {
+            log(LogLevel::INFO, level_name + " lines dropped by throttle: " + std::to_string(level.dropped));
+        }
+    });
 
     close_log_files(log_files);
+    reporter.stop();
+    templates().stop();
     return 0;
 } 
\ No newline at end of file
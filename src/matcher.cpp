@@ -0,0 +1,1280 @@
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "timbre/config.h"
+#include "timbre/log.h"
+#include "timbre/matcher.h"
+#include "timbre/serial.h"
+#include "timbre/stats.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace timbre {
+
+namespace {
+
+using CharSet = std::bitset<256>;
+
+constexpr int MAX_NESTING = 256;
+constexpr int MAX_REPEAT = 255;            // RE_DUP_MAX
+constexpr std::size_t MAX_NODES = 1 << 20;
+constexpr std::size_t DFA_CACHE_BYTES = 8 << 20;
+constexpr std::size_t DFA_CACHE_SLOTS = 4;
+
+unsigned char ascii_lower(unsigned char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+unsigned char ascii_upper(unsigned char c) { return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c; }
+
+struct Ast {
+    enum Kind { CHARS, CONCAT, ALTERNATE, REPEAT, BEGIN_LINE, END_LINE, EMPTY, ANY_STRING };
+    Kind kind = CHARS;
+    CharSet chars;
+    int min = 0;
+    int max = 0;  // REPEAT: negative means unbounded
+    std::vector<Ast> children;
+};
+
+/**
+ * Recursive descent parser for the subset of POSIX extended regex that the
+ * DFA models. Anything outside it (backrefs, collating elements, escapes of
+ * ordinary characters, stray braces, ...) is rejected rather than guessed
+ * at, so the level falls back to std::regex and keeps its exact semantics.
+ *
+ * In lenient mode the parser only needs an over-approximation of the
+ * language for literal extraction: constructs it cannot model become
+ * ANY_STRING or EMPTY instead of failing the parse.
+ */
+class Parser {
+private:
+    std::string_view _s;
+    std::size_t _pos;
+    bool _icase;
+    bool _lenient;
+    int _depth;
+
+    bool at_end() const { return _pos >= _s.size(); }
+    char peek() const { return _s[_pos]; }
+
+    void add_char(CharSet& set, unsigned char c) const {
+        set.set(c);
+        if (_icase) {
+            set.set(ascii_lower(c));
+            set.set(ascii_upper(c));
+        }
+    }
+
+    bool alternation(Ast& out) {
+        if (++_depth > MAX_NESTING) return false;
+        Ast alt;
+        alt.kind = Ast::ALTERNATE;
+        for (;;) {
+            Ast branch_ast;
+            if (!branch(branch_ast)) return false;
+            alt.children.push_back(std::move(branch_ast));
+            if (at_end() || peek() != '|') break;
+            ++_pos;
+        }
+        out = alt.children.size() == 1 ? std::move(alt.children[0]) : std::move(alt);
+        --_depth;
+        return true;
+    }
+
+    bool branch(Ast& out) {
+        Ast concat;
+        concat.kind = Ast::CONCAT;
+        while (!at_end() && peek() != '|' && peek() != ')') {
+            Ast piece_ast;
+            if (!piece(piece_ast)) return false;
+            concat.children.push_back(std::move(piece_ast));
+        }
+        if (concat.children.empty()) {
+            if (!_lenient) return false;  // empty alternative
+            out.kind = Ast::EMPTY;
+            return true;
+        }
+        out = concat.children.size() == 1 ? std::move(concat.children[0]) : std::move(concat);
+        return true;
+    }
+
+    bool piece(Ast& out) {
+        Ast atom_ast;
+        if (!atom(atom_ast)) return false;
+        if (at_end() || !is_quantifier(peek())) {
+            out = std::move(atom_ast);
+            return true;
+        }
+        if (atom_ast.kind == Ast::BEGIN_LINE || atom_ast.kind == Ast::END_LINE) {
+            if (!_lenient) return false;
+            atom_ast.kind = Ast::ANY_STRING;
+        }
+
+        Ast rep;
+        rep.kind = Ast::REPEAT;
+        const char q = _s[_pos++];
+        switch (q) {
+            case '*': rep.min = 0; rep.max = -1; break;
+            case '+': rep.min = 1; rep.max = -1; break;
+            case '?': rep.min = 0; rep.max = 1; break;
+            default:
+                if (!interval(rep.min, rep.max)) return false;
+                break;
+        }
+        if (!at_end() && is_quantifier(peek())) {
+            if (!_lenient) return false;  // stacked quantifiers
+            while (!at_end() && (peek() == '*' || peek() == '+' || peek() == '?')) ++_pos;
+            if (!at_end() && peek() == '{') return false;
+            out.kind = Ast::ANY_STRING;
+            return true;
+        }
+        rep.children.push_back(std::move(atom_ast));
+        out = std::move(rep);
+        return true;
+    }
+
+    static bool is_quantifier(char c) { return c == '*' || c == '+' || c == '?' || c == '{'; }
+
+    bool number(int& value) {
+        if (at_end() || !std::isdigit(static_cast<unsigned char>(peek()))) return false;
+        value = 0;
+        while (!at_end() && std::isdigit(static_cast<unsigned char>(peek()))) {
+            value = value * 10 + (_s[_pos++] - '0');
+            if (value > MAX_REPEAT) return false;
+        }
+        return true;
+    }
+
+    bool interval(int& min, int& max) {
+        if (!number(min)) return false;
+        max = min;
+        if (!at_end() && peek() == ',') {
+            ++_pos;
+            max = -1;
+            if (!at_end() && peek() != '}' && (!number(max) || max < min)) return false;
+        }
+        if (at_end() || peek() != '}') return false;
+        ++_pos;
+        return true;
+    }
+
+    bool atom(Ast& out) {
+        const char c = _s[_pos++];
+        switch (c) {
+            case '(': {
+                if (!at_end() && peek() == ')') {
+                    if (!_lenient) return false;  // empty group
+                    ++_pos;
+                    out.kind = Ast::EMPTY;
+                    return true;
+                }
+                if (!alternation(out)) return false;
+                if (at_end() || peek() != ')') return false;
+                ++_pos;
+                return true;
+            }
+            case '^': out.kind = Ast::BEGIN_LINE; return true;
+            case '$': out.kind = Ast::END_LINE; return true;
+            case '.':
+                // Anything but NUL, as std::regex has it for POSIX grammars
+                out.kind = Ast::CHARS;
+                out.chars.set();
+                out.chars.reset(0);
+                return true;
+            case '[': out.kind = Ast::CHARS; return bracket(out.chars);
+            case '\\': {
+                if (at_end()) return false;
+                const char e = _s[_pos++];
+                if (std::string_view("^$\\.*+?()[]{}|").find(e) == std::string_view::npos) {
+                    // \d, \w, \1 and friends: unknown semantics, anything goes
+                    if (!_lenient || !std::isalnum(static_cast<unsigned char>(e))) return false;
+                    out.kind = Ast::ANY_STRING;
+                    return true;
+                }
+                out.kind = Ast::CHARS;
+                add_char(out.chars, static_cast<unsigned char>(e));
+                return true;
+            }
+            case '*': case '+': case '?': case '{': case '}': case ']': case ')':
+                return false;
+            default:
+                out.kind = Ast::CHARS;
+                add_char(out.chars, static_cast<unsigned char>(c));
+                return true;
+        }
+    }
+
+    bool char_class(std::string_view name, CharSet& set) const {
+        int (*pred)(int) = nullptr;
+        if (name == "alnum") pred = [](int ch) { return std::isalnum(ch); };
+        else if (name == "alpha") pred = [](int ch) { return std::isalpha(ch); };
+        else if (name == "blank") pred = [](int ch) { return (ch == ' ' || ch == '\t') ? 1 : 0; };
+        else if (name == "cntrl") pred = [](int ch) { return std::iscntrl(ch); };
+        else if (name == "digit") pred = [](int ch) { return std::isdigit(ch); };
+        else if (name == "graph") pred = [](int ch) { return std::isgraph(ch); };
+        else if (name == "lower") pred = [](int ch) { return std::islower(ch); };
+        else if (name == "print") pred = [](int ch) { return std::isprint(ch); };
+        else if (name == "punct") pred = [](int ch) { return std::ispunct(ch); };
+        else if (name == "space") pred = [](int ch) { return std::isspace(ch); };
+        else if (name == "upper") pred = [](int ch) { return std::isupper(ch); };
+        else if (name == "xdigit") pred = [](int ch) { return std::isxdigit(ch); };
+        else return false;
+
+        for (int ch = 0; ch < 128; ++ch) {
+            if (pred(ch)) add_char(set, static_cast<unsigned char>(ch));
+        }
+        return true;
+    }
+
+    bool bracket(CharSet& set) {
+        bool negate = false;
+        if (!at_end() && peek() == '^') {
+            negate = true;
+            ++_pos;
+        }
+        bool first = true;
+        for (;;) {
+            if (at_end()) return false;
+            const unsigned char c = static_cast<unsigned char>(_s[_pos]);
+            if (c == ']' && !first) {
+                ++_pos;
+                break;
+            }
+            if (c == '[' && _pos + 1 < _s.size()) {
+                const char kind = _s[_pos + 1];
+                if (kind == '=' || kind == '.') return false;  // collating elements
+                if (kind == ':') {
+                    const std::size_t close = _s.find(":]", _pos + 2);
+                    if (close == std::string_view::npos) return false;
+                    if (!char_class(_s.substr(_pos + 2, close - _pos - 2), set)) {
+                        if (!_lenient) return false;
+                        set.set();
+                    }
+                    _pos = close + 2;
+                    first = false;
+                    continue;
+                }
+            }
+            const bool last = _pos + 1 < _s.size() && _s[_pos + 1] == ']';
+            if (c == '-' && !first && !last) {
+                if (!_lenient) return false;
+                set.set();
+            }
+            ++_pos;
+            first = false;
+
+            if (_pos + 1 < _s.size() && peek() == '-' && _s[_pos + 1] != ']') {
+                const unsigned char hi = static_cast<unsigned char>(_s[_pos + 1]);
+                if (c == '-' || c == ']' || hi == '[' || c >= 0x80 || hi >= 0x80 || c > hi) {
+                    if (!_lenient || hi == '[') return false;
+                    set.set();
+                }
+                for (unsigned ch = c; ch <= hi; ++ch) add_char(set, static_cast<unsigned char>(ch));
+                _pos += 2;
+            } else {
+                add_char(set, c);
+            }
+        }
+        if (negate) set.flip();
+        return true;
+    }
+
+public:
+    Parser(std::string_view expr, bool icase, bool lenient = false)
+        : _s(expr), _pos(0), _icase(icase), _lenient(lenient), _depth(0) {}
+
+    bool parse(Ast& out) {
+        if (_s.empty()) return false;
+        if (!alternation(out)) return false;
+        return at_end();
+    }
+};
+
+struct Node {
+    enum Op : std::uint8_t { CHAR, SPLIT, EPSILON, BEGIN_LINE, END_LINE, MATCH };
+    Op op;
+    std::int32_t out;
+    std::int32_t out1;
+    std::int32_t arg;    // CHAR: byte class set index, MATCH: level id
+    std::int32_t level;
+};
+
+struct FallbackLevel {
+    int id;
+    std::string expr;
+    std::regex pattern;
+};
+
+} // namespace
+
+/**
+ * Case-insensitive Aho-Corasick automaton over the literals every match of
+ * a level must contain. A line that hits none of a level's literals cannot
+ * match that level, so neither the DFA nor std::regex needs to look at it.
+ */
+struct Prefilter {
+    bool enabled = false;
+    std::vector<std::int32_t> trans;                // 256 entries per state
+    std::vector<std::int32_t> out;                  // per state, index into hits or -1
+    std::vector<std::vector<std::uint64_t>> hits;   // levels reported by a state
+    std::vector<std::uint64_t> always;              // levels without required literals
+    std::vector<unsigned char> skip;                // first bytes | 0x20, for the SIMD skip loop
+};
+
+struct Matcher::Program {
+    std::uint64_t id = 0;
+    std::vector<std::string> names;
+    std::vector<Node> nodes;
+    std::vector<CharSet> sets;
+    std::vector<std::int32_t> starts;
+    std::vector<FallbackLevel> fallbacks;
+    std::vector<std::uint64_t> dfa_levels;
+    Prefilter prefilter;
+    std::uint8_t byte_class[256] = {};
+    std::vector<unsigned char> class_rep;   // one representative byte per class
+    std::size_t words = 0;                  // 64-bit words in a level bitset
+    bool all = false;                       // Routing::ALL, report every match
+};
+
+namespace {
+
+std::atomic<std::uint64_t> next_program_id{1};
+
+/**
+ * Thompson construction of one level's AST into the shared node table.
+ * Holes are dangling out/out1 edges patched once the successor is known.
+ */
+class NfaBuilder {
+private:
+    Matcher::Program& _prog;
+    int _level;
+    using Holes = std::vector<std::pair<std::int32_t, bool>>;
+    struct Frag {
+        std::int32_t start;
+        Holes holes;
+    };
+
+    std::int32_t add(Node::Op op, std::int32_t arg = -1) {
+        _prog.nodes.push_back(Node{op, -1, -1, arg, _level});
+        return static_cast<std::int32_t>(_prog.nodes.size() - 1);
+    }
+
+    void patch(const Holes& holes, std::int32_t target) {
+        for (const auto& [node, second] : holes) {
+            (second ? _prog.nodes[node].out1 : _prog.nodes[node].out) = target;
+        }
+    }
+
+    std::int32_t add_set(const CharSet& set) {
+        for (std::size_t i = 0; i < _prog.sets.size(); ++i) {
+            if (_prog.sets[i] == set) return static_cast<std::int32_t>(i);
+        }
+        _prog.sets.push_back(set);
+        return static_cast<std::int32_t>(_prog.sets.size() - 1);
+    }
+
+    bool concat(Frag& acc, bool& empty, const Frag& next) {
+        if (empty) {
+            acc = next;
+            empty = false;
+        } else {
+            patch(acc.holes, next.start);
+            acc.holes = next.holes;
+        }
+        return true;
+    }
+
+    bool build(const Ast& ast, Frag& out) {
+        if (_prog.nodes.size() > MAX_NODES) return false;
+        switch (ast.kind) {
+            case Ast::CHARS: {
+                const std::int32_t n = add(Node::CHAR, add_set(ast.chars));
+                out = Frag{n, {{n, false}}};
+                return true;
+            }
+            case Ast::BEGIN_LINE:
+            case Ast::END_LINE: {
+                const std::int32_t n = add(ast.kind == Ast::BEGIN_LINE ? Node::BEGIN_LINE : Node::END_LINE);
+                out = Frag{n, {{n, false}}};
+                return true;
+            }
+            case Ast::CONCAT: {
+                bool empty = true;
+                for (const auto& child : ast.children) {
+                    Frag f;
+                    if (!build(child, f)) return false;
+                    concat(out, empty, f);
+                }
+                return true;
+            }
+            case Ast::ALTERNATE: {
+                Holes holes;
+                std::int32_t prev_split = -1;
+                for (std::size_t i = 0; i < ast.children.size(); ++i) {
+                    Frag f;
+                    if (!build(ast.children[i], f)) return false;
+                    holes.insert(holes.end(), f.holes.begin(), f.holes.end());
+                    std::int32_t entry = f.start;
+                    if (i + 1 < ast.children.size()) {
+                        entry = add(Node::SPLIT);
+                        _prog.nodes[entry].out = f.start;
+                    }
+                    if (prev_split < 0) out.start = entry;
+                    else _prog.nodes[prev_split].out1 = entry;
+                    prev_split = entry;
+                }
+                out.holes = std::move(holes);
+                return true;
+            }
+            case Ast::REPEAT: {
+                const Ast& child = ast.children[0];
+                bool empty = true;
+                for (int i = 0; i < ast.min; ++i) {
+                    Frag f;
+                    if (!build(child, f)) return false;
+                    if (ast.max < 0 && i + 1 == ast.min) {
+                        // x+ : loop back into the last mandatory copy
+                        const std::int32_t split = add(Node::SPLIT);
+                        _prog.nodes[split].out = f.start;
+                        patch(f.holes, split);
+                        f.holes = {{split, true}};
+                    }
+                    concat(out, empty, f);
+                }
+                if (ast.max < 0 && ast.min == 0) {
+                    Frag f;
+                    if (!build(child, f)) return false;
+                    const std::int32_t split = add(Node::SPLIT);
+                    _prog.nodes[split].out = f.start;
+                    patch(f.holes, split);
+                    concat(out, empty, Frag{split, {{split, true}}});
+                }
+                for (int i = ast.min; ast.max >= 0 && i < ast.max; ++i) {
+                    Frag f;
+                    if (!build(child, f)) return false;
+                    const std::int32_t split = add(Node::SPLIT);
+                    _prog.nodes[split].out = f.start;
+                    f.holes.emplace_back(split, true);
+                    f.start = split;
+                    concat(out, empty, f);
+                }
+                if (empty) {
+                    const std::int32_t n = add(Node::EPSILON);
+                    out = Frag{n, {{n, false}}};
+                }
+                return true;
+            }
+            case Ast::EMPTY:
+            case Ast::ANY_STRING:
+                return false;  // lenient parses only
+        }
+        return false;
+    }
+
+public:
+    NfaBuilder(Matcher::Program& prog, int level): _prog(prog), _level(level) {}
+
+    bool add_level(const Ast& ast) {
+        const std::size_t mark = _prog.nodes.size();
+        const std::size_t set_mark = _prog.sets.size();
+        Frag f;
+        if (!build(ast, f)) {
+            _prog.nodes.resize(mark);
+            _prog.sets.resize(set_mark);
+            return false;
+        }
+        const std::int32_t match = add(Node::MATCH, _level);
+        patch(f.holes, match);
+        _prog.starts.push_back(f.start);
+        return true;
+    }
+};
+
+void compute_byte_classes(Matcher::Program& prog) {
+    std::unordered_map<std::string, std::uint8_t> classes;
+    std::vector<bool> used(prog.sets.size(), false);
+    for (const auto& node : prog.nodes) {
+        if (node.op == Node::CHAR) used[static_cast<std::size_t>(node.arg)] = true;
+    }
+    prog.class_rep.clear();
+    for (unsigned b = 0; b < 256; ++b) {
+        std::string signature(prog.sets.size(), '0');
+        for (std::size_t i = 0; i < prog.sets.size(); ++i) {
+            if (used[i] && prog.sets[i].test(b)) signature[i] = '1';
+        }
+        auto [it, inserted] = classes.emplace(signature, static_cast<std::uint8_t>(classes.size()));
+        if (inserted) prog.class_rep.push_back(static_cast<unsigned char>(b));
+        prog.byte_class[b] = it->second;
+    }
+}
+
+constexpr std::size_t MAX_EXACT = 64;
+constexpr std::size_t MAX_LITERAL = 64;
+constexpr std::size_t MAX_SKIP_BYTES = 8;
+
+/**
+ * Literal summary of an AST node. When `exact` is set, `set` holds every
+ * string the node can match; otherwise any match contains one of `set`,
+ * and an empty `set` means there is no constraint at all.
+ */
+struct Literals {
+    bool exact = false;
+    std::vector<std::string> set;
+};
+
+using LiteralSet = std::vector<std::string>;
+
+LiteralSet required(const Literals& lit) {
+    if (!lit.exact) return lit.set;
+    for (const auto& s : lit.set) {
+        if (s.empty()) return {};
+    }
+    return lit.set;
+}
+
+std::size_t min_length(const LiteralSet& set) {
+    std::size_t len = std::string::npos;
+    for (const auto& s : set) len = std::min(len, s.size());
+    return len;
+}
+
+// Pick the more selective of two requirements
+LiteralSet better(LiteralSet a, LiteralSet b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    const std::size_t la = min_length(a);
+    const std::size_t lb = min_length(b);
+    if (la != lb) return la > lb ? a : b;
+    return a.size() <= b.size() ? a : b;
+}
+
+void unique(LiteralSet& set) {
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+}
+
+LiteralSet cross(const LiteralSet& a, const LiteralSet& b) {
+    LiteralSet out;
+    out.reserve(a.size() * b.size());
+    for (const auto& x : a) {
+        for (const auto& y : b) out.push_back(x + y);
+    }
+    unique(out);
+    return out;
+}
+
+bool too_long(const LiteralSet& set) {
+    for (const auto& s : set) {
+        if (s.size() > MAX_LITERAL) return true;
+    }
+    return false;
+}
+
+Literals extract(const Ast& ast) {
+    switch (ast.kind) {
+        case Ast::CHARS: {
+            LiteralSet set;
+            for (unsigned b = 0; b < 256; ++b) {
+                if (!ast.chars.test(b)) continue;
+                set.emplace_back(1, static_cast<char>(ascii_lower(static_cast<unsigned char>(b))));
+                if (set.size() > 8) return {};
+            }
+            unique(set);
+            if (set.size() > 4) return {};
+            return {true, set};
+        }
+        case Ast::BEGIN_LINE:
+        case Ast::END_LINE:
+        case Ast::EMPTY:
+            return {true, {""}};
+        case Ast::ANY_STRING:
+            return {};
+        case Ast::CONCAT: {
+            // Accumulate runs of exact children, keep the best requirement seen
+            LiteralSet run{""};
+            LiteralSet best;
+            bool exact = true;
+            for (const auto& child : ast.children) {
+                const Literals lit = extract(child);
+                if (lit.exact && run.size() * lit.set.size() <= MAX_EXACT) {
+                    LiteralSet next = cross(run, lit.set);
+                    if (!too_long(next)) {
+                        run = std::move(next);
+                        continue;
+                    }
+                }
+                exact = false;
+                best = better(best, required({true, run}));
+                if (lit.exact) {
+                    run = lit.set;
+                } else {
+                    best = better(best, lit.set);
+                    run = {""};
+                }
+            }
+            if (exact) return {true, run};
+            return {false, better(best, required({true, run}))};
+        }
+        case Ast::ALTERNATE: {
+            Literals out{true, {}};
+            LiteralSet any_of;
+            bool constrained = true;
+            for (const auto& child : ast.children) {
+                const Literals lit = extract(child);
+                if (out.exact && lit.exact && out.set.size() + lit.set.size() <= MAX_EXACT) {
+                    out.set.insert(out.set.end(), lit.set.begin(), lit.set.end());
+                } else {
+                    out.exact = false;
+                }
+                const LiteralSet req = required(lit);
+                if (req.empty()) constrained = false;
+                any_of.insert(any_of.end(), req.begin(), req.end());
+            }
+            if (out.exact) {
+                unique(out.set);
+                return out;
+            }
+            if (!constrained) return {};
+            unique(any_of);
+            return {false, any_of};
+        }
+        case Ast::REPEAT: {
+            if (ast.max == 0) return {true, {""}};
+            const Literals lit = extract(ast.children[0]);
+            if (lit.exact && ast.max > 0) {
+                LiteralSet all;
+                LiteralSet power{""};
+                bool fits = true;
+                for (int k = 0; k <= ast.max && fits; ++k) {
+                    if (k >= ast.min) all.insert(all.end(), power.begin(), power.end());
+                    if (k == ast.max) break;
+                    if (power.size() * lit.set.size() > MAX_EXACT) {
+                        fits = false;
+                        break;
+                    }
+                    power = cross(power, lit.set);
+                    fits = all.size() <= MAX_EXACT && !too_long(power);
+                }
+                if (fits && all.size() <= MAX_EXACT) {
+                    unique(all);
+                    return {true, all};
+                }
+            }
+            if (ast.min >= 1) return {false, required(lit)};
+            return {};
+        }
+    }
+    return {};
+}
+
+} // namespace
+
+std::vector<std::string> required_literals(std::string_view expr) {
+    Ast ast;
+    if (!Parser(expr, true, true).parse(ast)) return {};
+    LiteralSet set = required(extract(ast));
+    // "warn" already covers "warning"
+    std::sort(set.begin(), set.end(), [](const std::string& a, const std::string& b) {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    });
+    LiteralSet minimal;
+    for (const auto& s : set) {
+        const bool covered = std::any_of(minimal.begin(), minimal.end(), [&](const std::string& m) {
+            return s.find(m) != std::string::npos;
+        });
+        if (!covered) minimal.push_back(s);
+    }
+    return minimal;
+}
+
+namespace {
+
+void build_prefilter(Matcher::Program& prog, const std::vector<LiteralSet>& literals, const std::vector<bool>& active) {
+    Prefilter& pf = prog.prefilter;
+    pf.always.assign(prog.words, 0);
+    std::vector<std::vector<std::uint64_t>> outputs(1, std::vector<std::uint64_t>(prog.words, 0));
+    pf.trans.assign(256, -1);
+
+    for (std::size_t level = 0; level < literals.size(); ++level) {
+        if (!active[level]) continue;
+        if (literals[level].empty()) {
+            pf.always[level / 64] |= std::uint64_t{1} << (level % 64);
+            continue;
+        }
+        pf.enabled = true;
+        for (const auto& literal : literals[level]) {
+            std::int32_t state = 0;
+            for (const char ch : literal) {
+                const unsigned char c = static_cast<unsigned char>(ch);
+                std::int32_t& next = pf.trans[static_cast<std::size_t>(state) * 256 + c];
+                if (next < 0) {
+                    next = static_cast<std::int32_t>(outputs.size());
+                    pf.trans[static_cast<std::size_t>(state) * 256 + ascii_upper(c)] = next;
+                    outputs.emplace_back(prog.words, 0);
+                    pf.trans.resize(pf.trans.size() + 256, -1);
+                }
+                state = pf.trans[static_cast<std::size_t>(state) * 256 + c];
+            }
+            outputs[static_cast<std::size_t>(state)][level / 64] |= std::uint64_t{1} << (level % 64);
+        }
+    }
+    if (!pf.enabled) return;
+
+    // Breadth first: resolve failure links into a full transition table
+    std::vector<std::int32_t> fail(outputs.size(), 0);
+    std::vector<bool> seen(outputs.size(), false);
+    std::vector<std::int32_t> queue;
+    std::vector<bool> first_byte(256, false);
+    for (unsigned c = 0; c < 256; ++c) {
+        std::int32_t& next = pf.trans[c];
+        if (next < 0) {
+            next = 0;
+        } else {
+            first_byte[c] = true;
+            if (!seen[static_cast<std::size_t>(next)]) queue.push_back(next);
+            seen[static_cast<std::size_t>(next)] = true;
+        }
+    }
+    for (std::size_t head = 0; head < queue.size(); ++head) {
+        const std::int32_t u = queue[head];
+        for (unsigned c = 0; c < 256; ++c) {
+            std::int32_t& next = pf.trans[static_cast<std::size_t>(u) * 256 + c];
+            const std::int32_t via_fail = pf.trans[static_cast<std::size_t>(fail[static_cast<std::size_t>(u)]) * 256 + c];
+            if (next < 0) {
+                next = via_fail;
+            } else if (!seen[static_cast<std::size_t>(next)]) {
+                seen[static_cast<std::size_t>(next)] = true;
+                fail[static_cast<std::size_t>(next)] = via_fail;
+                for (std::size_t w = 0; w < prog.words; ++w) {
+                    outputs[static_cast<std::size_t>(next)][w] |= outputs[static_cast<std::size_t>(via_fail)][w];
+                }
+                queue.push_back(next);
+            }
+        }
+    }
+
+    pf.out.assign(outputs.size(), -1);
+    for (std::size_t state = 0; state < outputs.size(); ++state) {
+        const bool any = std::any_of(outputs[state].begin(), outputs[state].end(), [](std::uint64_t w) { return w != 0; });
+        if (!any) continue;
+        pf.out[state] = static_cast<std::int32_t>(pf.hits.size());
+        pf.hits.push_back(outputs[state]);
+    }
+
+    std::vector<unsigned char> skip;
+    for (unsigned c = 0; c < 256; ++c) {
+        const unsigned char folded = static_cast<unsigned char>(c | 0x20);
+        if (first_byte[c] && std::find(skip.begin(), skip.end(), folded) == skip.end()) skip.push_back(folded);
+    }
+    if (skip.size() <= MAX_SKIP_BYTES) pf.skip = std::move(skip);
+}
+
+// Advance to the next byte that could start a literal
+const unsigned char* skip_ahead(const Prefilter& pf, const unsigned char* p, const unsigned char* end) {
+#if defined(__SSE2__)
+    const std::size_t n = pf.skip.size();
+    __m128i wanted[MAX_SKIP_BYTES];
+    for (std::size_t i = 0; i < n; ++i) wanted[i] = _mm_set1_epi8(static_cast<char>(pf.skip[i]));
+    const __m128i fold = _mm_set1_epi8(0x20);
+    for (; end - p >= 16; p += 16) {
+        const __m128i block = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), fold);
+        __m128i hit = _mm_cmpeq_epi8(block, wanted[0]);
+        for (std::size_t i = 1; i < n; ++i) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, wanted[i]));
+        const int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+#else
+    (void)pf;
+    (void)end;
+#endif
+    return p;
+}
+
+// Levels that may match the line, or false when the prefilter rules all out
+bool prefilter(const Matcher::Program& prog, std::string_view line, std::vector<std::uint64_t>& candidates) {
+    const Prefilter& pf = prog.prefilter;
+    candidates = pf.always;
+    const auto* p = reinterpret_cast<const unsigned char*>(line.data());
+    const auto* end = p + line.size();
+    const bool skip = !pf.skip.empty();
+    std::int32_t state = 0;
+    while (p < end) {
+        if (state == 0 && skip) {
+            p = skip_ahead(pf, p, end);
+            if (p == end) break;
+        }
+        state = pf.trans[static_cast<std::size_t>(state) * 256 + *p++];
+        const std::int32_t hit = pf.out[static_cast<std::size_t>(state)];
+        if (hit >= 0) {
+            const auto& levels = pf.hits[static_cast<std::size_t>(hit)];
+            for (std::size_t w = 0; w < prog.words; ++w) candidates[w] |= levels[w];
+        }
+    }
+    return std::any_of(candidates.begin(), candidates.end(), [](std::uint64_t w) { return w != 0; });
+}
+
+// Every state of a loaded automaton, and every index it hands out, in range
+bool valid_prefilter(const Prefilter& pf, std::size_t words) {
+    if (pf.trans.empty() || pf.trans.size() % 256 != 0) return false;
+    const std::size_t states = pf.trans.size() / 256;
+    if (pf.out.size() != states || pf.always.size() != words || pf.skip.size() > MAX_SKIP_BYTES) return false;
+    for (const std::int32_t next : pf.trans) {
+        if (next < 0 || static_cast<std::size_t>(next) >= states) return false;
+    }
+    for (const std::int32_t hit : pf.out) {
+        if (hit < -1 || hit >= static_cast<std::int32_t>(pf.hits.size())) return false;
+    }
+    return std::all_of(pf.hits.begin(), pf.hits.end(), [words](const auto& levels) { return levels.size() == words; });
+}
+
+bool intersects(const std::vector<std::uint64_t>& a, const std::vector<std::uint64_t>& b) {
+    for (std::size_t w = 0; w < a.size(); ++w) {
+        if (a[w] & b[w]) return true;
+    }
+    return false;
+}
+
+bool has_level(const std::vector<std::uint64_t>& bits, int id) {
+    return (bits[static_cast<std::size_t>(id) / 64] >> (id % 64)) & 1;
+}
+
+/**
+ * Lazily built DFA over a Program. Each DFA state is the set of NFA threads
+ * waiting on input plus the levels already matched; threads belonging to a
+ * level that can no longer win are pruned, so once the top priority level
+ * matches the state goes dead and the scan stops early. When every match
+ * is wanted, only the threads of levels already matched are pruned and the
+ * scan stops once all levels have matched.
+ */
+class Dfa {
+private:
+    struct State {
+        std::vector<std::int32_t> threads;
+        std::vector<std::uint64_t> matched;
+        bool at_begin;
+        int eof;   // cached end-of-line verdict, -2 until computed
+        std::vector<std::uint64_t> eof_matched;  // every level matched at end of line, with eof
+    };
+
+    std::vector<State> _states;
+    std::vector<std::int32_t> _trans;
+    std::vector<std::uint8_t> _dead;
+    std::unordered_map<std::string, std::int32_t> _index;
+    std::size_t _max_states;
+    std::int32_t _start;
+
+    std::vector<std::uint32_t> _stamp;
+    std::uint32_t _gen;
+    std::vector<std::int32_t> _stack;
+
+    static int first_level(const std::vector<std::uint64_t>& bits) {
+        for (std::size_t w = 0; w < bits.size(); ++w) {
+            if (bits[w] != 0) return static_cast<int>(w * 64 + static_cast<std::size_t>(__builtin_ctzll(bits[w])));
+        }
+        return Matcher::NO_MATCH;
+    }
+
+    // Follow epsilon edges from everything on _stack
+    void closure(bool at_begin, bool at_end, std::vector<std::int32_t>& threads, std::vector<std::uint64_t>& matched) {
+        if (++_gen == 0) {
+            std::fill(_stamp.begin(), _stamp.end(), 0);
+            _gen = 1;
+        }
+        const auto& nodes = prog->nodes;
+        while (!_stack.empty()) {
+            const std::int32_t n = _stack.back();
+            _stack.pop_back();
+            if (n < 0 || _stamp[static_cast<std::size_t>(n)] == _gen) continue;
+            _stamp[static_cast<std::size_t>(n)] = _gen;
+            const Node& node = nodes[static_cast<std::size_t>(n)];
+            switch (node.op) {
+                case Node::CHAR: threads.push_back(n); break;
+                case Node::SPLIT: _stack.push_back(node.out1); _stack.push_back(node.out); break;
+                case Node::EPSILON: _stack.push_back(node.out); break;
+                case Node::BEGIN_LINE: if (at_begin) _stack.push_back(node.out); break;
+                case Node::END_LINE:
+                    if (at_end) _stack.push_back(node.out);
+                    else threads.push_back(n);
+                    break;
+                case Node::MATCH:
+                    matched[static_cast<std::size_t>(node.arg) / 64] |= std::uint64_t{1} << (node.arg % 64);
+                    break;
+            }
+        }
+    }
+
+    // Keep only the best match and drop threads that can no longer beat it,
+    // or when reporting every match, drop the threads of matched levels
+    void prune(std::vector<std::int32_t>& threads, std::vector<std::uint64_t>& matched) const {
+        const auto& nodes = prog->nodes;
+        if (prog->all) {
+            threads.erase(std::remove_if(threads.begin(), threads.end(), [&](std::int32_t n) {
+                return has_level(matched, nodes[static_cast<std::size_t>(n)].level);
+            }), threads.end());
+            return;
+        }
+        const int best = first_level(matched);
+        if (best == Matcher::NO_MATCH) return;
+        std::fill(matched.begin(), matched.end(), 0);
+        matched[static_cast<std::size_t>(best) / 64] |= std::uint64_t{1} << (best % 64);
+        threads.erase(std::remove_if(threads.begin(), threads.end(), [&](std::int32_t n) {
+            return nodes[static_cast<std::size_t>(n)].level >= best;
+        }), threads.end());
+    }
+
+    void seed_starts(const std::vector<std::uint64_t>& matched) {
+        const int best = prog->all ? Matcher::NO_MATCH : first_level(matched);
+        for (std::size_t level = 0; level < prog->starts.size(); ++level) {
+            const std::int32_t start = prog->starts[level];
+            const int id = prog->nodes[static_cast<std::size_t>(start)].level;
+            if (best != Matcher::NO_MATCH && id >= best) continue;
+            if (prog->all && has_level(matched, id)) continue;
+            _stack.push_back(start);
+        }
+    }
+
+    std::int32_t intern(State&& state) {
+        std::sort(state.threads.begin(), state.threads.end());
+        std::string key;
+        key.reserve(1 + state.matched.size() * 8 + state.threads.size() * 4);
+        key.push_back(state.at_begin ? '\1' : '\0');
+        key.append(reinterpret_cast<const char*>(state.matched.data()), state.matched.size() * 8);
+        key.append(reinterpret_cast<const char*>(state.threads.data()), state.threads.size() * 4);
+        if (const auto it = _index.find(key); it != _index.end()) return it->second;
+
+        const std::int32_t id = static_cast<std::int32_t>(_states.size());
+        _dead.push_back(state.threads.empty() && !state.at_begin ? 1 : 0);
+        _states.push_back(std::move(state));
+        _trans.resize(_trans.size() + prog->class_rep.size(), -1);
+        _index.emplace(std::move(key), id);
+        return id;
+    }
+
+    void reset() {
+        _states.clear();
+        _trans.clear();
+        _dead.clear();
+        _index.clear();
+
+        State start{{}, std::vector<std::uint64_t>(prog->words, 0), true, -2, {}};
+        seed_starts(start.matched);
+        closure(true, false, start.threads, start.matched);
+        prune(start.threads, start.matched);
+        _start = intern(std::move(start));
+    }
+
+    std::int32_t step(std::int32_t from, unsigned char byte) {
+        if (_states.size() >= _max_states) {
+            State keep = _states[static_cast<std::size_t>(from)];
+            reset();
+            from = intern(std::move(keep));
+        }
+        const State& src = _states[static_cast<std::size_t>(from)];
+        State next{{}, src.matched, false, -2, {}};
+        for (const std::int32_t n : src.threads) {
+            const Node& node = prog->nodes[static_cast<std::size_t>(n)];
+            if (node.op == Node::CHAR && prog->sets[static_cast<std::size_t>(node.arg)].test(byte)) {
+                _stack.push_back(node.out);
+            }
+        }
+        seed_starts(next.matched);
+        closure(false, false, next.threads, next.matched);
+        prune(next.threads, next.matched);
+
+        const std::int32_t to = intern(std::move(next));
+        _trans[static_cast<std::size_t>(from) * prog->class_rep.size() + prog->byte_class[byte]] = to;
+        return to;
+    }
+
+    int eof(std::int32_t s) {
+        State& state = _states[static_cast<std::size_t>(s)];
+        if (state.eof != -2) return state.eof;
+        std::vector<std::uint64_t> matched = state.matched;
+        std::vector<std::int32_t> threads;
+        for (const std::int32_t n : state.threads) {
+            const Node& node = prog->nodes[static_cast<std::size_t>(n)];
+            if (node.op == Node::END_LINE) _stack.push_back(node.out);
+        }
+        closure(state.at_begin, true, threads, matched);
+        state.eof = first_level(matched);
+        state.eof_matched = std::move(matched);
+        return state.eof;
+    }
+
+    std::int32_t scan(std::string_view line) {
+        const auto* p = reinterpret_cast<const unsigned char*>(line.data());
+        const auto* end = p + line.size();
+        const std::size_t width = prog->class_rep.size();
+        const std::uint8_t* byte_class = prog->byte_class;
+        std::int32_t s = _start;
+        for (; p < end && !_dead[static_cast<std::size_t>(s)]; ++p) {
+            std::int32_t t = _trans[static_cast<std::size_t>(s) * width + byte_class[*p]];
+            if (t < 0) t = step(s, *p);
+            s = t;
+        }
+        return s;
+    }
+
+public:
+    std::shared_ptr<const Matcher::Program> prog;
+
+    explicit Dfa(std::shared_ptr<const Matcher::Program> program)
+        : _max_states(0), _start(0), _gen(0), prog(std::move(program)) {
+        _stamp.assign(prog->nodes.size(), 0);
+        const std::size_t row = std::max<std::size_t>(prog->class_rep.size(), 1) * sizeof(std::int32_t);
+        _max_states = std::max<std::size_t>(64, DFA_CACHE_BYTES / row);
+        reset();
+    }
+
+    int search(std::string_view line) {
+        return eof(scan(line));
+    }
+
+    // Valid until the next search
+    const std::vector<std::uint64_t>& search_all(std::string_view line) {
+        const std::int32_t s = scan(line);
+        eof(s);
+        return _states[static_cast<std::size_t>(s)].eof_matched;
+    }
+};
+
+// DFA caches are per thread, so matching never takes a lock
+Dfa& dfa_for(const std::shared_ptr<const Matcher::Program>& prog) {
+    thread_local std::vector<std::unique_ptr<Dfa>> cache;
+    for (std::size_t i = 0; i < cache.size(); ++i) {
+        if (cache[i]->prog->id == prog->id) {
+            if (i != 0) std::rotate(cache.begin(), cache.begin() + static_cast<std::ptrdiff_t>(i), cache.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+            return *cache[0];
+        }
+    }
+    if (cache.size() >= DFA_CACHE_SLOTS) cache.pop_back();
+    cache.insert(cache.begin(), std::make_unique<Dfa>(prog));
+    return *cache[0];
+}
+
+} // namespace
+
+Matcher::Matcher(): _prog(std::make_shared<Program>()) {}
+
+bool parse_routing(const std::string& name, Routing& routing) {
+    if (name == "first") {
+        routing = Routing::FIRST;
+    } else if (name == "all") {
+        routing = Routing::ALL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Matcher::Matcher(const std::map<std::string, UserLevel>& levels, Routing routing) {
+    auto prog = std::make_shared<Program>();
+    prog->id = next_program_id.fetch_add(1);
+    prog->words = (levels.size() + 63) / 64;
+    prog->all = routing == Routing::ALL;
+
+    prog->dfa_levels.assign(prog->words, 0);
+
+    // Ids follow priority, highest first; the map keeps ties in name order
+    std::vector<std::map<std::string, UserLevel>::const_pointer> ordered;
+    for (const auto& entry : levels) ordered.push_back(&entry);
+    std::stable_sort(ordered.begin(), ordered.end(), [](const auto* a, const auto* b) {
+        return a->second.priority > b->second.priority;
+    });
+
+    int id = 0;
+    std::vector<LiteralSet> literals;
+    std::vector<bool> active;
+    for (const auto* entry : ordered) {
+        const std::string& name = entry->first;
+        const UserLevel& level = entry->second;
+        prog->names.push_back(name);
+        literals.push_back(required_literals(level.expr));
+        // NOTE: a pattern that failed to compile can never match, so it gets no matcher
+        active.push_back(level.valid);
+        if (!active.back()) {
+            ++id;
+            continue;
+        }
+        Ast ast;
+        if (Parser(level.expr, true).parse(ast) && NfaBuilder(*prog, id).add_level(ast)) {
+            prog->dfa_levels[static_cast<std::size_t>(id) / 64] |= std::uint64_t{1} << (id % 64);
+            log(LogLevel::DEBUG, "Matcher: level '" + name + "' compiled into DFA");
+        } else {
+            // Levels restored from the config cache carry no compiled regex
+            const bool compiled = (level.pattern.flags() & std::regex_constants::extended) != 0;
+            prog->fallbacks.push_back(FallbackLevel{id, level.expr, compiled ? level.pattern : _re_compile(level.expr)});
+            log(LogLevel::INFO, "Matcher: level '" + name + "' uses std::regex fallback");
+        }
+        if (literals.back().empty()) {
+            log(LogLevel::DEBUG, "Matcher: level '" + name + "' has no required literals");
+        }
+        ++id;
+    }
+    compute_byte_classes(*prog);
+    build_prefilter(*prog, literals, active);
+    _prog = std::move(prog);
+}
+
+int Matcher::match(std::string_view line) const {
+    const Program& prog = *_prog;
+    thread_local std::vector<std::uint64_t> candidates;
+    const bool filtered = prog.prefilter.enabled;
+    if (filtered && !prefilter(prog, line, candidates)) return NO_MATCH;
+
+    int best = NO_MATCH;
+    if (!prog.starts.empty() && (!filtered || intersects(candidates, prog.dfa_levels))) {
+        best = dfa_for(_prog).search(line);
+    }
+    for (const auto& fallback : prog.fallbacks) {
+        if (best != NO_MATCH && fallback.id > best) break;
+        if (filtered && !has_level(candidates, fallback.id)) continue;
+        if (Stats::enabled()) stats().regex_evaluations.fetch_add(1, std::memory_order_relaxed);
+        try {
+            if (std::regex_search(line.begin(), line.end(), fallback.pattern)) return fallback.id;
+        } catch (const std::regex_error& e) {
+            log(LogLevel::ERROR, std::string("Regex error: ") + e.what());
+        }
+    }
+    return best;
+}
+
+void Matcher::match_all(std::string_view line, std::vector<int>& ids) const {
+    ids.clear();
+    const Program& prog = *_prog;
+    if (!prog.all) {
+        const int id = match(line);
+        if (id != NO_MATCH) ids.push_back(id);
+        return;
+    }
+    thread_local std::vector<std::uint64_t> candidates;
+    thread_local std::vector<std::uint64_t> matched;
+    const bool filtered = prog.prefilter.enabled;
+    if (filtered && !prefilter(prog, line, candidates)) return;
+
+    matched.assign(prog.words, 0);
+    if (!prog.starts.empty() && (!filtered || intersects(candidates, prog.dfa_levels))) {
+        matched = dfa_for(_prog).search_all(line);
+    }
+    for (const auto& fallback : prog.fallbacks) {
+        if (filtered && !has_level(candidates, fallback.id)) continue;
+        if (Stats::enabled()) stats().regex_evaluations.fetch_add(1, std::memory_order_relaxed);
+        try {
+            if (std::regex_search(line.begin(), line.end(), fallback.pattern)) {
+                matched[static_cast<std::size_t>(fallback.id) / 64] |= std::uint64_t{1} << (fallback.id % 64);
+            }
+        } catch (const std::regex_error& e) {
+            log(LogLevel::ERROR, std::string("Regex error: ") + e.what());
+        }
+    }
+    for (std::size_t w = 0; w < matched.size(); ++w) {
+        for (std::uint64_t bits = matched[w]; bits != 0; bits &= bits - 1) {
+            ids.push_back(static_cast<int>(w * 64 + static_cast<std::size_t>(__builtin_ctzll(bits))));
+        }
+    }
+}
+
+Routing Matcher::routing() const {
+    return _prog->all ? Routing::ALL : Routing::FIRST;
+}
+
+void Matcher::save(ByteWriter& out) const {
+    const Program& prog = *_prog;
+    out.put(prog.names);
+    out.put(prog.nodes);
+    out.put(prog.sets);
+    out.put(prog.starts);
+    out.put(static_cast<std::uint64_t>(prog.fallbacks.size()));
+    for (const auto& fallback : prog.fallbacks) {
+        out.put(static_cast<std::int32_t>(fallback.id));
+        out.put(fallback.expr);
+    }
+    out.put(prog.dfa_levels);
+    out.put(prog.prefilter.enabled);
+    out.put(prog.prefilter.trans);
+    out.put(prog.prefilter.out);
+    out.put(prog.prefilter.hits);
+    out.put(prog.prefilter.always);
+    out.put(prog.prefilter.skip);
+    out.put(prog.byte_class);
+    out.put(prog.class_rep);
+    out.put(static_cast<std::uint64_t>(prog.words));
+    out.put(prog.all);
+}
+
+bool Matcher::load(ByteReader& in) {
+    auto prog = std::make_shared<Program>();
+    in.get(prog->names);
+    in.get(prog->nodes);
+    in.get(prog->sets);
+    in.get(prog->starts);
+    std::uint64_t fallbacks = 0;
+    in.get(fallbacks);
+    for (std::uint64_t i = 0; in.ok() && i < fallbacks; ++i) {
+        std::int32_t id = 0;
+        std::string expr;
+        in.get(id);
+        in.get(expr);
+        // std::regex has no serialized form, only these levels pay for compiling
+        if (in.ok()) prog->fallbacks.push_back(FallbackLevel{id, expr, _re_compile(expr)});
+    }
+    in.get(prog->dfa_levels);
+    in.get(prog->prefilter.enabled);
+    in.get(prog->prefilter.trans);
+    in.get(prog->prefilter.out);
+    in.get(prog->prefilter.hits);
+    in.get(prog->prefilter.always);
+    in.get(prog->prefilter.skip);
+    in.get(prog->byte_class);
+    in.get(prog->class_rep);
+    std::uint64_t words = 0;
+    in.get(words);
+    in.get(prog->all);
+    if (!in.ok()) return false;
+
+    // Don't trust indices from disk blindly, a bad cache must not crash the matcher:
+    // every index the DFA, the prefilter or the fallbacks follow is checked here
+    if (words != (prog->names.size() + 63) / 64 || prog->dfa_levels.size() != words) return false;
+    const auto level_id = [&prog](std::int32_t id) {
+        return id >= 0 && static_cast<std::size_t>(id) < prog->names.size();
+    };
+    const auto nodes = static_cast<std::int32_t>(prog->nodes.size());
+    for (const auto& node : prog->nodes) {
+        if (node.out >= nodes || node.out1 >= nodes || !level_id(node.level)) return false;
+        if (node.op == Node::CHAR && (node.arg < 0 || static_cast<std::size_t>(node.arg) >= prog->sets.size())) return false;
+        if (node.op == Node::MATCH && !level_id(node.arg)) return false;
+    }
+    for (const auto start : prog->starts) {
+        if (start < 0 || start >= nodes) return false;
+    }
+    for (const auto& fallback : prog->fallbacks) {
+        if (!level_id(fallback.id)) return false;
+    }
+    for (const std::uint8_t byte_class : prog->byte_class) {
+        if (byte_class >= prog->class_rep.size()) return false;
+    }
+    if (prog->prefilter.enabled && !valid_prefilter(prog->prefilter, static_cast<std::size_t>(words))) return false;
+
+    prog->words = static_cast<std::size_t>(words);
+    prog->id = next_program_id.fetch_add(1);
+    _prog = std::move(prog);
+    return true;
+}
+
+const std::string& Matcher::level_name(int id) const {
+    return _prog->names.at(static_cast<std::size_t>(id));
+}
+
+std::size_t Matcher::size() const {
+    return _prog->names.size();
+}
+
+std::size_t Matcher::fallback_count() const {
+    return _prog->fallbacks.size();
+}
+
+} // namespace timbre
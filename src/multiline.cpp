@@ -0,0 +1,25 @@
+#include <map>
+#include "timbre/config.h"
+#include "timbre/multiline.h"
+
+namespace timbre {
+
+bool Multiline::compile() {
+    std::map<std::string, UserLevel> levels;
+    UserLevel& level = levels["multiline"];
+    level.expr = start.empty() ? continuation : start;
+    level.pattern = _re_compile(level.expr);
+    level.valid = (level.pattern.flags() & std::regex_constants::extended) != 0;
+    matcher = Matcher(levels);
+    return level.valid;
+}
+
+bool EventGrouper::join(const Multiline& policy, std::chrono::steady_clock::time_point now) {
+    if (_lines == 0 || _lines >= policy.max_lines) return false;
+    if (policy.timeout > 0 && now - _last > std::chrono::milliseconds(policy.timeout)) return false;
+    ++_lines;
+    _last = now;
+    return true;
+}
+
+} // namespace timbre
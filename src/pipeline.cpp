@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "timbre/log.h"
+#include "timbre/matcher.h"
+#include "timbre/pipeline.h"
+#include "timbre/queue.h"
+#include "timbre/reload.h"
+#include "timbre/stats.h"
+#include "timbre/timbre.h"
+
+namespace timbre {
+
+namespace {
+
+constexpr std::size_t BATCHES_PER_WORKER = 4;
+constexpr unsigned IDLE_SPINS = 256;
+constexpr std::size_t MAPPED_CHUNK_SIZE = 1 << 20;
+
+struct Batch {
+    std::uint64_t seq = 0;
+    std::string data;       // owned copy for input read from a descriptor
+    std::string_view text;  // the batch's lines, into data or a mapped file
+    std::vector<std::string_view> lines;
+    std::vector<std::pair<std::size_t, int>> routes;  // (line, level), in line order
+    std::vector<bool> continues;  // with [multiline]: per line, left unclassified
+    bool teed = false;  // already copied to stdout by tee(2)
+    std::shared_ptr<UserConfig> config;  // reloaded rules to classify with, null for the initial ones
+};
+
+void classify(const Matcher& matcher, const LevelField& field, const Multiline& multiline, Batch& batch) {
+    batch.lines.clear();
+    batch.routes.clear();
+    batch.continues.clear();
+    const bool all = matcher.routing() == Routing::ALL;
+    std::vector<int> ids;
+    const char* p = batch.text.data();
+    const char* end = p + batch.text.size();
+    while (p < end) {
+        const char* nl = find_newline(p, end);
+        const std::string_view line(p, static_cast<std::size_t>(nl - p));
+        const std::size_t index = batch.lines.size();
+        batch.lines.push_back(line);
+        p = nl + 1;
+        // A line continuing an event most likely goes where the event went,
+        // the writer classifies it should it start one after all
+        if (multiline.enabled()) {
+            batch.continues.push_back(multiline.continues(line));
+            if (batch.continues.back()) continue;
+        }
+        if (line.empty()) continue;
+        if (all) {
+            classify_line(matcher, field, line, ids);
+            for (const int id : ids) batch.routes.emplace_back(index, id);
+            continue;
+        }
+        const int id = classify_line(matcher, field, line);
+        if (id != Matcher::NO_MATCH) batch.routes.emplace_back(index, id);
+    }
+}
+
+// Reader thread -> workers -> in-order writer. fill(batch) sets the next
+// batch's text and returns false once the input is exhausted. A reload is
+// picked up at the next batch boundary: the reader stamps each batch with
+// the rules it must be classified with and the writer rebinds the sinks
+// when it reaches the first batch stamped with new ones.
+template <typename Fill>
+std::size_t run_stages(UserConfig& config, SinkTable& log_files, std::size_t threads, bool quiet,
+                       const ConfigReloader* reloader, Fill fill) {
+    const std::size_t pool_size = threads * BATCHES_PER_WORKER + 2;
+    std::vector<Batch> pool(pool_size);
+    BoundedQueue<Batch*> free_batches(pool_size);
+    BoundedQueue<Batch*> to_workers(pool_size + threads);
+    BoundedQueue<Batch*> to_writer(pool_size);
+    for (auto& batch : pool) free_batches.push(&batch);
+
+    std::atomic<std::uint64_t> total{std::numeric_limits<std::uint64_t>::max()};
+    const Matcher matcher = config.get_matcher();
+    const LevelField field = config.get_level_field();
+    const Multiline multiline = config.get_multiline();
+
+    std::thread reader_thread([&]() {
+        std::uint64_t seq = 0;
+        std::uint64_t generation = 0;
+        std::shared_ptr<UserConfig> current;
+        for (;;) {
+            Batch* batch = nullptr;
+            free_batches.pop(batch);
+            if (!fill(*batch)) {
+                batch->config.reset();
+                free_batches.push(batch);
+                break;
+            }
+            if (reloader != nullptr && reloader->generation() != generation) {
+                generation = reloader->generation();
+                current = reloader->current();
+            }
+            batch->config = current;
+            batch->seq = seq++;
+            to_workers.push(batch);
+        }
+        total.store(seq, std::memory_order_release);
+        for (std::size_t i = 0; i < threads; ++i) to_workers.push(nullptr);
+    });
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&]() {
+            Batch* batch = nullptr;
+            for (;;) {
+                to_workers.pop(batch);
+                if (batch == nullptr) return;
+                if (batch->config) {
+                    classify(batch->config->get_matcher(), batch->config->get_level_field(), batch->config->get_multiline(), *batch);
+                } else {
+                    classify(matcher, field, multiline, *batch);
+                }
+                to_writer.push(batch);
+            }
+        });
+    }
+
+    // Batches can finish out of order, park them until their turn comes
+    std::vector<Batch*> parked(pool_size, nullptr);
+    std::uint64_t next = 0;
+    std::size_t line_count = 0;
+    unsigned spins = 0;
+    const UserConfig* bound = &config;
+    while (next < total.load(std::memory_order_acquire)) {
+        Batch* batch = nullptr;
+        if (!to_writer.try_pop(batch)) {
+            // Starved for input: push out whatever is buffered
+            if (spins == IDLE_SPINS) log_files.flush();
+            BoundedQueue<Batch*>::backoff(spins++);
+            continue;
+        }
+        spins = 0;
+        parked[batch->seq % pool_size] = batch;
+
+        while (Batch* ready = parked[next % pool_size]) {
+            if (ready->seq != next) break;
+            parked[next % pool_size] = nullptr;
+            if (ready->config && ready->config.get() != bound) {
+                bound = ready->config.get();
+                log_files.rebind(ready->config);
+            }
+            // With throttle_stdout, lines every level dropped aren't echoed either
+            const bool echo = !quiet && !ready->teed;
+            const bool echo_each = echo && bound->get_throttle_stdout();
+            if (echo && !echo_each) {
+                log_files.out().write(ready->text);
+                if (ready->text.back() != '\n') log_files.out().write("\n");
+            }
+            const Multiline& grouping = bound->get_multiline();
+            const bool grouped = !ready->continues.empty();
+            // Lines of a batch were read together, one arrival time does for all of them
+            const auto now = grouped && grouping.timeout > 0 ? std::chrono::steady_clock::now()
+                                                              : std::chrono::steady_clock::time_point{};
+            EventGrouper& event = log_files.event();
+            std::size_t r = 0;
+            for (std::size_t i = 0; i < ready->lines.size(); ++i) {
+                bool routed = false;
+                bool kept = false;
+                if (grouped && ready->continues[i]) {
+                    route_grouped(bound->get_matcher(), bound->get_level_field(), grouping, true, now, ready->lines[i], log_files, routed, kept);
+                } else {
+                    if (grouped) event.start(now);
+                    for (; r < ready->routes.size() && ready->routes[r].first == i; ++r) {
+                        routed = true;
+                        const bool admitted = route_line(ready->routes[r].second, ready->lines[i], log_files);
+                        if (grouped) event.route(ready->routes[r].second, admitted);
+                        kept |= admitted;
+                    }
+                }
+                if (echo_each && (kept || !routed)) log_files.out().write_line(ready->lines[i]);
+            }
+            log_files.poll();
+            line_count += ready->lines.size();
+            if (Stats::enabled()) stats().lines_in += ready->lines.size();
+            free_batches.push(ready);
+            ++next;
+        }
+    }
+
+    reader_thread.join();
+    for (auto& worker : workers) worker.join();
+    return line_count;
+}
+
+} // namespace
+
+std::size_t run_pipeline(
+    UserConfig& config,
+    LineReader& reader,
+    SinkTable& log_files,
+    std::size_t threads,
+    bool quiet,
+    const ConfigReloader* reloader) {
+
+    std::uint64_t generation = 0;
+    return run_stages(config, log_files, threads, quiet, reloader, [&reader, reloader, &generation](Batch& batch) {
+        // Lines of a throttled stdout are echoed one by one, stop teeing them
+        if (reloader != nullptr && reloader->generation() != generation) {
+            generation = reloader->generation();
+            if (reloader->current()->get_throttle_stdout()) reader.disable_tee();
+        }
+        std::string_view block;
+        if (!reader.next_block(block)) return false;
+        batch.teed = reader.teed();
+        batch.data.assign(block.data(), block.size());
+        batch.text = batch.data;
+        return true;
+    });
+}
+
+std::size_t run_mapped(
+    UserConfig& config,
+    const MappedFile& file,
+    SinkTable& log_files,
+    std::size_t threads,
+    bool quiet) {
+
+    const std::string_view text = file.view();
+    if (threads <= 1) {
+        // Same per-line path as stdin, minus the read buffer
+        std::size_t line_count = 0;
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (p < end) {
+            const char* nl = find_newline(p, end);
+            process_line(config, std::string_view(p, static_cast<std::size_t>(nl - p)), log_files, quiet);
+            ++line_count;
+            p = nl + 1;
+        }
+        if (Stats::enabled()) stats().bytes_in += text.size();
+        return line_count;
+    }
+
+    std::size_t pos = 0;
+    return run_stages(config, log_files, threads, quiet, nullptr, [&text, &pos](Batch& batch) {
+        if (pos >= text.size()) return false;
+        // Cut at the first newline past the chunk size so no line is split
+        std::size_t cut = text.size();
+        if (text.size() - pos > MAPPED_CHUNK_SIZE) {
+            const char* nl = find_newline(text.data() + pos + MAPPED_CHUNK_SIZE, text.data() + text.size());
+            cut = std::min(text.size(), static_cast<std::size_t>(nl - text.data()) + 1);
+        }
+        batch.teed = false;
+        batch.text = text.substr(pos, cut - pos);
+        if (Stats::enabled()) stats().bytes_in += batch.text.size();
+        pos = cut;
+        return true;
+    });
+}
+
+} // namespace timbre
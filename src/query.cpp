@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include "timbre/compress.h"
+#include "timbre/index.h"
+#include "timbre/log.h"
+#include "timbre/matcher.h"
+#include "timbre/query.h"
+#include "timbre/reader.h"
+#include "timbre/rotate.h"
+#include "timbre/trigram.h"
+
+namespace timbre {
+
+namespace {
+
+constexpr std::size_t MIN_CHUNK_SIZE = 256 * 1024;
+constexpr std::size_t MAX_CHUNK_SIZE = 8 << 20;
+constexpr std::size_t CHUNKS_PER_THREAD = 8;
+constexpr std::size_t AHEAD_PER_THREAD = 4;  // chunks scanned ahead of the one being written
+constexpr std::size_t STAMP_LOOKAHEAD = 64;  // lines searched for a stamped line to start a chunk at
+constexpr std::size_t STAMP_LOOKBACK = 1024;  // lines searched back for a stamped line
+
+struct Bounds {
+    std::int64_t since = IndexEntry::NO_TIME;
+    std::int64_t until = IndexEntry::NO_TIME;
+
+    bool timed() const { return since != IndexEntry::NO_TIME || until != IndexEntry::NO_TIME; }
+    bool contains(std::int64_t time_ms) const {
+        if (time_ms == IndexEntry::NO_TIME) return false;
+        return (since == IndexEntry::NO_TIME || time_ms >= since) && (until == IndexEntry::NO_TIME || time_ms <= until);
+    }
+};
+
+struct Chunk {
+    std::size_t begin;
+    std::size_t end;
+    std::string out;
+    std::uint64_t matched = 0;
+    bool done = false;
+};
+
+std::string escape_literal(const std::string& text) {
+    std::string escaped;
+    for (const char c : text) {
+        if (std::string_view("\\.[](){}*+?|^$").find(c) != std::string_view::npos) escaped.push_back('\\');
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+std::size_t next_line(std::string_view text, std::size_t pos) {
+    const char* end = text.data() + text.size();
+    const char* nl = find_newline(text.data() + pos, end);
+    return nl == end ? text.size() : static_cast<std::size_t>(nl + 1 - text.data());
+}
+
+// Line start at or after pos; with a time range, preferably a stamped one
+// so the lines continuing an event stay in the chunk of its stamp
+std::size_t chunk_start(std::string_view text, std::size_t pos, std::size_t limit, bool timed) {
+    if (pos > 0 && text[pos - 1] != '\n') pos = next_line(text, pos);
+    if (!timed) return std::min(pos, limit);
+    std::size_t at = pos;
+    for (std::size_t n = 0; at < limit && n < STAMP_LOOKAHEAD; ++n) {
+        const std::size_t end = next_line(text, at);
+        std::int64_t time_ms = 0;
+        if (parse_timestamp(text.substr(at, end - at), time_ms)) return at;
+        at = end;
+    }
+    return std::min(pos, limit);
+}
+
+void scan_chunk(const Matcher& matcher, std::string_view text, const Bounds& bounds, const std::string& prefix,
+                Chunk& chunk) {
+    const char* p = text.data() + chunk.begin;
+    const char* const end = text.data() + chunk.end;
+    std::int64_t current = IndexEntry::NO_TIME;
+    while (p < end) {
+        const char* nl = find_newline(p, end);
+        const std::string_view line(p, static_cast<std::size_t>(nl - p));
+        p = nl + 1;
+        if (bounds.timed()) {
+            std::int64_t time_ms = 0;
+            if (parse_timestamp(line, time_ms)) current = time_ms;
+            if (!bounds.contains(current)) continue;
+        }
+        if (matcher.match(line) == Matcher::NO_MATCH) continue;
+        chunk.out.append(prefix);
+        chunk.out.append(line);
+        chunk.out.push_back('\n');
+        ++chunk.matched;
+    }
+}
+
+// Start of the nearest stamped line at or before pos, or pos if there is none close by
+std::size_t stamped_start(std::string_view text, std::size_t pos) {
+    for (std::size_t at = pos, n = 0; n < STAMP_LOOKBACK; ++n) {
+        const std::size_t end = next_line(text, at);
+        std::int64_t time_ms = 0;
+        if (parse_timestamp(text.substr(at, end - at), time_ms)) return at;
+        if (at == 0) break;
+        const std::size_t nl = at > 1 ? text.rfind('\n', at - 2) : std::string_view::npos;
+        at = nl == std::string_view::npos ? 0 : nl + 1;
+    }
+    return pos;
+}
+
+// The parts of [begin, end) to scan: the blocks between index entries that
+// the trigram index, if there is one, can't rule out
+void candidate_ranges(std::string_view text, const LogIndex& index, const TrigramIndex* trigrams,
+                      const std::vector<std::string>& literals, bool timed, std::size_t begin, std::size_t end,
+                      std::vector<std::pair<std::size_t, std::size_t>>& ranges) {
+    const auto& entries = index.entries();
+    std::vector<bool> candidates(entries.size(), true);
+    if (trigrams != nullptr) trigrams->filter(literals, candidates);
+    for (std::size_t k = 0; k < entries.size(); ++k) {
+        if (!candidates[k]) continue;
+        std::size_t from = std::max(begin, static_cast<std::size_t>(entries[k].offset));
+        const std::size_t to = std::min(end, k + 1 < entries.size()
+            ? static_cast<std::size_t>(entries[k + 1].offset)
+            : text.size());
+        if (from >= to) continue;
+        // Continuation lines need the stamp they follow to be placed in the time range
+        if (timed && from > begin && entries[k].time_ms == IndexEntry::NO_TIME) {
+            from = std::max(begin, stamped_start(text, from));
+        }
+        if (!ranges.empty() && from <= ranges.back().second) {
+            ranges.back().second = to;
+        } else {
+            ranges.emplace_back(from, to);
+        }
+    }
+}
+
+// Resolve the time range against one file, false if a bound can't be read
+bool resolve_bounds(const Query& query, std::int64_t latest, Bounds& bounds) {
+    if (!query.since.empty() && !parse_time_arg(query.since, latest, bounds.since)) return false;
+    if (query.until.empty()) return true;
+    // A bare time of day for until is the first one after since
+    const std::int64_t until_latest = bounds.since != IndexEntry::NO_TIME
+        ? bounds.since + 24 * 60 * 60 * 1000 - 1
+        : latest;
+    return parse_time_arg(query.until, until_latest, bounds.until);
+}
+
+// Scan one file, returning false on errors
+bool query_file(const Query& query, const Matcher& matcher, const std::vector<std::string>& literals,
+                const std::string& path, const std::string& prefix, std::size_t threads, std::uint64_t& matched) {
+    MappedFile file;
+    if (!file.open(path)) {
+        log(LogLevel::ERROR, "Failed to open " + path);
+        return false;
+    }
+    std::string_view text = file.view();
+    // Compressed segments keep indexes of their text, which is searched decompressed
+    std::string inflated;
+    if (const Codec codec = detect_codec(text); codec != Codec::NONE) {
+        if (!codec_available(codec)) {
+            log(LogLevel::WARNING, "Skipping " + path + ", this build has no " + codec_name(codec) + " support");
+            return true;
+        }
+        if (!decompress_all(text, inflated)) {
+            log(LogLevel::WARNING, "Failed to decompress all of " + path + ", querying what could be");
+        }
+        text = inflated;
+    }
+
+    LogIndex index;
+    const bool indexed = index.load(path + ".idx", text.size());
+    Bounds bounds;
+    const bool timed = !query.since.empty() || !query.until.empty();
+    if (timed && !resolve_bounds(query, latest_time(text, indexed ? &index : nullptr), bounds)) {
+        log(LogLevel::ERROR, "Cannot use the time range for " + path + ", expected YYYY-MM-DD HH:MM[:SS], "
+            "or HH:MM[:SS] in a file with timestamps");
+        return false;
+    }
+
+    // Skip what the index places entirely outside the range
+    std::size_t begin = 0;
+    std::size_t end = text.size();
+    if (indexed && bounds.since != IndexEntry::NO_TIME) {
+        if (const IndexEntry* entry = index.find_time(bounds.since)) begin = static_cast<std::size_t>(entry->offset);
+    }
+    if (indexed && bounds.until != IndexEntry::NO_TIME) {
+        if (const IndexEntry* entry = index.find_time_after(bounds.until)) end = static_cast<std::size_t>(entry->offset);
+    }
+    if (begin >= end) return true;
+
+    // Then skip the blocks the trigram index rules out
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;
+    TrigramIndex trigrams;
+    const bool filtered = indexed && !literals.empty() && trigrams.load(path + ".tri");
+    if (indexed) {
+        candidate_ranges(text, index, filtered ? &trigrams : nullptr, literals, timed, begin, end, ranges);
+    } else {
+        ranges.emplace_back(begin, end);
+    }
+    std::size_t total = 0;
+    for (const auto& range : ranges) total += range.second - range.first;
+    log(LogLevel::DEBUG, "Querying " + path + " bytes " + std::to_string(begin) + "-" + std::to_string(end)
+        + (indexed ? "" : " (no index)") + (filtered ? ", " + std::to_string(total) + " of them after trigrams" : ""));
+
+    const std::size_t chunk_size = std::clamp(total / (threads * CHUNKS_PER_THREAD), MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    std::vector<Chunk> chunks;
+    for (const auto& range : ranges) {
+        for (std::size_t pos = range.first; pos < range.second;) {
+            const std::size_t cut = chunk_start(text, std::min(range.second, pos + chunk_size), range.second, timed);
+            chunks.push_back(Chunk{pos, cut, {}, 0, false});
+            pos = cut;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::size_t next = 0;
+    std::size_t written = 0;
+    const std::size_t ahead = threads * AHEAD_PER_THREAD;
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < std::min(threads, chunks.size()); ++t) {
+        workers.emplace_back([&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                // Don't run further ahead of the output than a few chunks per thread
+                ready.wait(lock, [&]() { return next >= chunks.size() || next < written + ahead; });
+                if (next >= chunks.size()) return;
+                Chunk& chunk = chunks[next++];
+                lock.unlock();
+                scan_chunk(matcher, text, bounds, prefix, chunk);
+                lock.lock();
+                chunk.done = true;
+                ready.notify_all();
+            }
+        });
+    }
+
+    bool ok = true;
+    for (auto& chunk : chunks) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&chunk]() { return chunk.done; });
+            out.swap(chunk.out);
+        }
+        ok = ok && std::fwrite(out.data(), 1, out.size(), stdout) == out.size();
+        matched += chunk.matched;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++written;
+        }
+        ready.notify_all();
+    }
+    for (auto& worker : workers) worker.join();
+    if (!ok) log(LogLevel::ERROR, "Failed to write query results");
+    return ok;
+}
+
+} // namespace
+
+bool query_files(const UserConfig& config, const std::vector<std::string>& levels, std::vector<std::string>& files) {
+    const auto& all = config.get_log_levels();
+    std::vector<const UserLevel*> picked;
+    if (levels.empty()) {
+        // NOLINTBEGIN: unassignedVariable
+        for (const auto& [name, level] : all) picked.push_back(&level); // NOLINT
+        // NOLINTEND
+    }
+    for (const auto& name : levels) {
+        const auto it = all.find(name);
+        if (it == all.end()) {
+            log(LogLevel::ERROR, "Unknown level: " + name);
+            return false;
+        }
+        picked.push_back(&it->second);
+    }
+    for (const UserLevel* level : picked) {
+        const std::string path = config.get_log_dir() + "/" + level->path;
+        if (std::find(files.begin(), files.end(), path) != files.end()) continue;
+        // Rotated segments first, oldest to newest, then the live file: the lines in the order written
+        const std::vector<std::string> segments = rotated_segments(path);
+        files.insert(files.end(), segments.begin(), segments.end());
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(path, ec)) {
+            files.push_back(path);
+        } else if (segments.empty()) {
+            log(LogLevel::INFO, "No log file " + path + " yet, skipping it");
+        }
+    }
+    return true;
+}
+
+int run_query(const Query& query, const std::vector<std::string>& files) {
+    std::map<std::string, UserLevel> levels;
+    UserLevel& level = levels["query"];
+    level.expr = query.fixed ? escape_literal(query.pattern) : query.pattern;
+    level.pattern = _re_compile(level.expr);
+    level.valid = (level.pattern.flags() & std::regex_constants::extended) != 0;
+    if (!level.valid) return 2;
+    const Matcher matcher(levels);
+    const std::vector<std::string> literals = required_literals(level.expr);
+
+    const std::size_t threads = query.threads > 0
+        ? query.threads
+        : std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    std::uint64_t matched = 0;
+    bool ok = true;
+    for (const auto& path : files) {
+        const std::string prefix = files.size() > 1 ? path + ":" : "";
+        ok = query_file(query, matcher, literals, path, prefix, threads, matched) && ok;
+    }
+    std::fflush(stdout);
+    log(LogLevel::INFO, "Query matched " + std::to_string(matched) + " lines in " + std::to_string(files.size())
+        + " files");
+    if (!ok) return 2;
+    return matched > 0 ? 0 : 1;
+}
+
+} // namespace timbre
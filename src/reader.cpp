@@ -0,0 +1,509 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // tee(2)
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "timbre/log.h"
+#include "timbre/reader.h"
+#include "timbre/stats.h"
+
+#ifdef _WIN32
+#include <io.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#define NOMINMAX
+#define NOGDI  // NOTE: wingdi.h defines ERROR, which clashes with LogLevel::ERROR
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace timbre {
+
+const char* find_newline(const char* begin, const char* end) {
+    const char* p = begin;
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, nl));
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    for (; end - p >= 16; p += 16) {
+        const uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), nl);
+        if (vmaxvq_u8(eq) != 0) {
+            break;  // NOTE: let memchr pin down the exact byte within this block
+        }
+    }
+#endif
+    const void* hit = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+    return hit ? static_cast<const char*>(hit) : end;
+}
+
+const char* find_last_newline(const char* begin, const char* end) {
+    for (const char* p = end; p != begin; --p) {
+        if (p[-1] == '\n') return p - 1;
+    }
+    return nullptr;
+}
+
+static long read_block(int fd, char* buf, std::size_t len) {
+    for (;;) {
+#ifdef _WIN32
+        const long n = _read(fd, buf, static_cast<unsigned int>(len));
+#else
+        const long n = ::read(fd, buf, len);
+#endif
+        if (n < 0 && errno == EINTR) continue;
+        return n;
+    }
+}
+
+static bool input_ready(int fd) {
+#ifdef _WIN32
+    (void)fd;
+    return false;
+#else
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+// How often a pipe is peeked at again while it holds part of a magic number
+static constexpr std::chrono::milliseconds PEEK_RETRY{1};
+
+// Whether the writing end of pipe fd is closed, as far as poll(2) can tell
+static bool pipe_closed(int fd) {
+#ifdef _WIN32
+    (void)fd;
+    return true;
+#else
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLHUP) != 0;
+#endif
+}
+
+// Copies up to len bytes of the input into buf without consuming them, by
+// teeing them into a scratch pipe. -1 if fd is not a pipe or tee(2) fails.
+static long peek_pipe(int fd, char* buf, std::size_t len) {
+#ifdef __linux__
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode)) return -1;
+    int scratch[2];
+    if (::pipe2(scratch, O_CLOEXEC) != 0) return -1;
+    ssize_t n;
+    do {
+        n = ::tee(fd, scratch[1], len, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) n = ::read(scratch[0], buf, static_cast<std::size_t>(n));
+    ::close(scratch[0]);
+    ::close(scratch[1]);
+    return n;
+#else
+    (void)fd;
+    (void)buf;
+    (void)len;
+    return -1;
+#endif
+}
+
+// Decompression thread: reads compressed input and queues decompressed
+// chunks for fill(), at most INFLATED_AHEAD of them
+struct LineReader::Inflating {
+    static constexpr std::size_t RAW_BLOCK_SIZE = 64 * 1024;
+
+    int fd;
+    Decompressor decompressor;
+    std::string prefix;  // compressed bytes read while detecting the codec
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable room;
+    std::deque<std::string> chunks;
+    std::vector<std::string> spare;
+    bool done = false;
+    bool stop = false;
+    std::string current;  // the chunk fill() is copying from
+    std::size_t pos = 0;
+    std::thread thread;
+
+    void run();
+    bool available();
+    long take(char* buf, std::size_t len);
+};
+
+void LineReader::Inflating::run() {
+    std::vector<char> raw(RAW_BLOCK_SIZE);
+    std::string_view input = prefix;
+    bool ok = true;
+    for (;;) {
+        if (input.empty()) {
+            const long n = read_block(fd, raw.data(), raw.size());
+            if (n < 0) log(LogLevel::ERROR, std::string("Failed to read input: ") + std::strerror(errno));
+            if (n <= 0) break;
+            input = std::string_view(raw.data(), static_cast<std::size_t>(n));
+        }
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!spare.empty()) {
+                out = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        out.clear();
+        if (!decompressor.update(input, out)) {
+            log(LogLevel::ERROR, std::string("Failed to decompress ") + codec_name(decompressor.codec())
+                + " input, it is corrupt or not what its header says");
+            ok = false;
+            break;
+        }
+        input = {};
+        if (out.empty()) continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this]() { return stop || chunks.size() < INFLATED_AHEAD; });
+        if (stop) break;
+        chunks.push_back(std::move(out));
+        lock.unlock();
+        ready.notify_one();
+    }
+    if (ok && decompressor.truncated()) {
+        log(LogLevel::WARNING, std::string("Compressed input ends in the middle of a ")
+            + codec_name(decompressor.codec()) + " frame, it was truncated");
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    ready.notify_one();
+}
+
+bool LineReader::Inflating::available() {
+    if (pos < current.size()) return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    return !chunks.empty() || done;
+}
+
+long LineReader::Inflating::take(char* buf, std::size_t len) {
+    if (pos == current.size()) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return !chunks.empty() || done; });
+        if (chunks.empty()) return 0;
+        spare.push_back(std::move(current));
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        pos = 0;
+        lock.unlock();
+        room.notify_one();
+    }
+    const std::size_t n = std::min(len, current.size() - pos);
+    std::memcpy(buf, current.data() + pos, n);
+    pos += n;
+    return static_cast<long>(n);
+}
+
+LineReader::LineReader(int fd, std::size_t block_size)
+    : _fd(fd), _tee_fd(-1), _teed(false), _untee(false), _teed_end(0), _last_teed(false), _buffer(block_size),
+      _begin(0), _end(0), _eof(false) {}
+
+LineReader::~LineReader() {
+    if (!_inflating) return;
+    {
+        std::lock_guard<std::mutex> lock(_inflating->mutex);
+        _inflating->stop = true;
+    }
+    _inflating->room.notify_one();
+    _inflating->thread.join();
+}
+
+Codec LineReader::detect_compression() {
+    char head[4];
+    // Pipes are peeked at so the bytes can still be teed; anything else is
+    // read into the buffer, where it is used as input either way
+    long peeked = peek_pipe(_fd, head, sizeof(head));
+    // A writer can put the first byte of a magic number in the pipe on its own,
+    // wait for the rest or for the writer to close. The close is checked before
+    // peeking again, so bytes written just ahead of it are still seen.
+    while (peeked > 0 && magic_incomplete(std::string_view(head, static_cast<std::size_t>(peeked)))) {
+        const bool closed = pipe_closed(_fd);
+        if (!closed) std::this_thread::sleep_for(PEEK_RETRY);
+        peeked = peek_pipe(_fd, head, sizeof(head));
+        if (closed) break;
+    }
+    std::string_view magic(head, peeked > 0 ? static_cast<std::size_t>(peeked) : 0);
+    if (peeked < 0) {
+        // Terminals and sockets return short reads too, keep reading until the codec is known
+        long n = 0;
+        do {
+            n = read_block(_fd, _buffer.data() + _end, _buffer.size() - _end);
+            if (n > 0) _end += static_cast<std::size_t>(n);
+        } while (n > 0 && magic_incomplete(std::string_view(_buffer.data(), _end)));
+        // NOTE: a failure after some input is reported by the next fill()
+        if (_end == 0) {
+            if (n < 0) log(LogLevel::ERROR, std::string("Failed to read input: ") + std::strerror(errno));
+            _eof = true;
+            return Codec::NONE;
+        }
+        magic = std::string_view(_buffer.data(), _end);
+    }
+
+    const Codec codec = detect_codec(magic);
+    if (codec != Codec::NONE && !codec_available(codec)) {
+        log(LogLevel::WARNING, std::string("Input looks ") + codec_name(codec)
+            + " compressed, but this build has no support for it; reading it as is");
+    }
+    if (codec == Codec::NONE || !codec_available(codec)) {
+        if (Stats::enabled()) stats().bytes_in += _end;
+        return Codec::NONE;
+    }
+
+    _inflating = std::make_unique<Inflating>();
+    _inflating->fd = _fd;
+    _inflating->prefix.assign(_buffer.data(), _end);
+    _begin = _end = 0;
+    if (!_inflating->decompressor.init(codec)) {
+        log(LogLevel::ERROR, std::string("Failed to set up ") + codec_name(codec) + " decompression");
+        _inflating.reset();
+        _eof = true;
+        return Codec::NONE;
+    }
+    _inflating->thread = std::thread([this]() { _inflating->run(); });
+    log(LogLevel::INFO, std::string("Decompressing ") + codec_name(codec) + " input");
+    return codec;
+}
+
+bool LineReader::enable_tee(int out_fd) {
+#ifdef __linux__
+    // Whatever is already buffered was never teed, and decompressed text can't be
+    if (_end > _begin || _inflating) return false;
+    struct stat in_st;
+    struct stat out_st;
+    if (::fstat(_fd, &in_st) != 0 || ::fstat(out_fd, &out_st) != 0) return false;
+    if (!S_ISFIFO(in_st.st_mode) || !S_ISFIFO(out_st.st_mode)) return false;
+    if (in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) return false;
+    _tee_fd = out_fd;
+    return true;
+#else
+    (void)out_fd;
+    return false;
+#endif
+}
+
+long LineReader::tee_block(char* buf, std::size_t len) {
+#ifdef __linux__
+    for (;;) {
+        const ssize_t n = ::tee(_fd, _tee_fd, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EINVAL && !_teed) {
+            log(LogLevel::INFO, "tee(2) not supported on these pipes, copying output in userspace");
+            _tee_fd = -1;
+            return read_block(_fd, buf, len);
+        }
+        if (n <= 0) return n;
+        _teed = true;
+
+        // Consume exactly the bytes that were duplicated
+        std::size_t got = 0;
+        while (got < static_cast<std::size_t>(n)) {
+            const long r = read_block(_fd, buf + got, static_cast<std::size_t>(n) - got);
+            if (r <= 0) return r < 0 ? r : static_cast<long>(got);
+            got += static_cast<std::size_t>(r);
+        }
+        return static_cast<long>(got);
+    }
+#else
+    return read_block(_fd, buf, len);
+#endif
+}
+
+bool LineReader::fill() {
+    if (_eof) return false;
+
+    // Move the partial line to the front so the next block lands right after it
+    if (_begin > 0) {
+        std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+        _end -= _begin;
+        _teed_end = _teed_end > _begin ? _teed_end - _begin : 0;
+        _begin = 0;
+    }
+    // Only between lines, a line is either teed whole or echoed whole
+    if (_untee && _tee_fd >= 0 && _end == 0) {
+        log(LogLevel::INFO, "No longer teeing stdin to stdout");
+        _tee_fd = -1;
+    }
+    // A single line fills the whole buffer, make room for more of it
+    if (_end == _buffer.size()) {
+        _buffer.resize(_buffer.size() * 2);
+    }
+
+    if (_on_idle && !(_inflating ? _inflating->available() : input_ready(_fd))) _on_idle();
+
+    const long n = _inflating ? _inflating->take(_buffer.data() + _end, _buffer.size() - _end)
+        : _tee_fd >= 0 ? tee_block(_buffer.data() + _end, _buffer.size() - _end)
+        : read_block(_fd, _buffer.data() + _end, _buffer.size() - _end);
+    if (n < 0) {
+        log(LogLevel::ERROR, std::string("Failed to read input: ") + std::strerror(errno));
+        _eof = true;
+        return false;
+    }
+    if (n == 0) {
+        _eof = true;
+        return false;
+    }
+    _end += static_cast<std::size_t>(n);
+    if (_tee_fd >= 0) _teed_end = _end;
+    if (Stats::enabled()) stats().bytes_in += static_cast<std::uint64_t>(n);
+    return true;
+}
+
+bool LineReader::next(std::string_view& line) {
+    std::size_t scanned = _begin;
+    for (;;) {
+        const char* base = _buffer.data();
+        const char* nl = find_newline(base + scanned, base + _end);
+        if (nl != base + _end) {
+            const std::size_t pos = static_cast<std::size_t>(nl - base);
+            line = std::string_view(base + _begin, pos - _begin);
+            _begin = pos + 1;
+            _last_teed = _begin <= _teed_end;
+            return true;
+        }
+        // Don't rescan what we already know holds no newline
+        scanned = _end - _begin;
+        if (!fill()) break;
+        scanned += _begin;
+    }
+
+    // Trailing line without a newline, same as std::getline
+    if (_end > _begin) {
+        line = std::string_view(_buffer.data() + _begin, _end - _begin);
+        _begin = _end;
+        _last_teed = _end <= _teed_end;
+        return true;
+    }
+    return false;
+}
+
+bool LineReader::next_block(std::string_view& block) {
+    std::size_t scanned = _begin;
+    for (;;) {
+        const char* base = _buffer.data();
+        const char* last = find_last_newline(base + scanned, base + _end);
+        if (last != nullptr) {
+            const std::size_t pos = static_cast<std::size_t>(last - base);
+            block = std::string_view(base + _begin, pos + 1 - _begin);
+            _begin = pos + 1;
+            _last_teed = _begin <= _teed_end;
+            return true;
+        }
+        scanned = _end - _begin;
+        if (!fill()) break;
+        scanned += _begin;
+    }
+
+    if (_end > _begin) {
+        block = std::string_view(_buffer.data() + _begin, _end - _begin);
+        _begin = _end;
+        _last_teed = _end <= _teed_end;
+        return true;
+    }
+    return false;
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile() : _data(nullptr), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(nullptr) {}
+#else
+MappedFile::MappedFile() : _data(nullptr), _size(0) {}
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    _path = path;
+#ifdef _WIN32
+    _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size)) {
+        close();
+        return false;
+    }
+    _size = static_cast<std::size_t>(size.QuadPart);
+    if (_size == 0) return true;
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping == nullptr) {
+        close();
+        return false;
+    }
+    _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr) {
+        close();
+        return false;
+    }
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    _size = static_cast<std::size_t>(st.st_size);
+    if (_size > 0) {
+        void* data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            _size = 0;
+            return false;
+        }
+        // Chunks are consumed front to back, let the kernel read far ahead
+        ::madvise(data, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const char*>(data);
+    }
+    ::close(fd);  // NOTE: the mapping keeps the file referenced
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (_data != nullptr) UnmapViewOfFile(_data);
+    if (_mapping != nullptr) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+#else
+    if (_data != nullptr) ::munmap(const_cast<char*>(_data), _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
+
+} // namespace timbre
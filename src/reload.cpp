@@ -0,0 +1,158 @@
+#include <cerrno>
+#include <csignal>
+#include <filesystem>
+#include <tuple>  // for std::ignore
+#include <utility>
+#include "timbre/cache.h"
+#include "timbre/log.h"
+#include "timbre/reload.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace timbre {
+
+#ifndef _WIN32
+// Write end of the running reloader's self-pipe, for the signal handler
+static volatile sig_atomic_t s_wake_fd = -1;
+
+static void on_sighup(int) {
+    const int saved = errno;
+    const char byte = 'r';
+    if (s_wake_fd >= 0) std::ignore = ::write(s_wake_fd, &byte, 1);
+    errno = saved;
+}
+#endif
+
+ConfigReloader::ConfigReloader(const std::string& path, const std::string& cache_dir,
+                               std::function<void(UserConfig&)> apply)
+    : _path(path), _cache_dir(cache_dir), _apply(std::move(apply)), _generation(0), _wake{-1, -1}, _watch(-1) {}
+
+ConfigReloader::~ConfigReloader() {
+    stop();
+}
+
+bool ConfigReloader::reload() {
+    auto next = std::make_shared<UserConfig>();
+    const ConfigCache cache(_cache_dir);
+    if (!cache.load_or_compile(_path, *next)) {
+        log(LogLevel::ERROR, "Failed to reload configuration from " + _path + ", keeping the current rules");
+        return false;
+    }
+    if (_apply) _apply(*next);
+    std::atomic_store(&_current, std::move(next));
+    _generation.fetch_add(1, std::memory_order_release);
+    log(LogLevel::INFO, "Reloaded configuration from " + _path);
+    return true;
+}
+
+#ifdef _WIN32
+
+bool ConfigReloader::start(bool) {
+    log(LogLevel::WARNING, "Configuration reload is not supported on Windows");
+    return false;
+}
+
+void ConfigReloader::stop() {}
+
+void ConfigReloader::run() {}
+
+#else
+
+bool ConfigReloader::start(bool watch) {
+    if (_thread.joinable() || _path.empty()) return false;
+    if (::pipe(_wake) != 0) {
+        log(LogLevel::ERROR, "Failed to create reload pipe");
+        return false;
+    }
+    for (const int fd : _wake) ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(_wake[1], F_SETFL, O_NONBLOCK);
+
+    if (watch) {
+#ifdef __linux__
+        // Watch the directory, editors and config management replace the file
+        std::filesystem::path dir = std::filesystem::path(_path).parent_path();
+        if (dir.empty()) dir = ".";
+        _watch = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_watch >= 0 && ::inotify_add_watch(_watch, dir.string().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            ::close(_watch);
+            _watch = -1;
+        }
+        if (_watch < 0) log(LogLevel::WARNING, "Cannot watch " + dir.string() + ", reload with SIGHUP instead");
+#else
+        log(LogLevel::WARNING, "Watching the configuration needs inotify, reload with SIGHUP instead");
+#endif
+    }
+
+    s_wake_fd = _wake[1];
+    struct sigaction action = {};
+    action.sa_handler = on_sighup;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGHUP, &action, nullptr);
+
+    _thread = std::thread([this]() { run(); });
+    return true;
+}
+
+void ConfigReloader::stop() {
+    if (!_thread.joinable()) return;
+    signal(SIGHUP, SIG_IGN);
+    s_wake_fd = -1;
+    const char byte = 'q';
+    std::ignore = ::write(_wake[1], &byte, 1);
+    _thread.join();
+    for (int& fd : _wake) {
+        ::close(fd);
+        fd = -1;
+    }
+    if (_watch >= 0) ::close(_watch);
+    _watch = -1;
+}
+
+void ConfigReloader::run() {
+    const std::string name = std::filesystem::path(_path).filename().string();
+    for (;;) {
+        pollfd fds[2] = {{_wake[0], POLLIN, 0}, {_watch, POLLIN, 0}};
+        if (::poll(fds, _watch >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            log(LogLevel::ERROR, "Reload thread: poll failed");
+            return;
+        }
+
+        bool wanted = false;
+        if (fds[0].revents & POLLIN) {
+            char bytes[64];
+            const ssize_t n = ::read(_wake[0], bytes, sizeof(bytes));
+            for (ssize_t i = 0; i < n; ++i) {
+                if (bytes[i] == 'q') return;
+            }
+            wanted = n > 0;
+        }
+#ifdef __linux__
+        if (_watch >= 0 && (fds[1].revents & POLLIN)) {
+            alignas(inotify_event) char events[4096];
+            ssize_t n;
+            // Drain everything queued so a burst of writes is a single reload
+            while ((n = ::read(_watch, events, sizeof(events))) > 0) {
+                for (ssize_t pos = 0; pos < n;) {
+                    const auto* event = reinterpret_cast<const inotify_event*>(events + pos);
+                    if (event->len > 0 && name == event->name) wanted = true;
+                    pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                }
+            }
+        }
+#endif
+        if (wanted) reload();
+    }
+}
+
+#endif
+
+} // namespace timbre
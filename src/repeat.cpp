@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstring>
+#include "timbre/repeat.h"
+#include "timbre/sink.h"
+
+namespace timbre {
+
+std::uint64_t hash_line(std::string_view line) {
+    constexpr std::uint64_t K = 0x9e3779b97f4a7c15ULL;
+    const char* p = line.data();
+    std::size_t n = line.size();
+    std::uint64_t h = static_cast<std::uint64_t>(n) * K;
+    for (; n >= 8; p += 8, n -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * K;
+        h ^= h >> 29;
+    }
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, p, n);
+    h = (h ^ tail) * K;
+    return h ^ (h >> 32);
+}
+
+RepeatCollapser::RepeatCollapser(Sink& sink, std::size_t window)
+    : _sink(&sink), _window(std::clamp<std::size_t>(window, 1, MAX_WINDOW)), _next(0), _last(NONE) {}
+
+void RepeatCollapser::emit(std::size_t slot) {
+    Entry& entry = _window[slot];
+    if (entry.repeats == 0) return;
+    const std::string count = std::to_string(entry.repeats) + (entry.repeats == 1 ? " time" : " times");
+    if (slot == _last) {
+        _sink->write_line("timbre: last message repeated " + count);
+    } else {
+        _sink->write_line("timbre: message repeated " + count + ": " + entry.text);
+    }
+    entry.repeats = 0;
+    // Only the record of the line written last ends its run
+    if (slot == _last) _last = NONE;
+}
+
+void RepeatCollapser::write_line(std::string_view line) {
+    const std::uint64_t hash = hash_line(line);
+    std::size_t match = NONE;
+    for (std::size_t slot = 0; slot < _window.size(); ++slot) {
+        const Entry& entry = _window[slot];
+        if (entry.used && entry.hash == hash && entry.text == line) {
+            match = slot;
+            break;
+        }
+    }
+    // Any other line ends the run of the line written last, its count goes out now
+    if (_last != NONE && match != _last) {
+        emit(_last);
+        _last = NONE;
+    }
+    if (match != NONE) {
+        Entry& entry = _window[match];
+        if (entry.repeats++ == 0) entry.since = std::chrono::steady_clock::now();
+        return;
+    }
+    // The oldest line leaves the window, with the count it has gathered
+    const std::size_t slot = _next;
+    emit(slot);
+    Entry& entry = _window[slot];
+    entry.used = true;
+    entry.hash = hash;
+    entry.text.assign(line.data(), line.size());
+    _next = (_next + 1) % _window.size();
+    _sink->write_line(line);
+    _last = slot;
+}
+
+void RepeatCollapser::write_verbatim(std::string_view line) {
+    if (_last != NONE) emit(_last);
+    _sink->write_line(line);
+    _last = NONE;
+}
+
+void RepeatCollapser::flush_if_due(std::chrono::steady_clock::time_point now) {
+    for (std::size_t slot = 0; slot < _window.size(); ++slot) {
+        if (_window[slot].repeats > 0 && now - _window[slot].since >= REPEAT_INTERVAL) emit(slot);
+    }
+}
+
+void RepeatCollapser::flush() {
+    // The line written last goes first, so its record can still say "last message"
+    if (_last != NONE) emit(_last);
+    for (std::size_t slot = 0; slot < _window.size(); ++slot) emit(slot);
+}
+
+} // namespace timbre
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <filesystem>
+#include <tuple>
+#include <vector>
+#include "timbre/log.h"
+#include "timbre/rotate.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace timbre {
+
+namespace {
+
+constexpr std::size_t STAMP_LENGTH = 15;  // YYYYmmdd-HHMMSS
+
+bool exists(const std::string& path) {
+    std::error_code ec;
+    return std::filesystem::exists(path, ec);
+}
+
+bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Splits "YYYYmmdd-HHMMSS[-N]" into its parts, false for anything else
+bool parse_stamp(const std::string& text, std::string& stamp, unsigned long& n) {
+    if (text.size() < STAMP_LENGTH || text[8] != '-') return false;
+    for (std::size_t i = 0; i < STAMP_LENGTH; ++i) {
+        if (i != 8 && !std::isdigit(static_cast<unsigned char>(text[i]))) return false;
+    }
+    stamp = text.substr(0, STAMP_LENGTH);
+    n = 0;
+    if (text.size() == STAMP_LENGTH) return true;
+    if (text[STAMP_LENGTH] != '-' || text.size() == STAMP_LENGTH + 1) return false;
+    for (std::size_t i = STAMP_LENGTH + 1; i < text.size(); ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(text[i]))) return false;
+        n = n * 10 + static_cast<unsigned long>(text[i] - '0');
+    }
+    return true;
+}
+
+// Compressed files keep their extension last: info.log.zst -> info.log.<stamp>.zst
+std::string strip_codec_extension(const std::string& name, std::string& extension) {
+    for (const char* ext : {".gz", ".zst"}) {
+        if (ends_with(name, ext)) {
+            extension = ext;
+            return name.substr(0, name.size() - extension.size());
+        }
+    }
+    extension.clear();
+    return name;
+}
+
+} // namespace
+
+std::string rotated_name(const std::string& base) {
+    const std::time_t now = std::time(nullptr);
+    std::tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    char stamp[STAMP_LENGTH + 1];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    std::string extension;
+    const std::string name = strip_codec_extension(base, extension) + "." + stamp;
+    std::string candidate = name;
+    // Several rotations within a second, or a clock that went backwards
+    for (unsigned n = 1; exists(candidate) || exists(candidate + ".gz") || exists(candidate + ".zst"); ++n) {
+        candidate = name + "-" + std::to_string(n);
+    }
+    return candidate + extension;
+}
+
+std::vector<std::string> rotated_segments(const std::string& base) {
+    const std::filesystem::path base_path(base);
+    const std::filesystem::path dir = base_path.has_parent_path() ? base_path.parent_path() : ".";
+    std::string extension;
+    const std::string prefix = strip_codec_extension(base_path.filename().string(), extension) + ".";
+
+    std::vector<std::tuple<std::string, unsigned long, std::string>> segments;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) != 0 || ends_with(name, ".tmp")) continue;
+        const std::string rest = strip_codec_extension(name.substr(prefix.size()), extension);
+        std::string stamp;
+        unsigned long n = 0;
+        if (parse_stamp(rest, stamp, n)) segments.emplace_back(stamp, n, it->path().string());
+    }
+    std::sort(segments.begin(), segments.end());
+
+    std::vector<std::string> paths;
+    paths.reserve(segments.size());
+    for (auto& segment : segments) paths.push_back(std::move(std::get<2>(segment)));
+    return paths;
+}
+
+Archiver::Archiver() : _stop(false) {}
+
+Archiver::~Archiver() {
+    stop();
+}
+
+void Archiver::submit(const std::string& segment, const std::string& base, const Rotation& policy) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(Job{segment, base, policy});
+        if (!_thread.joinable()) {
+            _stop = false;
+            _thread = std::thread([this]() { run(); });
+        }
+    }
+    _wake.notify_one();
+}
+
+void Archiver::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_thread.joinable()) return;
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+void Archiver::run() {
+#ifdef __linux__
+    // Per thread on Linux: keep compression behind the classification threads
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 10);
+#endif
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+        if (_jobs.empty()) return;  // stopping, and nothing left to do
+        const Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+        archive(job);
+        lock.lock();
+    }
+}
+
+void Archiver::archive(const Job& job) {
+    const Codec codec = job.policy.compress;
+    if (codec != Codec::NONE) {
+        const std::string target = job.segment + codec_extension(codec);
+        if (compress_file(job.segment, target, codec)) {
+            std::error_code ec;
+            std::filesystem::remove(job.segment, ec);
+            // Its indexes still describe the text, which query reads back decompressed
+            for (const char* sidecar : {".idx", ".tri"}) {
+                if (!exists(job.segment + sidecar)) continue;
+                std::filesystem::rename(job.segment + sidecar, target + sidecar, ec);
+                if (ec) log(LogLevel::WARNING, "Failed to move " + job.segment + sidecar + " along with its log: " + ec.message());
+            }
+            log(LogLevel::INFO, "Compressed rotated log " + target);
+        } else {
+            log(LogLevel::WARNING, "Failed to compress " + job.segment + ", keeping it uncompressed");
+        }
+    }
+    if (job.policy.keep > 0) prune(job.base, job.policy.keep);
+}
+
+void Archiver::prune(const std::string& base, std::uint32_t keep) {
+    const std::vector<std::string> segments = rotated_segments(base);
+    if (segments.size() <= keep) return;
+    std::error_code ec;
+    for (std::size_t i = 0; i < segments.size() - keep; ++i) {
+        std::filesystem::remove(segments[i], ec);
+        std::filesystem::remove(segments[i] + ".idx", ec);
+        std::filesystem::remove(segments[i] + ".tri", ec);
+        log(LogLevel::INFO, "Removed rotated log " + segments[i]);
+    }
+}
+
+} // namespace timbre
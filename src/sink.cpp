@@ -0,0 +1,812 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <new>
+#include <thread>
+#include <utility>
+#include "timbre/log.h"
+#include "timbre/sink.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace timbre {
+
+static bool write_all(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        const long n = _write(fd, data, static_cast<unsigned int>(len));
+#else
+        const long n = ::write(fd, data, len);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Hand both buffers to the kernel in one call, finishing any short write
+static bool write_both(int fd, std::string_view a, std::string_view b) {
+#ifdef _WIN32
+    return write_all(fd, a.data(), a.size()) && write_all(fd, b.data(), b.size());
+#else
+    while (!a.empty()) {
+        struct iovec iov[2] = {
+            {const_cast<char*>(a.data()), a.size()},
+            {const_cast<char*>(b.data()), b.size()},
+        };
+        const ssize_t n = ::writev(fd, iov, 2);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        const std::size_t done = static_cast<std::size_t>(n);
+        if (done >= a.size()) {
+            b.remove_prefix(done - a.size());
+            a = {};
+        } else {
+            a.remove_prefix(done);
+        }
+    }
+    return write_all(fd, b.data(), b.size());
+#endif
+}
+
+// Positioned counterpart of write_all for sinks that track their own offset
+static bool pwrite_all(int fd, const char* data, std::size_t len, std::uint64_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) return false;
+    return write_all(fd, data, len);
+#else
+    while (len > 0) {
+        const ssize_t n = ::pwrite(fd, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+        offset += static_cast<std::uint64_t>(n);
+    }
+    return true;
+#endif
+}
+
+struct Sink::Pending {
+    Sink* sink;
+    Buffer buffer;
+    std::size_t len;
+    std::size_t done;
+    std::uint64_t offset;
+    std::uint64_t submitted_ns;
+};
+
+// Compression thread of one sink. Buffers are compressed and written in
+// the order the sink handed them over; the sink gets spare buffers back.
+struct Sink::Compressing {
+    struct Chunk {
+        Buffer buffer;
+        std::size_t len;
+        std::string extra;
+    };
+
+    Sink& sink;
+    Compressor compressor;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable room;
+    std::deque<Chunk> queue;
+    std::vector<Buffer> spare;
+    std::atomic<std::uint64_t> file_bytes;
+    std::atomic<bool> failed;
+    bool stop;
+    std::thread thread;
+
+    Compressing(Sink& owner, std::uint64_t existing)
+        : sink(owner), file_bytes(existing), failed(false), stop(false) {}
+
+    bool write(const std::string& data);
+    void run();
+};
+
+bool Sink::Compressing::write(const std::string& data) {
+    if (data.empty()) return true;
+    const std::uint64_t start = Stats::enabled() ? Stats::now_ns() : 0;
+    const bool ok = write_all(sink._fd, data.data(), data.size());
+    if (start != 0) stats().sink_write_ns.record(Stats::now_ns() - start);
+    if (ok) {
+        sink._written += data.size();
+        file_bytes.fetch_add(data.size(), std::memory_order_relaxed);
+    }
+    return ok;
+}
+
+void Sink::Compressing::run() {
+    std::string out;
+    bool in_frame = false;
+    auto frame_start = std::chrono::steady_clock::now();
+    const auto ready = [this]() { return stop || !queue.empty(); };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (in_frame) {
+            wake.wait_until(lock, frame_start + FRAME_INTERVAL, ready);
+        } else {
+            wake.wait(lock, ready);
+        }
+        if (queue.empty() && stop) break;
+        bool have = !queue.empty();
+        Chunk chunk;
+        if (have) {
+            chunk = std::move(queue.front());
+            queue.pop_front();
+        }
+        lock.unlock();
+        room.notify_one();
+
+        out.clear();
+        bool ok = !failed.load(std::memory_order_relaxed);
+        if (ok && have) {
+            if (!in_frame) frame_start = std::chrono::steady_clock::now();
+            in_frame = true;
+            ok = compressor.update(std::string_view(chunk.buffer.get(), chunk.len), out)
+                && compressor.update(chunk.extra, out);
+        }
+        // End the frame on time so what is on disk always decompresses
+        if (ok && in_frame && std::chrono::steady_clock::now() - frame_start >= FRAME_INTERVAL) {
+            ok = compressor.finish(out);
+            in_frame = false;
+        }
+        if (ok) ok = write(out);
+        if (!ok && !failed.exchange(true)) {
+            log(LogLevel::ERROR, "Failed to write compressed output to " + sink._path + ": " + std::strerror(errno));
+        }
+
+        lock.lock();
+        if (have) spare.push_back(std::move(chunk.buffer));
+    }
+    lock.unlock();
+
+    // An empty file is not valid gzip or zstd, an empty frame is
+    out.clear();
+    const bool empty = file_bytes.load(std::memory_order_relaxed) == 0;
+    if ((in_frame || empty) && !failed.load() && !(compressor.finish(out) && write(out))) {
+        log(LogLevel::ERROR, "Failed to write compressed output to " + sink._path + ": " + std::strerror(errno));
+        failed = true;
+    }
+}
+
+void Sink::AlignedDelete::operator()(char* p) const {
+    ::operator delete[](p, std::align_val_t{ALIGNMENT});
+}
+
+Sink::Sink(std::size_t capacity)
+    : _fd(-1), _owned(false), _failed(false),
+      _buffer(static_cast<char*>(::operator new[](capacity, std::align_val_t{ALIGNMENT}))),
+      _capacity(capacity), _size(0), _last_flush(std::chrono::steady_clock::now()),
+      _ring(nullptr), _offset(0), _pending(0), _lazy(false), _append(false), _archiver(nullptr), _file_bytes(0),
+      _codec(Codec::NONE), _codec_level(0), _indexed(false), _trigrams(nullptr) {}
+
+Sink::~Sink() {
+    close();
+}
+
+bool Sink::open(const std::string& path, bool append, IoRing* ring) {
+    // NOTE: visit_files() reads the path of sinks in the table without the
+    // writer's help, only sinks not in it yet are given a new one; rotating
+    // and lazy opening reopen the same path and leave it alone
+    if (path != _path) _path = path;
+    const bool ok = open_file(path, append, ring);
+    if (ok && _indexed && _codec == Codec::NONE) {
+        _index.open(path, append, _file_bytes, _trigrams);
+    } else if (ok && !append) {
+        // Sidecars of an earlier run would describe what was just truncated
+        std::error_code ec;
+        std::filesystem::remove(path + ".idx", ec);
+        std::filesystem::remove(path + ".tri", ec);
+    }
+    return ok;
+}
+
+bool Sink::open_file(const std::string& path, bool append, IoRing* ring) {
+    close();
+#ifdef _WIN32
+    (void)ring;
+    const int flags = _O_WRONLY | _O_CREAT | _O_BINARY | (append ? _O_APPEND : _O_TRUNC);
+    _fd = _open(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    // Ring writes carry explicit offsets, O_APPEND would override them
+    _ring = ring != nullptr && ring->ready() && _codec == Codec::NONE ? ring : nullptr;
+    const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? (_ring ? 0 : O_APPEND) : O_TRUNC);
+    _fd = ::open(path.c_str(), flags, 0644);
+    _offset = 0;
+    if (_fd >= 0 && _ring != nullptr && append) {
+        const off_t end = ::lseek(_fd, 0, SEEK_END);
+        _offset = end > 0 ? static_cast<std::uint64_t>(end) : 0;
+    }
+#endif
+    _owned = true;
+    _failed = false;
+    _opened = std::chrono::steady_clock::now();
+    std::error_code ec;
+    const std::uintmax_t existing = append && _fd >= 0 ? std::filesystem::file_size(path, ec) : 0;
+    _file_bytes = ec ? 0 : static_cast<std::uint64_t>(existing);
+    if (_fd >= 0 && _codec != Codec::NONE) {
+        _compressing = std::make_unique<Compressing>(*this, _file_bytes);
+        if (!_compressing->compressor.init(_codec, _codec_level)) {
+            log(LogLevel::ERROR, std::string("Failed to set up ") + codec_name(_codec) + " compression for " + path);
+            _compressing.reset();
+            _failed = true;
+            return false;
+        }
+        _compressing->thread = std::thread([this]() { _compressing->run(); });
+    }
+    return _fd >= 0;
+}
+
+void Sink::defer_open(const std::string& path, bool append, IoRing* ring) {
+    close();
+    _path = path;
+    _append = append;
+    _ring = ring;
+    _owned = true;
+    _failed = false;
+    _lazy = true;
+}
+
+bool Sink::open_lazy() {
+    _lazy = false;
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(_path).parent_path(), ec);
+    if (!open(_path, _append, _ring)) {
+        log(LogLevel::ERROR, "Failed to open log file: " + _path);
+        return false;
+    }
+    log(LogLevel::INFO, "Opened log file: " + _path);
+    return true;
+}
+
+bool Sink::reconfigure(Codec codec, int level, bool indexed, TrigramIndexer* trigrams, IoRing* ring) {
+    if (codec == _codec && level == _codec_level && indexed == _indexed && trigrams == _trigrams) return false;
+    close();
+    set_compression(codec, level);
+    set_index(indexed, trigrams);
+    // Like defer_open(), leaving the path alone for visit_files()
+    _append = true;
+    _ring = ring;
+    _owned = true;
+    _failed = false;
+    _lazy = true;
+    return true;
+}
+
+void Sink::set_compression(Codec codec, int level) {
+    _codec = codec;
+    _codec_level = level;
+}
+
+void Sink::set_rotation(const Rotation& rotation, Archiver* archiver) {
+    _rotation = rotation;
+    _archiver = archiver;
+}
+
+void Sink::attach(int fd, const std::string& name) {
+    close();
+    _fd = fd;
+    _path = name;
+    _owned = false;
+    _failed = false;
+    _ring = nullptr;
+}
+
+bool Sink::write_out(std::string_view extra) {
+    if (_fd < 0 && _lazy) open_lazy();
+    if (_fd < 0 || _failed) {
+        _size = 0;
+        return false;
+    }
+    // Rotate before writing, so a segment never holds data from after it was due
+    if (_rotation.enabled() && rotation_due()) rotate();
+    const std::uint64_t len = _size + extra.size();
+    const bool ok = _compressing ? write_compressed(extra)
+        : _ring != nullptr ? write_ring(extra)
+        : write_sync(extra);
+    if (ok) {
+        _file_bytes += len;
+        _index.written();
+        if (_pending == 0) _index.settled(_file_bytes);
+    }
+    return ok;
+}
+
+bool Sink::write_ring(std::string_view extra) {
+    bool ok = _size == 0 || submit_buffer();
+    _last_flush = std::chrono::steady_clock::now();
+    // Oversized lines are rare enough to write in place at their offset
+    if (ok && !extra.empty()) {
+        ok = pwrite_all(_fd, extra.data(), extra.size(), _offset);
+        _offset += extra.size();
+        if (ok) _written += extra.size();
+        if (!ok) {
+            log(LogLevel::ERROR, "Failed to write to " + _path + ": " + std::strerror(errno));
+            _failed = true;
+        }
+    }
+    return ok;
+}
+
+bool Sink::write_sync(std::string_view extra) {
+    const std::uint64_t start = Stats::enabled() ? Stats::now_ns() : 0;
+    const bool ok = extra.empty()
+        ? write_all(_fd, _buffer.get(), _size)
+        : write_both(_fd, std::string_view(_buffer.get(), _size), extra);
+    if (ok) _written += _size + extra.size();
+    if (start != 0) stats().sink_write_ns.record(Stats::now_ns() - start);
+    _size = 0;
+    _last_flush = std::chrono::steady_clock::now();
+    if (!ok) {
+        log(LogLevel::ERROR, "Failed to write to " + _path + ": " + std::strerror(errno));
+        _failed = true;
+    }
+    return ok;
+}
+
+bool Sink::write_compressed(std::string_view extra) {
+    Compressing& compressing = *_compressing;
+    if (compressing.failed.load()) {
+        _failed = true;
+        _size = 0;
+        return false;
+    }
+    {
+        std::unique_lock<std::mutex> lock(compressing.mutex);
+        compressing.room.wait(lock, [&compressing]() { return compressing.queue.size() < MAX_IN_FLIGHT; });
+        compressing.queue.push_back(Compressing::Chunk{std::move(_buffer), _size, std::string(extra)});
+        if (!compressing.spare.empty()) {
+            _buffer = std::move(compressing.spare.back());
+            compressing.spare.pop_back();
+        }
+    }
+    compressing.wake.notify_one();
+    if (!_buffer) _buffer.reset(static_cast<char*>(::operator new[](_capacity, std::align_val_t{ALIGNMENT})));
+    _size = 0;
+    _last_flush = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool Sink::rotation_due() const {
+    // Compressed files rotate on their size on disk
+    const std::uint64_t size = _compressing ? _compressing->file_bytes.load(std::memory_order_relaxed) : _file_bytes;
+    if (_rotation.max_size > 0 && size >= _rotation.max_size) return true;
+    return _rotation.max_age > 0
+        && std::chrono::steady_clock::now() - _opened >= std::chrono::seconds(_rotation.max_age);
+}
+
+bool Sink::rotate_before() {
+    // What the file can still take goes out first, the line starts the next segment
+    if (_size > 0 && !write_out({})) return false;
+    if (_fd >= 0) rotate();
+    return _fd >= 0 && !_failed;
+}
+
+void Sink::rotate() {
+    // The buffer stays put and goes into the new file
+    IoRing* ring = _ring;
+    const std::string path = _path;
+    const std::uint64_t bytes_out = _file_bytes;
+    release();
+    const std::string segment = rotated_name(path);
+    std::error_code ec;
+    std::filesystem::rename(path, segment, ec);
+    const bool rotated = !ec;
+    if (!rotated) {
+        log(LogLevel::ERROR, "Failed to rotate " + path + ", no longer rotating it: " + ec.message());
+        _rotation = Rotation{};
+    }
+    if (rotated) _index.rotate(segment, bytes_out, std::string_view(_buffer.get(), _size));
+    // Keep appending to the old file if it could not be moved aside
+    if (!open_file(path, !rotated, ring)) {
+        log(LogLevel::ERROR, "Failed to reopen log file: " + path);
+        return;
+    }
+    if (!rotated) return;
+    log(LogLevel::INFO, "Rotated " + path + " to " + segment);
+    Rotation policy = _rotation;
+    if (_codec != Codec::NONE) policy.compress = Codec::NONE;  // already compressed
+    if (_archiver != nullptr && (policy.compress != Codec::NONE || policy.keep > 0)) {
+        _archiver->submit(segment, path, policy);
+    }
+}
+
+bool Sink::submit_buffer() {
+    auto* op = new Pending{this, std::move(_buffer), _size, 0, _offset, Stats::enabled() ? Stats::now_ns() : 0};
+    _offset += _size;
+    _size = 0;
+    ++_pending;
+    bool ok = true;
+    while (!_ring->write(_fd, op->buffer.get(), op->len, op->offset, reinterpret_cast<std::uint64_t>(op))) {
+        if (!(ok = reap(*_ring, 1))) break;
+    }
+    if (ok) {
+        ok = _ring->submit();
+    } else {
+        // The ring is unusable, don't lose the buffer
+        if (pwrite_all(_fd, op->buffer.get(), op->len, op->offset)) {
+            _written += op->len;
+            ok = true;
+        }
+        _spare.push_back(std::move(op->buffer));
+        --_pending;
+        delete op;
+    }
+
+    // Keep filling a spare buffer, only block once MAX_IN_FLIGHT are queued up
+    while (ok && _spare.empty() && _pending >= MAX_IN_FLIGHT) ok = reap(*_ring, 1);
+    if (!_spare.empty()) {
+        _buffer = std::move(_spare.back());
+        _spare.pop_back();
+    } else {
+        _buffer.reset(static_cast<char*>(::operator new[](_capacity, std::align_val_t{ALIGNMENT})));
+    }
+    if (!ok) {
+        log(LogLevel::ERROR, "Failed to submit write to " + _path + ": " + std::strerror(errno));
+        _failed = true;
+    }
+    return ok;
+}
+
+void Sink::complete(Pending* op, int result) {
+    if (result == -EINTR || result == -EAGAIN) result = 0;
+    if (result < 0) {
+        log(LogLevel::ERROR, "Failed to write to " + _path + ": " + std::strerror(-result));
+        _failed = true;
+    } else {
+        op->done += static_cast<std::size_t>(result);
+        _written += static_cast<std::uint64_t>(result);
+        if (op->done < op->len && !_failed) {
+            const char* rest = op->buffer.get() + op->done;
+            const std::size_t len = op->len - op->done;
+            const std::uint64_t offset = op->offset + op->done;
+            if (_ring->write(_fd, rest, len, offset, reinterpret_cast<std::uint64_t>(op))) return;
+            // Ring is full of other writes, finish this one by hand
+            if (pwrite_all(_fd, rest, len, offset)) {
+                _written += len;
+            } else {
+                log(LogLevel::ERROR, "Failed to write to " + _path + ": " + std::strerror(errno));
+                _failed = true;
+            }
+        }
+    }
+    if (op->submitted_ns != 0) stats().sink_write_ns.record(Stats::now_ns() - op->submitted_ns);
+    _spare.push_back(std::move(op->buffer));
+    --_pending;
+    delete op;
+    // Everything before _offset is on disk once no ring write is left
+    if (_pending == 0) _index.settled(_offset);
+}
+
+bool Sink::reap(IoRing& ring, unsigned wait_for) {
+    if (!ring.submit(wait_for)) return false;
+    for (const auto& completion : ring.reap()) {
+        auto* op = reinterpret_cast<Pending*>(completion.tag);
+        op->sink->complete(op, completion.result);
+    }
+    // Push out any short writes that were requeued
+    return ring.submit();
+}
+
+bool Sink::write(std::string_view data) {
+    if (_size + data.size() <= _capacity) {
+        std::memcpy(_buffer.get() + _size, data.data(), data.size());
+        _size += data.size();
+        return true;
+    }
+    if (data.size() < _capacity) {
+        if (!write_out({})) return false;
+        std::memcpy(_buffer.get(), data.data(), data.size());
+        _size = data.size();
+        return true;
+    }
+    return write_out(data);
+}
+
+bool Sink::write_line(std::string_view line) {
+    if (_rotation.max_size > 0 && !_compressing && _file_bytes + _size > 0
+        && _file_bytes + _size + line.size() + 1 > _rotation.max_size && !rotate_before()) {
+        return false;
+    }
+    if (_size + line.size() + 1 <= _capacity) {
+        char* dst = _buffer.get() + _size;
+        std::memcpy(dst, line.data(), line.size());
+        dst[line.size()] = '\n';
+        _size += line.size() + 1;
+    } else if (!(write(line) && write("\n"))) {
+        return false;
+    }
+    // Where the line ended up, after any write out on the way
+    _index.line(_file_bytes + _size - line.size() - 1, line);
+    return true;
+}
+
+bool Sink::flush() {
+    if (_size == 0) return !_failed;
+    return write_out({});
+}
+
+bool Sink::flush_if_due(std::chrono::steady_clock::time_point now, std::chrono::milliseconds interval) {
+    if (_size == 0 || now - _last_flush < interval) return true;
+    return write_out({});
+}
+
+void Sink::close() {
+    if (_lazy && _size > 0) flush();  // never written out yet, open it now
+    _lazy = false;
+    if (_fd < 0) return;
+    flush();
+    release();
+    _index.close();
+}
+
+void Sink::release() {
+    // Wait for ring writes and compression still working on this descriptor
+    while (_pending > 0 && _ring->in_flight() > 0 && reap(*_ring, 1)) {}
+    if (_compressing) {
+        {
+            std::lock_guard<std::mutex> lock(_compressing->mutex);
+            _compressing->stop = true;
+        }
+        _compressing->wake.notify_one();
+        _compressing->thread.join();
+        _compressing.reset();
+    }
+    if (_owned) {
+#ifdef _WIN32
+        _close(_fd);
+#else
+        ::close(_fd);
+#endif
+    }
+    _fd = -1;
+    _ring = nullptr;
+}
+
+// Slots are indexed by matcher id, which follows level priority
+static std::vector<std::map<std::string, UserLevel>::pointer> levels_by_id(UserConfig& config) {
+    std::vector<std::map<std::string, UserLevel>::pointer> ordered;
+    const Matcher& matcher = config.get_matcher();
+    auto& levels = config.get_log_levels();
+    for (std::size_t id = 0; id < matcher.size(); ++id) {
+        ordered.push_back(&*levels.find(matcher.level_name(static_cast<int>(id))));
+    }
+    return ordered;
+}
+
+SinkTable::SinkTable()
+    : _stdout(std::make_unique<Sink>()), _interval(std::chrono::milliseconds(200)), _ticks(0), _append(false),
+      _lock(std::make_unique<std::mutex>()) {}
+
+void SinkTable::open(UserConfig& config, bool append) {
+    close();
+    std::lock_guard<std::mutex> lock(*_lock);
+    _append = append;
+    _files.clear();
+    _slots.clear();
+    _limiters.clear();
+    _collapsers.clear();
+    _event.reset();
+    _stdout->attach(1, "stdout");
+    _ring.reset();
+    if (!_archiver) _archiver = std::make_unique<Archiver>();
+    if (!_trigrams) _trigrams = std::make_unique<TrigramIndexer>();
+    if (config.get_io_backend() == "uring") {
+        _ring = std::make_unique<IoRing>();
+        if (!_ring->init()) {
+            log(LogLevel::WARNING, std::string("io_uring unavailable, falling back to write(2): ") + std::strerror(errno));
+            _ring.reset();
+        }
+    }
+
+    std::filesystem::create_directories(config.get_log_dir());
+    std::map<std::string, Sink*> by_path;
+    for (auto* entry : levels_by_id(config)) {
+        const std::string& level_name = entry->first;
+        UserLevel& level_config = entry->second;
+        const std::string file_path = config.get_log_dir() + "/" + level_config.path;
+        Sink* sink = nullptr;
+        if (const auto it = by_path.find(file_path); it != by_path.end()) {
+            sink = it->second;
+        } else {
+            _files.push_back(std::make_unique<Sink>());
+            sink = _files.back().get();
+            by_path[file_path] = sink;
+            sink->set_rotation(level_config.rotation, _archiver.get());
+            sink->set_compression(level_config.compress, level_config.compress_level);
+            sink->set_index(config.get_index(), config.get_trigram_index() ? _trigrams.get() : nullptr);
+            if (!sink->open(file_path, append, _ring.get())) {
+                log(LogLevel::ERROR, "Failed to open log file: " + file_path);
+            }
+            if (level_config.collapse_window > 0) {
+                _collapsers[sink] = std::make_unique<RepeatCollapser>(*sink, level_config.collapse_window);
+            }
+        }
+        RateLimiter* limiter = nullptr;
+        if (level_config.throttle.enabled()) {
+            limiter = (_limiters[level_name] = std::make_unique<RateLimiter>(level_config.throttle)).get();
+        }
+        const auto collapser = _collapsers.find(sink);
+        _slots.push_back(Slot{&level_name, &level_config, sink, limiter,
+                              collapser != _collapsers.end() ? collapser->second.get() : nullptr});
+    }
+}
+
+void SinkTable::rebind(std::shared_ptr<UserConfig> next) {
+    UserConfig& config = *next;
+    std::map<std::string, std::unique_ptr<Sink>> old_files;
+    for (auto& file : _files) old_files[file->path()] = std::move(file);
+    std::map<std::string, std::pair<std::uint64_t, std::uint64_t>> old_counts;
+    for (const auto& slot : _slots) old_counts[*slot.name] = {slot.level->count, slot.level->dropped};
+    std::map<std::string, std::unique_ptr<RateLimiter>> limiters;
+    std::map<const Sink*, std::unique_ptr<RepeatCollapser>> collapsers;
+    // A file keeps its collapser, and the repeats counted so far, unless the window changed
+    const auto collapse = [&](Sink* sink, std::uint32_t window) {
+        if (const auto old = _collapsers.find(sink); old != _collapsers.end() && old->second->window() == window) {
+            collapsers[sink] = std::move(old->second);
+        } else if (window > 0) {
+            collapsers[sink] = std::make_unique<RepeatCollapser>(*sink, window);
+        }
+    };
+
+    std::vector<std::unique_ptr<Sink>> files;
+    std::vector<Slot> slots;
+    std::map<std::string, Sink*> by_path;
+    for (auto* entry : levels_by_id(config)) {
+        const std::string& level_name = entry->first;
+        UserLevel& level_config = entry->second;
+        const std::string file_path = config.get_log_dir() + "/" + level_config.path;
+        Sink* sink = nullptr;
+        if (const auto it = by_path.find(file_path); it != by_path.end()) {
+            sink = it->second;
+        } else if (auto old = old_files.find(file_path); old != old_files.end()) {
+            files.push_back(std::move(old->second));
+            old_files.erase(old);
+            sink = files.back().get();
+            sink->set_rotation(level_config.rotation, _archiver.get());
+            if (sink->reconfigure(level_config.compress, level_config.compress_level, config.get_index(),
+                                  config.get_trigram_index() ? _trigrams.get() : nullptr, _ring.get())) {
+                log(LogLevel::INFO, "Reopening log file with new compression or index settings: " + file_path);
+            }
+            collapse(sink, level_config.collapse_window);
+        } else {
+            files.push_back(std::make_unique<Sink>());
+            sink = files.back().get();
+            sink->set_rotation(level_config.rotation, _archiver.get());
+            sink->set_compression(level_config.compress, level_config.compress_level);
+            sink->set_index(config.get_index(), config.get_trigram_index() ? _trigrams.get() : nullptr);
+            sink->defer_open(file_path, _append, _ring.get());
+            collapse(sink, level_config.collapse_window);
+        }
+        by_path[file_path] = sink;
+        if (const auto it = old_counts.find(level_name); it != old_counts.end()) {
+            level_config.count = it->second.first;
+            level_config.dropped = it->second.second;
+        }
+        RateLimiter* limiter = nullptr;
+        if (level_config.throttle.enabled()) {
+            auto& slot_limiter = limiters[level_name];
+            if (const auto old = _limiters.find(level_name); old != _limiters.end()) {
+                slot_limiter = std::move(old->second);
+                slot_limiter->set_policy(level_config.throttle);
+            } else {
+                slot_limiter = std::make_unique<RateLimiter>(level_config.throttle);
+            }
+            limiter = slot_limiter.get();
+        }
+        const auto collapser = collapsers.find(sink);
+        slots.push_back(Slot{&level_name, &level_config, sink, limiter,
+                             collapser != collapsers.end() ? collapser->second.get() : nullptr});
+    }
+    // Report what levels losing their throttle dropped while their sinks are still open
+    for (const auto& slot : _slots) {
+        if (slot.limiter == nullptr || limiters.count(*slot.name) > 0) continue;
+        const std::string marker = slot.limiter->marker(*slot.name, std::chrono::steady_clock::now(), true);
+        if (!marker.empty()) write_verbatim(slot, marker);
+    }
+    // NOLINTBEGIN: unassignedVariable
+    for (auto& [sink, collapser] : _collapsers) { // NOLINT
+        if (collapser) collapser->flush();
+    }
+    // NOLINTEND
+
+    {
+        std::lock_guard<std::mutex> lock(*_lock);
+        _files = std::move(files);
+        _slots = std::move(slots);
+        _bound = std::move(next);
+        _limiters = std::move(limiters);
+        _collapsers = std::move(collapsers);
+    }
+    _event.reset();
+    // Whatever is left is no longer routed to
+    for (auto& [path, file] : old_files) { // NOLINT
+        log(LogLevel::INFO, "Closing log file: " + path);
+        file->close();
+    }
+    _interval = std::chrono::milliseconds(config.get_flush_interval());
+}
+
+void SinkTable::visit_levels(const std::function<void(const std::string&, const UserLevel&)>& fn) const {
+    std::lock_guard<std::mutex> lock(*_lock);
+    for (const auto& slot : _slots) fn(*slot.name, *slot.level);
+}
+
+void SinkTable::visit_files(const std::function<void(const Sink&)>& fn) const {
+    std::lock_guard<std::mutex> lock(*_lock);
+    for (const auto& file : _files) fn(*file);
+}
+
+void SinkTable::tick() {
+    if (++_ticks < TICKS_PER_CLOCK_CHECK) return;
+    poll();
+}
+
+void SinkTable::poll() {
+    _ticks = 0;
+    const auto now = std::chrono::steady_clock::now();
+    _stdout->flush_if_due(now, _interval);
+    // NOLINTBEGIN: unassignedVariable
+    for (auto& [sink, collapser] : _collapsers) collapser->flush_if_due(now); // NOLINT
+    // NOLINTEND
+    for (auto& file : _files) file->flush_if_due(now, _interval);
+    if (_ring) Sink::reap(*_ring, 0);
+    if (!_limiters.empty()) write_markers(false);
+}
+
+void SinkTable::write_verbatim(const Slot& slot, std::string_view line) {
+    if (slot.collapser != nullptr) {
+        slot.collapser->write_verbatim(line);
+    } else {
+        slot.sink->write_line(line);
+    }
+}
+
+void SinkTable::write_markers(bool force) {
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto& slot : _slots) {
+        if (slot.limiter == nullptr) continue;
+        const std::string marker = slot.limiter->marker(*slot.name, now, force);
+        if (!marker.empty()) write_verbatim(slot, marker);
+    }
+}
+
+void SinkTable::flush() {
+    _stdout->flush();
+    for (auto& file : _files) file->flush();
+}
+
+void SinkTable::close() {
+    // NOLINTBEGIN: unassignedVariable
+    for (auto& [sink, collapser] : _collapsers) collapser->flush(); // NOLINT
+    // NOLINTEND
+    if (!_limiters.empty()) write_markers(true);
+    _stdout->flush();
+    for (auto& file : _files) file->close();
+    // Let the last rotated segments finish compressing, and the last blocks indexing
+    if (_archiver) _archiver->stop();
+    if (_trigrams) _trigrams->stop();
+}
+
+} // namespace timbre
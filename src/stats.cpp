@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <utility>
+#include "timbre/config.h"
+#include "timbre/log.h"
+#include "timbre/sink.h"
+#include "timbre/stats.h"
+
+namespace timbre {
+
+Stats& stats() {
+    static Stats instance;
+    return instance;
+}
+
+// A thread's classification count, handed over to the total as the thread exits
+struct Stats::ThreadCount {
+    Stats& owner;
+    Counter count;
+
+    explicit ThreadCount(Stats& of) : owner(of) {
+        std::lock_guard<std::mutex> lock(owner._classified_mutex);
+        owner._classified_live.push_back(&count);
+    }
+    ~ThreadCount() {
+        std::lock_guard<std::mutex> lock(owner._classified_mutex);
+        owner._classified_exited += count.load();
+        auto& live = owner._classified_live;
+        live.erase(std::find(live.begin(), live.end(), &count));
+    }
+};
+
+Counter& Stats::thread_classifications() {
+    thread_local ThreadCount mine(*this);
+    return mine.count;
+}
+
+std::uint64_t Stats::classifications() const {
+    std::lock_guard<std::mutex> lock(_classified_mutex);
+    std::uint64_t total = _classified_exited;
+    for (const Counter* count : _classified_live) total += count->load();
+    return total;
+}
+
+Histogram::Histogram() : _sum(0), _max(0) {
+    for (auto& bucket : _buckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+std::size_t Histogram::bucket(std::uint64_t value) {
+    if (value < SUB_BUCKETS) return static_cast<std::size_t>(value);
+    unsigned msb = 63;
+    while ((value >> msb) == 0) --msb;
+    const unsigned shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + static_cast<std::size_t>((value >> shift) - SUB_BUCKETS);
+}
+
+std::uint64_t Histogram::bucket_high(std::size_t index) {
+    const std::size_t group = index / SUB_BUCKETS;
+    const std::uint64_t sub = index % SUB_BUCKETS;
+    if (group == 0) return sub;
+    const unsigned shift = static_cast<unsigned>(group - 1);
+    return ((SUB_BUCKETS + sub) << shift) + ((std::uint64_t{1} << shift) - 1);
+}
+
+void Histogram::record(std::uint64_t ns) {
+    _buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(ns, std::memory_order_relaxed);
+    std::uint64_t max = _max.load(std::memory_order_relaxed);
+    while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+Histogram::Summary Histogram::summary() const {
+    Summary summary;
+    std::array<std::uint64_t, BUCKETS> counts;
+    for (std::size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+        summary.count += counts[i];
+    }
+    summary.sum = _sum.load(std::memory_order_relaxed);
+    summary.max = _max.load(std::memory_order_relaxed);
+    if (summary.count == 0) return summary;
+
+    const std::pair<double, std::uint64_t*> quantiles[] = {
+        {0.50, &summary.p50}, {0.90, &summary.p90}, {0.99, &summary.p99}, {0.999, &summary.p999},
+    };
+    std::uint64_t seen = 0;
+    std::size_t q = 0;
+    for (std::size_t i = 0; i < BUCKETS && q < std::size(quantiles); ++i) {
+        seen += counts[i];
+        while (q < std::size(quantiles)
+               && static_cast<double>(seen) >= quantiles[q].first * static_cast<double>(summary.count)) {
+            *quantiles[q].second = std::min(bucket_high(i), summary.max);
+            ++q;
+        }
+    }
+    return summary;
+}
+
+static std::string escape(const std::string& text) {
+    std::string out;
+    for (const char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out += c;
+    }
+    return out;
+}
+
+static void summary_json(std::ostringstream& out, const Histogram::Summary& s) {
+    out << "{\"count\":" << s.count << ",\"p50\":" << s.p50 << ",\"p90\":" << s.p90
+        << ",\"p99\":" << s.p99 << ",\"p999\":" << s.p999 << ",\"max\":" << s.max << "}";
+}
+
+static void summary_prometheus(std::ostringstream& out, const std::string& name, const std::string& help,
+                               const Histogram::Summary& s) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " summary\n";
+    const std::pair<const char*, std::uint64_t> quantiles[] = {
+        {"0.5", s.p50}, {"0.9", s.p90}, {"0.99", s.p99}, {"0.999", s.p999},
+    };
+    // NOLINTBEGIN: unassignedVariable
+    for (const auto& [quantile, ns] : quantiles) { // NOLINT
+        out << name << "{quantile=\"" << quantile << "\"} " << static_cast<double>(ns) / 1e9 << "\n";
+    }
+    // NOLINTEND
+    out << name << "_sum " << static_cast<double>(s.sum) / 1e9 << "\n";
+    out << name << "_count " << s.count << "\n";
+}
+
+static void counter_prometheus(std::ostringstream& out, const std::string& name, const std::string& help,
+                               std::uint64_t value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " " << value << "\n";
+}
+
+StatsReporter::StatsReporter(SinkTable& log_files, const std::string& target, std::chrono::milliseconds interval)
+    : _log_files(log_files), _target(target), _format(Format::JSON), _interval(interval),
+      _started(std::chrono::steady_clock::now()), _last(_started), _last_lines(0), _last_bytes(0), _stop(false) {
+    const std::string prom = ".prom";
+    if (_target.size() > prom.size() && _target.compare(_target.size() - prom.size(), prom.size(), prom) == 0) {
+        _format = Format::PROMETHEUS;
+    }
+}
+
+StatsReporter::~StatsReporter() {
+    stop();
+}
+
+void StatsReporter::start() {
+    Stats::active = true;
+    _started = _last = std::chrono::steady_clock::now();
+    _thread = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_wake.wait_for(lock, _interval, [this]() { return _stop; })) {
+            write_snapshot();
+        }
+    });
+}
+
+void StatsReporter::stop() {
+    if (!_thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+    write_snapshot();
+}
+
+std::string StatsReporter::to_json() {
+    Stats& s = stats();
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - _last).count();
+    const std::uint64_t lines = s.lines_in.load();
+    const std::uint64_t bytes = s.bytes_in.load();
+
+    std::ostringstream out;
+    out << "{\"uptime_s\":" << std::chrono::duration<double>(now - _started).count()
+        << ",\"lines_in\":" << lines
+        << ",\"bytes_in\":" << bytes
+        << ",\"lines_per_sec\":" << (elapsed > 0 ? static_cast<double>(lines - _last_lines) / elapsed : 0.0)
+        << ",\"bytes_per_sec\":" << (elapsed > 0 ? static_cast<double>(bytes - _last_bytes) / elapsed : 0.0)
+        << ",\"classifications\":" << s.classifications()
+        << ",\"regex_evaluations\":" << s.regex_evaluations.load(std::memory_order_relaxed)
+        << ",\"levels\":{";
+    bool first = true;
+    // Levels and files can change under a config reload, go through the table
+    _log_files.visit_levels([&](const std::string& name, const UserLevel& level) {
+        out << (first ? "" : ",") << "\"" << escape(name) << "\":" << level.count.load();
+        first = false;
+    });
+    out << "},\"dropped\":{";
+    first = true;
+    _log_files.visit_levels([&](const std::string& name, const UserLevel& level) {
+        out << (first ? "" : ",") << "\"" << escape(name) << "\":" << level.dropped.load();
+        first = false;
+    });
+    out << "},\"sinks\":{\"stdout\":" << _log_files.out().bytes_written();
+    _log_files.visit_files([&](const Sink& file) {
+        out << ",\"" << escape(file.path()) << "\":" << file.bytes_written();
+    });
+    out << "},\"classify_ns\":";
+    summary_json(out, s.classify_ns.summary());
+    out << ",\"sink_write_ns\":";
+    summary_json(out, s.sink_write_ns.summary());
+    out << "}\n";
+
+    _last = now;
+    _last_lines = lines;
+    _last_bytes = bytes;
+    return out.str();
+}
+
+std::string StatsReporter::to_prometheus() {
+    Stats& s = stats();
+    std::ostringstream out;
+    out << "# HELP timbre_uptime_seconds Seconds since timbre started.\n";
+    out << "# TYPE timbre_uptime_seconds gauge\n";
+    out << "timbre_uptime_seconds "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - _started).count() << "\n";
+    counter_prometheus(out, "timbre_lines_in_total", "Lines read from input.", s.lines_in.load());
+    counter_prometheus(out, "timbre_bytes_in_total", "Bytes read from input.", s.bytes_in.load());
+    counter_prometheus(out, "timbre_classifications_total", "Lines run through the level matcher.",
+                       s.classifications());
+    counter_prometheus(out, "timbre_regex_evaluations_total", "Lines handed to a std::regex fallback pattern.",
+                       s.regex_evaluations.load(std::memory_order_relaxed));
+
+    out << "# HELP timbre_level_lines_total Lines routed to each level.\n";
+    out << "# TYPE timbre_level_lines_total counter\n";
+    _log_files.visit_levels([&](const std::string& name, const UserLevel& level) {
+        out << "timbre_level_lines_total{level=\"" << escape(name) << "\"} " << level.count.load() << "\n";
+    });
+    out << "# HELP timbre_level_dropped_lines_total Lines dropped by each level's sample_rate / max_lines_per_sec.\n";
+    out << "# TYPE timbre_level_dropped_lines_total counter\n";
+    _log_files.visit_levels([&](const std::string& name, const UserLevel& level) {
+        out << "timbre_level_dropped_lines_total{level=\"" << escape(name) << "\"} " << level.dropped.load() << "\n";
+    });
+    out << "# HELP timbre_sink_bytes_written_total Bytes handed to the kernel per output.\n";
+    out << "# TYPE timbre_sink_bytes_written_total counter\n";
+    out << "timbre_sink_bytes_written_total{file=\"stdout\"} " << _log_files.out().bytes_written() << "\n";
+    _log_files.visit_files([&](const Sink& file) {
+        out << "timbre_sink_bytes_written_total{file=\"" << escape(file.path()) << "\"} "
+            << file.bytes_written() << "\n";
+    });
+
+    summary_prometheus(out, "timbre_classify_latency_seconds", "Time to classify one line (sampled).",
+                       s.classify_ns.summary());
+    summary_prometheus(out, "timbre_sink_write_latency_seconds", "Time for one buffered write to complete.",
+                       s.sink_write_ns.summary());
+    return out.str();
+}
+
+void StatsReporter::write_snapshot() {
+    if (_format == Format::PROMETHEUS) {
+        // Write aside and rename so the collector never reads half a file
+        const std::string tmp = _target + ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::trunc);
+            file << to_prometheus();
+            if (!file) {
+                log(LogLevel::ERROR, "Failed to write stats to " + tmp);
+                return;
+            }
+        }
+        if (std::rename(tmp.c_str(), _target.c_str()) != 0) {
+            log(LogLevel::ERROR, "Failed to write stats to " + _target);
+        }
+        return;
+    }
+
+    const std::string snapshot = to_json();
+    if (_target == "stderr" || _target == "-") {
+        std::fputs(snapshot.c_str(), stderr);
+        std::fflush(stderr);
+        return;
+    }
+    std::ofstream file(_target, std::ios::app);
+    file << snapshot;
+    if (!file) log(LogLevel::ERROR, "Failed to write stats to " + _target);
+}
+
+} // namespace timbre
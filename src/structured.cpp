@@ -0,0 +1,219 @@
+#include <cstring>
+#include <algorithm>
+#include "timbre/structured.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace timbre {
+
+namespace {
+
+const char* const SYSLOG[] = {"emergency", "alert", "critical", "error", "warning", "notice", "info", "debug"};
+
+// Words taken for a severity between brackets, "[main]" and the like are not
+const char* const SEVERITIES[] = {"trace", "debug", "info", "notice", "warn", "warning", "error", "err",
+                                  "severe", "crit", "critical", "fatal", "alert", "emerg", "emergency"};
+
+// Longest word looked at between brackets, "[EMERGENCY]"
+constexpr std::size_t MAX_BRACKET_WORD = 9;
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+bool is_letter(char c) { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'); }
+
+// Whether word is name, lowercase, in any case
+bool same_word(std::string_view name, std::string_view word) {
+    return name.size() == word.size()
+        && std::equal(name.begin(), name.end(), word.begin(), [](char a, char b) { return a == (b | 0x20); });
+}
+
+bool is_severity(std::string_view word) {
+    for (const char* severity : SEVERITIES) {
+        if (same_word(severity, word)) return true;
+    }
+    return false;
+}
+
+// Severities under another name than the default level they belong to
+struct Alias {
+    const char* severity;
+    const char* level;
+};
+
+const Alias ALIASES[] = {
+    {"fatal", "error"}, {"panic", "error"}, {"emerg", "error"},  {"emergency", "error"}, {"alert", "error"},
+    {"crit", "error"},  {"critical", "error"}, {"severe", "error"}, {"err", "error"},
+    {"notice", "info"}, {"trace", "debug"},
+};
+
+// The severity an enabled prefix puts at the start of line, empty if none
+std::string_view prefix_severity(std::string_view line, std::uint8_t prefixes) {
+    const auto enabled = [prefixes](Prefix prefix) { return (prefixes & static_cast<std::uint8_t>(prefix)) != 0; };
+    if (line.size() < 3) return {};
+    switch (line[0]) {
+    case '<':
+        if (enabled(Prefix::SYSLOG)) {
+            // <PRI>, PRI = facility * 8 + severity
+            int priority = 0;
+            std::size_t i = 1;
+            for (; i < 4 && i < line.size() && is_digit(line[i]); ++i) priority = priority * 10 + (line[i] - '0');
+            if (i > 1 && i < line.size() && line[i] == '>' && priority <= 191) return SYSLOG[priority % 8];
+        }
+        break;
+    case '[':
+        if (enabled(Prefix::BRACKET)) {
+            std::size_t i = 1;
+            while (i <= MAX_BRACKET_WORD && i < line.size() && is_letter(line[i])) ++i;
+            if (i > 1 && i < line.size() && line[i] == ']' && is_severity(line.substr(1, i - 1))) {
+                return line.substr(1, i - 1);
+            }
+        }
+        break;
+    case 'I':
+    case 'W':
+    case 'E':
+    case 'F':
+        // Lmmdd, then a space
+        if (enabled(Prefix::GLOG) && line.size() > 5 && is_digit(line[1]) && is_digit(line[2])
+            && is_digit(line[3]) && is_digit(line[4]) && line[5] == ' ') {
+            switch (line[0]) {
+            case 'I': return "info";
+            case 'W': return "warning";
+            case 'E': return "error";
+            default: return "fatal";
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return {};
+}
+
+// The next '"' or '=' from p on, end if there is none
+const char* find_delimiter(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i equals = _mm_set1_epi8('=');
+    for (; end - p >= 16; p += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, equals)));
+        if (mask != 0) return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == '"' || *p == '=') return p;
+    }
+    return end;
+}
+
+// The quote closing the string opened at p[-1], end if it is never closed
+const char* closing_quote(const char* p, const char* end) {
+    while (p < end) {
+        const char* quote = static_cast<const char*>(std::memchr(p, '"', end - p));
+        if (quote == nullptr) return end;
+        const char* escape = quote;
+        while (escape > p && escape[-1] == '\\') --escape;
+        if ((quote - escape) % 2 == 0) return quote;
+        p = quote + 1;
+    }
+    return end;
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && is_blank(*p)) ++p;
+    return p;
+}
+
+// A value at p, quoted or running up to the first of stops
+std::string_view read_value(const char* p, const char* end, const char* stops) {
+    if (p < end && *p == '"') {
+        const char* close = closing_quote(p + 1, end);
+        return std::string_view(p + 1, close - p - 1);
+    }
+    const char* stop = p;
+    while (stop < end && std::strchr(stops, *stop) == nullptr) ++stop;
+    return std::string_view(p, stop - p);
+}
+
+// Syslog severities 0-7 and the bunyan/pino scale 10-60 by name
+std::string_view level_name(std::string_view value) {
+    static const char* const PINO[] = {"trace", "debug", "info", "warn", "error", "fatal"};
+    if (value.empty() || value.size() > 2) return value;
+    int number = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return value;
+        number = number * 10 + (c - '0');
+    }
+    if (number < 8) return SYSLOG[number];
+    if (number % 10 == 0 && number <= 60) return PINO[number / 10 - 1];
+    return value;
+}
+
+} // namespace
+
+std::string_view default_level(std::string_view severity) {
+    for (const Alias& alias : ALIASES) {
+        if (same_word(alias.severity, severity)) return alias.level;
+    }
+    return {};
+}
+
+bool parse_prefix(const std::string& name, Prefix& prefix) {
+    if (name == "glog" || name == "klog") {
+        prefix = Prefix::GLOG;
+    } else if (name == "syslog") {
+        prefix = Prefix::SYSLOG;
+    } else if (name == "bracket") {
+        prefix = Prefix::BRACKET;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool LevelField::find(std::string_view line, std::string_view& value) const {
+    if (_prefixes != 0) {
+        value = prefix_severity(line, _prefixes);
+        if (!value.empty()) return true;
+    }
+    if (_keys.empty()) return false;
+    const char* const begin = line.data();
+    const char* const end = begin + line.size();
+    const char* const first = skip_blanks(begin, end);
+    const bool json = first < end && *first == '{';
+    const auto is_key = [this](std::string_view key) {
+        return std::find(_keys.begin(), _keys.end(), key) != _keys.end();
+    };
+
+    for (const char* p = find_delimiter(begin, end); p < end; p = find_delimiter(p + 1, end)) {
+        if (*p == '"') {
+            const char* close = closing_quote(p + 1, end);
+            if (close == end) return false;
+            if (json) {
+                // A key is a string followed by a colon
+                const char* colon = skip_blanks(close + 1, end);
+                if (colon < end && *colon == ':' && is_key(std::string_view(p + 1, close - p - 1))) {
+                    value = level_name(read_value(skip_blanks(colon + 1, end), end, ",} \t"));
+                    if (!value.empty()) return true;
+                }
+            }
+            p = close;
+        } else if (!json) {
+            // A key runs back from the equals sign to the start of the line or a blank
+            const char* key = p;
+            while (key > begin && !is_blank(key[-1])) --key;
+            if (is_key(std::string_view(key, p - key))) {
+                value = level_name(read_value(p + 1, end, " \t"));
+                if (!value.empty()) return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace timbre
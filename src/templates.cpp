@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include "timbre/repeat.h"
+#include "timbre/templates.h"
+
+namespace timbre {
+
+namespace {
+
+constexpr std::string_view WILDCARD = "<*>";
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool is_hex(char c) {
+    return is_digit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+bool is_alpha(char c) {
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+bool is_uuid(std::string_view s) {
+    if (s.size() != 36) return false;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        const bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash ? s[i] != '-' : !is_hex(s[i])) return false;
+    }
+    return true;
+}
+
+// 0x1f, or 8+ hex digits with at least one decimal digit (ids, hashes)
+bool is_hex_string(std::string_view s) {
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        return std::all_of(s.begin() + 2, s.end(), is_hex);
+    }
+    return s.size() >= 8 && std::all_of(s.begin(), s.end(), is_hex) && std::any_of(s.begin(), s.end(), is_digit);
+}
+
+// 42, -1.5, 10.0.0.1, 12:30:00, 2024-01-31, optionally with a short unit such as 100ms
+std::size_t number_length(std::string_view s) {
+    std::size_t i = (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+    if (i >= s.size() || !is_digit(s[i])) return 0;
+    while (i < s.size() && (is_digit(s[i]) || s[i] == '.' || s[i] == ':' || s[i] == ',' || s[i] == '-' || s[i] == '_')) ++i;
+    std::size_t unit = 0;
+    while (i + unit < s.size() && unit < 3 && is_alpha(s[i + unit])) ++unit;
+    return i + unit == s.size() ? i : 0;
+}
+
+bool is_path(std::string_view s) {
+    if (s.size() > 1 && (s[0] == '/' || (s[0] == '~' && s[1] == '/'))) return true;
+    if (s.size() > 2 && s[0] == '.' && (s[1] == '/' || (s[1] == '.' && s[2] == '/'))) return true;
+    return s.find("://") != std::string_view::npos;
+}
+
+bool is_opening(char c) {
+    return c == '(' || c == '[' || c == '{' || c == '"' || c == '\'' || c == '<';
+}
+
+bool is_closing(char c) {
+    return c == ')' || c == ']' || c == '}' || c == '"' || c == '\'' || c == '>' || c == ','
+        || c == ';' || c == ':' || c == '.';
+}
+
+// Tokens with digits are too variable to branch the parse tree on
+std::uint64_t tree_key(const std::vector<std::string>& tokens) {
+    std::uint64_t key = static_cast<std::uint64_t>(tokens.size()) * 0x9e3779b97f4a7c15ULL;
+    for (std::size_t i = 0; i < std::min<std::size_t>(tokens.size(), 2); ++i) {
+        const std::string& token = tokens[i];
+        const bool variable = std::any_of(token.begin(), token.end(), is_digit) || token.find('<') != std::string::npos;
+        key = (key ^ hash_line(variable ? WILDCARD : std::string_view(token))) * 0x100000001b3ULL;
+    }
+    return key;
+}
+
+} // namespace
+
+TemplateMiner& templates() {
+    static TemplateMiner instance;
+    return instance;
+}
+
+TemplateMiner::TemplateMiner() : _top(10), _interval(0), _stop(false) {}
+
+TemplateMiner::~TemplateMiner() {
+    stop();
+}
+
+void TemplateMiner::start(std::size_t top, std::chrono::milliseconds interval) {
+    active = true;
+    _top = top;
+    _interval = interval;
+    if (interval.count() <= 0) return;
+    _thread = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_wake.wait_for(lock, _interval, [this]() { return _stop; })) {
+            lock.unlock();
+            const std::string text = report();
+            std::fputs(text.c_str(), stderr);
+            std::fflush(stderr);
+            lock.lock();
+        }
+    });
+}
+
+void TemplateMiner::stop() {
+    if (!active) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    if (_thread.joinable()) _thread.join();
+    const std::string text = report();
+    std::fputs(text.c_str(), stderr);
+    std::fflush(stderr);
+    active = false;
+}
+
+TemplateMiner::Shard& TemplateMiner::shard() {
+    // Gives the shard back for the next thread when this one exits
+    struct Handle {
+        TemplateMiner* miner = nullptr;
+        Shard* shard = nullptr;
+        ~Handle() {
+            if (shard == nullptr) return;
+            std::lock_guard<std::mutex> lock(miner->_mutex);
+            shard->taken = false;
+        }
+    };
+    thread_local Handle handle;
+    if (handle.miner == this) return *handle.shard;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto free = std::find_if(_shards.begin(), _shards.end(), [](const auto& s) { return !s->taken; });
+    if (free == _shards.end()) free = _shards.insert(_shards.end(), std::make_unique<Shard>());
+    (*free)->taken = true;
+    handle.miner = this;
+    handle.shard = free->get();
+    return *handle.shard;
+}
+
+void TemplateMiner::tokenize(std::string_view line, std::vector<std::string>& tokens) {
+    std::size_t count = 0;
+    std::size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) ++i;
+        const std::size_t start = i;
+        // One pass for the bounds, the first '=' and whether any mask can apply:
+        // every mask needs a digit or a slash, and most words have neither
+        std::size_t equals = std::string_view::npos;
+        bool candidate = false;
+        for (; i < line.size() && line[i] != ' ' && line[i] != '\t'; ++i) {
+            const char c = line[i];
+            candidate |= is_digit(c) || c == '/';
+            if (c == '=' && equals == std::string_view::npos) equals = i - start;
+        }
+        if (i == start) break;
+        const std::string_view token = line.substr(start, i - start);
+
+        // Mask the token's core: key=<core>, or the part inside brackets, quotes and trailing punctuation
+        std::size_t begin = equals == std::string_view::npos ? 0 : equals + 1;
+        while (begin < token.size() && is_opening(token[begin])) ++begin;
+        std::size_t end = token.size();
+        while (end > begin && is_closing(token[end - 1])) --end;
+        const std::string_view core = token.substr(begin, end - begin);
+        const char* mask = nullptr;
+        std::size_t masked = core.size();
+        if (!candidate) {
+            // Nothing to mask
+        } else if (is_uuid(core)) {
+            mask = "<UUID>";
+        } else if (is_hex_string(core)) {
+            mask = "<HEX>";
+        } else if (const std::size_t digits = number_length(core); digits > 0) {
+            mask = "<NUM>";
+            masked = digits;
+        } else if (is_path(core)) {
+            mask = "<PATH>";
+        }
+
+        if (count == tokens.size()) tokens.emplace_back();
+        std::string& out = tokens[count++];
+        if (mask == nullptr) {
+            out.assign(token.data(), token.size());
+        } else {
+            out.assign(token.data(), begin);
+            out.append(mask);
+            out.append(token.data() + begin + masked, token.size() - begin - masked);
+        }
+    }
+    tokens.resize(count);
+}
+
+void TemplateMiner::add(const std::string& level, std::string_view line) {
+    Shard& own = shard();
+    std::lock_guard<std::mutex> lock(own.mutex);
+    tokenize(line, own.tokens);
+    if (own.tokens.empty()) return;
+    // Runs of one level are the rule, skip the map for them
+    if (own.last_tree == nullptr || own.last_level != level) {
+        own.last_tree = &own.trees[level];
+        own.last_level = level;
+    }
+    add_tokens(*own.last_tree, own.tokens, 1);
+}
+
+// Joins count lines of tokens into tree, one line from add(), a whole template from report()
+void TemplateMiner::add_tokens(Tree& tree, const std::vector<std::string>& tokens, std::uint64_t count) {
+    tree.lines += count;
+    const std::uint64_t key = tree_key(tokens);
+    auto& leaf = tree.leaves[key];
+
+    auto best = tree.lru.end();
+    std::size_t best_same = 0;
+    for (const auto it : leaf) {
+        if (it->tokens.size() != tokens.size()) continue;  // a key collision
+        std::size_t same = 0;
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            if (it->tokens[i] == tokens[i] && it->tokens[i] != WILDCARD) ++same;
+        }
+        if (best == tree.lru.end() || same > best_same) {
+            best = it;
+            best_same = same;
+        }
+    }
+    if (best != tree.lru.end() && static_cast<double>(best_same) >= SIMILARITY * static_cast<double>(tokens.size())) {
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            if (best->tokens[i] != tokens[i]) best->tokens[i] = WILDCARD;
+        }
+        best->count += count;
+        tree.lru.splice(tree.lru.begin(), tree.lru, best);
+        return;
+    }
+
+    if (tree.lru.size() >= MAX_TEMPLATES) {
+        const auto oldest = std::prev(tree.lru.end());
+        auto& oldest_leaf = tree.leaves[oldest->leaf];
+        oldest_leaf.erase(std::find(oldest_leaf.begin(), oldest_leaf.end(), oldest));
+        if (oldest_leaf.empty() && oldest->leaf != key) tree.leaves.erase(oldest->leaf);
+        tree.evicted += oldest->count;
+        tree.lru.pop_back();
+    }
+    tree.lru.push_front(Template{tokens, count, key});
+    tree.leaves[key].push_back(tree.lru.begin());
+}
+
+std::string TemplateMiner::report() {
+    std::map<std::string, Tree> merged;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const auto& shard : _shards) {
+            std::lock_guard<std::mutex> shard_lock(shard->mutex);
+            // NOLINTBEGIN: unassignedVariable
+            for (const auto& [level, tree] : shard->trees) { // NOLINT
+                Tree& into = merged[level];
+                // Oldest first, so the merged tree keeps the shard's recency
+                for (auto it = tree.lru.rbegin(); it != tree.lru.rend(); ++it) add_tokens(into, it->tokens, it->count);
+                into.lines += tree.evicted;
+                into.evicted += tree.evicted;
+            }
+            // NOLINTEND
+        }
+    }
+
+    std::ostringstream out;
+    // NOLINTBEGIN: unassignedVariable
+    for (const auto& [level, tree] : merged) { // NOLINT
+        std::vector<const Template*> top;
+        for (const auto& t : tree.lru) top.push_back(&t);
+        const std::size_t n = std::min(_top, top.size());
+        std::partial_sort(top.begin(), top.begin() + static_cast<std::ptrdiff_t>(n), top.end(),
+                          [](const Template* a, const Template* b) { return a->count > b->count; });
+        out << "timbre: top " << n << " of " << tree.lru.size() << " templates for " << level << " ("
+            << tree.lines << " lines";
+        if (tree.evicted > 0) out << ", " << tree.evicted << " in evicted templates";
+        out << ")\n";
+        for (std::size_t i = 0; i < n; ++i) {
+            char share[16];
+            std::snprintf(share, sizeof(share), "%5.1f%%", 100.0 * static_cast<double>(top[i]->count)
+                          / static_cast<double>(tree.lines));
+            out << "  " << top[i]->count << "  " << share << " ";
+            for (const auto& token : top[i]->tokens) out << " " << token;
+            out << "\n";
+        }
+    }
+    // NOLINTEND
+    return out.str();
+}
+
+} // namespace timbre
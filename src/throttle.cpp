@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cstdio>
+#include "timbre/throttle.h"
+
+namespace timbre {
+
+RateLimiter::RateLimiter(const Throttle& policy)
+    : _policy(policy), _credit(1.0), _tokens(static_cast<double>(policy.max_lines_per_sec)),
+      _refilled(std::chrono::steady_clock::now()), _unreported(0), _reported(_refilled) {}
+
+void RateLimiter::set_policy(const Throttle& policy) {
+    _policy = policy;
+    _tokens = std::min(_tokens, static_cast<double>(policy.max_lines_per_sec));
+}
+
+bool RateLimiter::admit() {
+    if (_policy.sample_rate < 1.0) {
+        _credit += _policy.sample_rate;
+        if (_credit < 1.0) {
+            ++_unreported;
+            return false;
+        }
+        _credit -= 1.0;
+    }
+    if (_policy.max_lines_per_sec > 0) {
+        // NOTE: only throttled levels pay for reading the clock
+        const auto now = std::chrono::steady_clock::now();
+        const double rate = static_cast<double>(_policy.max_lines_per_sec);
+        _tokens = std::min(rate, _tokens + std::chrono::duration<double>(now - _refilled).count() * rate);
+        _refilled = now;
+        if (_tokens < 1.0) {
+            ++_unreported;
+            return false;
+        }
+        _tokens -= 1.0;
+    }
+    return true;
+}
+
+std::string RateLimiter::marker(const std::string& level, std::chrono::steady_clock::time_point now, bool force) {
+    if (_unreported == 0) {
+        _reported = now;  // the next marker covers the time since lines started being dropped
+        return {};
+    }
+    if (!force && now - _reported < MARKER_INTERVAL) return {};
+    char policy[96];
+    std::snprintf(policy, sizeof(policy), "sample_rate %g, max_lines_per_sec %llu", _policy.sample_rate,
+                  static_cast<unsigned long long>(_policy.max_lines_per_sec));
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(now - _reported).count();
+    std::string text = "timbre: dropped " + std::to_string(_unreported) + " " + level + " lines in the last "
+        + std::to_string(seconds) + "s (" + policy + ")";
+    _unreported = 0;
+    _reported = now;
+    return text;
+}
+
+} // namespace timbre
@@ -1,14 +1,13 @@
 #include <iostream>
-#include <fstream>
 #include <string>
-#include <filesystem>
-#include <system_error>
 #include <regex>
 #include <algorithm>
 #include <cctype>
 #include "CLI/CLI11.hpp"
 #include "timbre/log.h"
 #include "timbre/config.h"
+#include "timbre/stats.h"
+#include "timbre/templates.h"
 #include "timbre/timbre.h"
 #include "timbre/version.h"
 
@@ -32,67 +31,165 @@ void print_version() {
 }
 
 bool match(const std::string& line, const std::regex& pattern) {
+    return match(std::string_view(line), pattern);
+}
+
+bool match(std::string_view line, const std::regex& pattern) {
     try {
-        return std::regex_search(line, pattern);
+        return std::regex_search(line.begin(), line.end(), pattern);
     } catch (const std::regex_error& e) {
         log(LogLevel::ERROR, std::string("Regex error: ") + e.what());
         return false;
     }
 }
 
+namespace {
+
+int match_line(const Matcher& matcher, const LevelField& field, std::string_view line) {
+    std::string_view value;
+    if (field.enabled() && field.find(line, value)) {
+        int id = matcher.match(value);
+        if (const std::string_view level = default_level(value); id == Matcher::NO_MATCH && !level.empty()) {
+            id = matcher.match(level);
+        }
+        if (id != Matcher::NO_MATCH) return id;
+    }
+    return matcher.match(line);
+}
+
+void match_line(const Matcher& matcher, const LevelField& field, std::string_view line, std::vector<int>& ids) {
+    std::string_view value;
+    if (field.enabled() && field.find(line, value)) {
+        matcher.match_all(value, ids);
+        if (const std::string_view level = default_level(value); ids.empty() && !level.empty()) {
+            matcher.match_all(level, ids);
+        }
+        if (!ids.empty()) return;
+    }
+    matcher.match_all(line, ids);
+}
+
+// Whether to time this classification, one in SAMPLE_EVERY on each thread.
+// Counted on a counter of the thread's own, workers bumping a shared one
+// for every line would contend on it
+bool sample_classification() {
+    thread_local Counter& classified = stats().thread_classifications();
+    return (++classified).load() % Stats::SAMPLE_EVERY == 0;
+}
+
+} // namespace
+
+int classify_line(const Matcher& matcher, const LevelField& field, std::string_view line) {
+    if (!Stats::enabled() || !sample_classification()) return match_line(matcher, field, line);
+    const std::uint64_t start = Stats::now_ns();
+    const int id = match_line(matcher, field, line);
+    stats().classify_ns.record(Stats::now_ns() - start);
+    return id;
+}
+
+void classify_line(const Matcher& matcher, const LevelField& field, std::string_view line, std::vector<int>& ids) {
+    if (!Stats::enabled() || !sample_classification()) {
+        match_line(matcher, field, line, ids);
+        return;
+    }
+    const std::uint64_t start = Stats::now_ns();
+    match_line(matcher, field, line, ids);
+    stats().classify_ns.record(Stats::now_ns() - start);
+}
+
 void process_line(
     UserConfig& config, 
     const std::string& line, 
-    std::map<std::string, std::ofstream>& log_files,
+    SinkTable& log_files,
+    bool quiet) {
+    process_line(config, std::string_view(line), log_files, quiet);
+}
+
+void process_line(
+    UserConfig& config, 
+    std::string_view line, 
+    SinkTable& log_files,
     bool quiet) {
 
-    // Always write to stdout (tee behavior) unless quiet mode is enabled
-    if (!quiet) {
-        std::cout << line << '\n' << std::flush;
+    // Always write to stdout (tee behavior) unless quiet mode is enabled,
+    // or the line may yet be dropped by its level's throttle
+    const bool echo_after = !quiet && config.get_throttle_stdout();
+    if (!quiet && !echo_after) {
+        log_files.out().write_line(line);
     }
+    log_files.tick();
 
-    if (line.empty()) return;
-    
-    // NOLINTBEGIN: unassignedVariable
-    for (auto& [level_name, level_config] : config.get_log_levels()) { // NOLINT
-        if (match(line, level_config.pattern)) {
-            level_config.count++;  // Increment the count for matched level
-            auto file_it = log_files.find(level_name);
-            if (file_it != log_files.end() && file_it->second.is_open()) {
-                file_it->second << line << '\n';
-                if (!file_it->second.good()) {
-                    log(LogLevel::ERROR, "Failed to write to log file for level: " + level_name);
-                    return;
-                }
-            }
-            return;
-        }
+    if (Stats::enabled()) ++stats().lines_in;
+    bool routed = false;
+    bool kept = false;
+    const Multiline& multiline = config.get_multiline();
+    if (multiline.enabled()) {
+        const auto now = multiline.timeout > 0 ? std::chrono::steady_clock::now()
+                                               : std::chrono::steady_clock::time_point{};
+        route_grouped(config.get_matcher(), config.get_level_field(), multiline, multiline.continues(line), now, line, log_files, routed, kept);
+    } else {
+        classify_and_route(config.get_matcher(), config.get_level_field(), line, log_files, nullptr, routed, kept);
     }
-    // NOLINTEND
-}
-
-std::map<std::string, std::ofstream> open_log_files(UserConfig& config, bool append) {
-    std::map<std::string, std::ofstream> log_files;
-    
-    std::filesystem::create_directories(config.get_log_dir());
-    for (auto& [level_name, level_config] : config.get_log_levels()) {
-        std::string file_path = config.get_log_dir() + "/" + level_config.path;
-        auto mode = append ? std::ios::app : std::ios::trunc;
-        log_files[level_name].open(file_path, std::ios::out | mode);
-        if (!log_files[level_name].is_open()) {
-            log(LogLevel::ERROR, "Failed to open log file: " + file_path);
+    if (echo_after && (kept || !routed)) log_files.out().write_line(line);
+}
+
+void classify_and_route(const Matcher& matcher, const LevelField& field, std::string_view line, SinkTable& log_files,
+                        EventGrouper* event, bool& routed, bool& kept) {
+    if (line.empty()) {
+        // Nothing to classify
+    } else if (matcher.routing() == Routing::ALL) {
+        thread_local std::vector<int> ids;
+        classify_line(matcher, field, line, ids);
+        for (const int id : ids) {
+            const bool admitted = route_line(id, line, log_files);
+            if (event != nullptr) event->route(id, admitted);
+            kept |= admitted;
         }
+        routed = !ids.empty();
+    } else {
+        const int id = classify_line(matcher, field, line);
+        routed = id != Matcher::NO_MATCH;
+        kept = routed && route_line(id, line, log_files);
+        if (routed && event != nullptr) event->route(id, kept);
     }
-    
-    return log_files;
 }
 
-void close_log_files(std::map<std::string, std::ofstream>& log_files) {
-    for (auto& file_pair : log_files) {
-        if (file_pair.second.is_open()) {
-            file_pair.second.close();
+void route_grouped(const Matcher& matcher, const LevelField& field, const Multiline& multiline, bool continues,
+                   std::chrono::steady_clock::time_point now, std::string_view line, SinkTable& log_files,
+                   bool& routed, bool& kept) {
+    EventGrouper& event = log_files.event();
+    if (continues && event.join(multiline, now)) {
+        // Where the first line went, past the throttle that already let it through
+        for (const int id : event.levels()) {
+            log_files.level(id).count++;
+            log_files.write_line(id, line);
         }
+        routed = event.routed();
+        kept = !event.levels().empty();
+        return;
     }
+    event.start(now);
+    classify_and_route(matcher, field, line, log_files, &event, routed, kept);
+}
+
+bool route_line(int level, std::string_view line, SinkTable& log_files) {
+    // Mined before throttling, a storm's shape is what the report is for
+    if (TemplateMiner::enabled()) templates().add(log_files.level_name(level), line);
+    if (!log_files.admit(level)) return false;
+    log_files.level(level).count++;  // Increment the count for matched level
+    log_files.write_line(level, line);
+    return true;
+}
+
+SinkTable open_log_files(UserConfig& config, bool append) {
+    SinkTable log_files;
+    log_files.open(config, append);
+    log_files.set_flush_interval(std::chrono::milliseconds(config.get_flush_interval()));
+    return log_files;
+}
+
+void close_log_files(SinkTable& log_files) {
+    log_files.close();
 }
 
 }
@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "timbre/log.h"
+#include "timbre/trigram.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace timbre {
+
+namespace {
+
+// Sidecar layout: MAGIC, FORMAT_VERSION, sizeof(RunHeader), then each run's
+// header and payload in host byte order, like the .idx sidecar
+constexpr char MAGIC[8] = {'T', 'I', 'M', 'B', 'R', 'T', 'R', 'I'};
+constexpr std::uint32_t FORMAT_VERSION = 1;
+constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(std::uint32_t);
+constexpr std::uint32_t TRIGRAMS = 1 << 24;
+constexpr unsigned BLOCK_BITS = 6;  // a posting is trigram << BLOCK_BITS | block in its run
+
+struct RunHeader {
+    std::uint64_t first_block;
+    std::uint32_t block_count;
+    std::uint32_t trigram_count;
+    std::uint64_t payload_bytes;
+};
+
+static_assert(sizeof(RunHeader) == 24, "run headers are written as is");
+static_assert(TrigramIndexer::BLOCKS_PER_RUN <= (1u << BLOCK_BITS), "a run's blocks fit a 64 bit mask");
+
+unsigned char ascii_lower(unsigned char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
+void put_varint(std::string& out, std::uint64_t value) {
+    for (; value >= 0x80; value >>= 7) out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(std::string_view data, std::size_t& pos, std::uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; pos < data.size() && shift < 64; shift += 7) {
+        const auto byte = static_cast<unsigned char>(data[pos++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+bool seek_to(std::FILE* file, std::uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+} // namespace
+
+struct TrigramIndexer::File {
+    std::string path;  // FILE.tri, moved along by rename()
+    std::FILE* log = nullptr;
+    std::FILE* out = nullptr;
+    std::uint64_t position = 0;  // of the next read from log
+    std::uint64_t first_block = 0;  // of the run being built
+    std::uint32_t block_count = 0;
+    std::vector<std::uint32_t> postings;
+    bool failed = false;
+};
+
+TrigramIndexer::TrigramIndexer() : _stop(false) {}
+
+TrigramIndexer::~TrigramIndexer() {
+    stop();
+}
+
+std::shared_ptr<TrigramIndexer::File> TrigramIndexer::open(const std::string& log_path, std::uint64_t max_blocks,
+                                                           std::uint64_t& blocks) {
+    auto file = std::make_shared<File>();
+    file->path = log_path + ".tri";
+    {
+        // A file closed just before may still be finishing the same index
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [&]() {
+            return std::none_of(_active.begin(), _active.end(), [&](const File* f) { return f->path == file->path; });
+        });
+        _active.push_back(file.get());
+    }
+
+    TrigramIndex existing;
+    bool resume = existing.load(file->path) && existing.blocks() <= max_blocks;
+    std::error_code ec;
+    if (resume) std::filesystem::resize_file(file->path, existing.bytes(), ec);
+    resume = resume && !ec;
+    blocks = resume ? existing.blocks() : 0;
+    file->first_block = blocks;
+    file->out = std::fopen(file->path.c_str(), resume ? "ab" : "wb");
+    file->log = std::fopen(log_path.c_str(), "rb");
+    const std::uint32_t header[2] = {FORMAT_VERSION, static_cast<std::uint32_t>(sizeof(RunHeader))};
+    if (file->out == nullptr || file->log == nullptr
+        || (!resume && (std::fwrite(MAGIC, sizeof(MAGIC), 1, file->out) != 1
+                        || std::fwrite(header, sizeof(header), 1, file->out) != 1
+                        || std::fflush(file->out) != 0))) {
+        log(LogLevel::WARNING, "Failed to create trigram index " + file->path + ", not indexing it");
+        close_file(*file);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _active.erase(std::find(_active.begin(), _active.end(), file.get()));
+        }
+        _idle.notify_all();
+        return nullptr;
+    }
+    if (resume) log(LogLevel::DEBUG, "Resuming trigram index " + file->path + " at block " + std::to_string(blocks));
+    return file;
+}
+
+void TrigramIndexer::add(const std::shared_ptr<File>& file, std::uint64_t block, std::uint64_t begin,
+                         std::uint64_t end) {
+    submit(Job{file, block, begin, end, false});
+}
+
+void TrigramIndexer::finish(const std::shared_ptr<File>& file) {
+    submit(Job{file, 0, 0, 0, true});
+}
+
+void TrigramIndexer::rename(const std::shared_ptr<File>& file, const std::string& segment) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const std::string target = segment + ".tri";
+    std::error_code ec;
+    std::filesystem::rename(file->path, target, ec);
+    if (ec) {
+        log(LogLevel::WARNING, "Failed to move trigram index " + file->path + " along with its log: " + ec.message());
+        return;
+    }
+    file->path = target;
+}
+
+void TrigramIndexer::submit(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(job));
+        if (!_thread.joinable()) {
+            _stop = false;
+            _thread = std::thread([this]() { run(); });
+        }
+    }
+    _wake.notify_one();
+}
+
+void TrigramIndexer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_thread.joinable()) return;
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+void TrigramIndexer::run() {
+#ifdef __linux__
+    // Per thread on Linux: reading back what was written yields to the classification threads
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 10);
+#endif
+    if (_seen.empty()) _seen.assign(TRIGRAMS / 64, 0);
+    _buffer.resize(READ_SIZE);
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+        if (_jobs.empty()) return;  // stopping, and nothing left to do
+        const Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+        if (!job.finish) {
+            index_block(*job.file, job.block, job.begin, job.end);
+            lock.lock();
+            continue;
+        }
+        close_file(*job.file);
+        lock.lock();
+        _active.erase(std::find(_active.begin(), _active.end(), job.file.get()));
+        _idle.notify_all();
+    }
+}
+
+void TrigramIndexer::index_block(File& file, std::uint64_t block, std::uint64_t begin, std::uint64_t end) {
+    if (file.failed) return;
+    if (block != file.first_block + file.block_count || (file.position != begin && !seek_to(file.log, begin))) {
+        log(LogLevel::WARNING, "Lost track of " + file.path + " at block " + std::to_string(block)
+            + ", no longer indexing it");
+        file.failed = true;
+        return;
+    }
+    file.position = begin;
+
+    // Trigrams never span lines, so blocks are indexed independently
+    std::uint32_t key = 0;
+    unsigned have = 0;
+    while (file.position < end) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(end - file.position, READ_SIZE));
+        const std::size_t got = std::fread(_buffer.data(), 1, want, file.log);
+        file.position += got;
+        if (got != want) {
+            log(LogLevel::WARNING, "Failed to read back " + file.path + " at byte " + std::to_string(file.position)
+                + ", no longer indexing it");
+            file.failed = true;
+            break;
+        }
+        for (std::size_t i = 0; i < got; ++i) {
+            const auto c = static_cast<unsigned char>(_buffer[i]);
+            if (c == '\n') {
+                have = 0;
+                continue;
+            }
+            key = ((key << 8) | ascii_lower(c)) & (TRIGRAMS - 1);
+            if (++have < 3) continue;
+            std::uint64_t& word = _seen[key / 64];
+            const std::uint64_t bit = std::uint64_t{1} << (key % 64);
+            if ((word & bit) == 0) {
+                word |= bit;
+                _found.push_back(key);
+            }
+        }
+    }
+
+    const auto slot = static_cast<std::uint32_t>(block - file.first_block);
+    for (const std::uint32_t trigram : _found) {
+        _seen[trigram / 64] = 0;
+        file.postings.push_back(trigram << BLOCK_BITS | slot);
+    }
+    _found.clear();
+    if (file.failed) return;
+    ++file.block_count;
+    if (file.block_count == BLOCKS_PER_RUN || file.postings.size() >= MAX_RUN_POSTINGS) write_run(file);
+}
+
+bool TrigramIndexer::write_run(File& file) {
+    if (file.block_count == 0) return true;
+    std::sort(file.postings.begin(), file.postings.end());
+    std::string payload;
+    RunHeader header{file.first_block, file.block_count, 0, 0};
+    std::uint32_t previous = 0;
+    for (std::size_t i = 0; i < file.postings.size();) {
+        const std::uint32_t trigram = file.postings[i] >> BLOCK_BITS;
+        std::uint64_t mask = 0;
+        for (; i < file.postings.size() && file.postings[i] >> BLOCK_BITS == trigram; ++i) {
+            mask |= std::uint64_t{1} << (file.postings[i] & ((1u << BLOCK_BITS) - 1));
+        }
+        put_varint(payload, trigram - previous);
+        put_varint(payload, mask);
+        previous = trigram;
+        ++header.trigram_count;
+    }
+    header.payload_bytes = payload.size();
+    file.first_block += file.block_count;
+    file.block_count = 0;
+    file.postings.clear();
+    if (std::fwrite(&header, sizeof(header), 1, file.out) != 1
+        || std::fwrite(payload.data(), 1, payload.size(), file.out) != payload.size()
+        || std::fflush(file.out) != 0) {
+        log(LogLevel::WARNING, "Failed to write trigram index " + file.path + ", no longer indexing it");
+        file.failed = true;
+        return false;
+    }
+    return true;
+}
+
+void TrigramIndexer::close_file(File& file) {
+    if (file.out != nullptr && !file.failed) write_run(file);
+    if (file.out != nullptr) std::fclose(file.out);
+    if (file.log != nullptr) std::fclose(file.log);
+    file.out = nullptr;
+    file.log = nullptr;
+    file.postings = {};
+}
+
+bool TrigramIndex::load(const std::string& tri_path) {
+    _runs.clear();
+    _bytes = 0;
+    std::ifstream in(tri_path, std::ios::binary);
+    if (!in) return false;
+    _data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    std::uint32_t header[2] = {0, 0};
+    if (_data.size() < HEADER_SIZE || std::memcmp(_data.data(), MAGIC, sizeof(MAGIC)) != 0) return false;
+    std::memcpy(header, _data.data() + sizeof(MAGIC), sizeof(header));
+    if (header[0] != FORMAT_VERSION || header[1] != sizeof(RunHeader)) return false;
+
+    // A crash can leave a torn last run
+    std::size_t pos = HEADER_SIZE;
+    while (_data.size() - pos >= sizeof(RunHeader)) {
+        RunHeader run{};
+        std::memcpy(&run, _data.data() + pos, sizeof(run));
+        if (run.first_block != blocks() || run.block_count == 0 || run.block_count > TrigramIndexer::BLOCKS_PER_RUN
+            || run.payload_bytes > _data.size() - pos - sizeof(run)) {
+            break;
+        }
+        pos += sizeof(run);
+        _runs.push_back(Run{run.first_block, run.block_count, run.trigram_count, pos,
+                            static_cast<std::size_t>(run.payload_bytes)});
+        pos += static_cast<std::size_t>(run.payload_bytes);
+    }
+    _bytes = _runs.empty() ? HEADER_SIZE : pos;
+    return true;
+}
+
+void TrigramIndex::filter(const std::vector<std::string>& literals, std::vector<bool>& candidates) const {
+    if (literals.empty()) return;
+    std::vector<std::vector<std::uint32_t>> needs;
+    std::vector<std::uint32_t> wanted;
+    for (const auto& literal : literals) {
+        if (literal.size() < 3) return;
+        needs.emplace_back();
+        for (std::size_t i = 0; i + 3 <= literal.size(); ++i) {
+            const auto trigram = static_cast<std::uint32_t>(ascii_lower(static_cast<unsigned char>(literal[i])) << 16
+                | ascii_lower(static_cast<unsigned char>(literal[i + 1])) << 8
+                | ascii_lower(static_cast<unsigned char>(literal[i + 2])));
+            needs.back().push_back(trigram);
+            wanted.push_back(trigram);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    const auto position = [&wanted](std::uint32_t trigram) {
+        return static_cast<std::size_t>(std::lower_bound(wanted.begin(), wanted.end(), trigram) - wanted.begin());
+    };
+
+    std::vector<std::uint64_t> masks(wanted.size());
+    for (const auto& run : _runs) {
+        // Walk the run's sorted trigrams alongside the wanted ones
+        std::fill(masks.begin(), masks.end(), 0);
+        const std::string_view postings(_data.data() + run.offset, run.size);
+        std::size_t pos = 0;
+        std::size_t at = 0;
+        std::uint64_t trigram = 0;
+        bool intact = true;
+        for (std::uint32_t n = 0; n < run.trigram_count && at < wanted.size(); ++n) {
+            std::uint64_t delta = 0;
+            std::uint64_t mask = 0;
+            if (!get_varint(postings, pos, delta) || !get_varint(postings, pos, mask)) {
+                intact = false;
+                break;
+            }
+            trigram += delta;
+            while (at < wanted.size() && wanted[at] < trigram) ++at;
+            if (at < wanted.size() && wanted[at] == trigram) masks[at] = mask;
+        }
+        if (!intact) continue;  // leave the run's blocks to the scan
+
+        std::uint64_t hits = 0;
+        for (const auto& trigrams : needs) {
+            std::uint64_t all = ~std::uint64_t{0};
+            for (const std::uint32_t t : trigrams) all &= masks[position(t)];
+            hits |= all;
+        }
+        for (std::uint32_t b = 0; b < run.block_count && run.first_block + b < candidates.size(); ++b) {
+            if ((hits >> b & 1) == 0) candidates[static_cast<std::size_t>(run.first_block + b)] = false;
+        }
+    }
+}
+
+} // namespace timbre
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include "timbre/uring.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define TIMBRE_HAVE_URING 1
+#endif
+#endif
+
+namespace timbre {
+
+#ifdef TIMBRE_HAVE_URING
+
+static int uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// IORING_OP_WRITE needs 5.6, older kernels only have the vectored variant
+static bool has_write_op(int fd) {
+    constexpr unsigned OPS = 256;
+    std::vector<char> storage(sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, OPS) < 0) return false;
+    if (probe->last_op < IORING_OP_WRITE) return false;
+    return (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+}
+
+#endif
+
+IoRing::IoRing()
+    : _fd(-1), _sq_ring(nullptr), _cq_ring(nullptr), _sqes(nullptr),
+      _sq_ring_size(0), _cq_ring_size(0), _sqes_size(0),
+      _sq_head(nullptr), _sq_tail(nullptr), _sq_mask(nullptr), _sq_array(nullptr),
+      _cq_head(nullptr), _cq_tail(nullptr), _cq_mask(nullptr), _cqes(nullptr),
+      _sq_entries(0), _cq_entries(0), _queued(0), _in_flight(0) {}
+
+IoRing::~IoRing() {
+    release();
+}
+
+bool IoRing::supported() {
+#ifdef TIMBRE_HAVE_URING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IoRing::init(unsigned entries) {
+    release();
+#ifdef TIMBRE_HAVE_URING
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    _fd = uring_setup(entries, &params);
+    if (_fd < 0) return false;
+    if (!has_write_op(_fd)) {
+        release();
+        errno = ENOSYS;
+        return false;
+    }
+
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+
+    _sq_ring = ::mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                      static_cast<off_t>(IORING_OFF_SQ_RING));
+    if (_sq_ring == MAP_FAILED) {
+        _sq_ring = nullptr;
+        release();
+        return false;
+    }
+    if (single_mmap) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = ::mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                          static_cast<off_t>(IORING_OFF_CQ_RING));
+        if (_cq_ring == MAP_FAILED) {
+            _cq_ring = nullptr;
+            release();
+            return false;
+        }
+    }
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                   static_cast<off_t>(IORING_OFF_SQES));
+    if (_sqes == MAP_FAILED) {
+        _sqes = nullptr;
+        release();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(_sq_ring);
+    char* cq = static_cast<char*>(_cq_ring);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = cq + params.cq_off.cqes;
+    _sq_entries = params.sq_entries;
+    _cq_entries = params.cq_entries;
+    return true;
+#else
+    (void)entries;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+void IoRing::release() {
+#ifdef TIMBRE_HAVE_URING
+    if (_sqes != nullptr) ::munmap(_sqes, _sqes_size);
+    if (_cq_ring != nullptr && _cq_ring != _sq_ring) ::munmap(_cq_ring, _cq_ring_size);
+    if (_sq_ring != nullptr) ::munmap(_sq_ring, _sq_ring_size);
+    if (_fd >= 0) ::close(_fd);
+#endif
+    _fd = -1;
+    _sq_ring = _cq_ring = _sqes = _cqes = nullptr;
+    _queued = 0;
+    _in_flight = 0;
+}
+
+bool IoRing::write(int fd, const char* data, std::size_t len, std::uint64_t offset, std::uint64_t tag) {
+#ifdef TIMBRE_HAVE_URING
+    // Never have more writes outstanding than the completion queue can hold
+    if (_fd < 0 || _in_flight >= _cq_entries) return false;
+    const unsigned tail = *_sq_tail;
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) return false;
+
+    const unsigned index = tail & *_sq_mask;
+    auto* sqe = static_cast<io_uring_sqe*>(_sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<std::uint64_t>(data);
+    sqe->len = static_cast<std::uint32_t>(len);
+    sqe->user_data = tag;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++_queued;
+    ++_in_flight;
+    return true;
+#else
+    (void)fd, (void)data, (void)len, (void)offset, (void)tag;
+    return false;
+#endif
+}
+
+bool IoRing::submit(unsigned wait_for) {
+#ifdef TIMBRE_HAVE_URING
+    if (_fd < 0) return false;
+    if (wait_for > _in_flight) wait_for = static_cast<unsigned>(_in_flight);
+    if (_queued == 0 && wait_for == 0) return true;
+    for (;;) {
+        const int n = uring_enter(_fd, _queued, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        _queued -= static_cast<unsigned>(n);
+        return true;
+    }
+#else
+    (void)wait_for;
+    return false;
+#endif
+}
+
+const std::vector<IoRing::Completion>& IoRing::reap() {
+    _completions.clear();
+#ifdef TIMBRE_HAVE_URING
+    if (_fd < 0) return _completions;
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const auto& cqe = static_cast<const io_uring_cqe*>(_cqes)[head & *_cq_mask];
+        _completions.push_back(Completion{cqe.user_data, cqe.res});
+        ++head;
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    _in_flight -= _completions.size();
+#endif
+    return _completions;
+}
+
+} // namespace timbre
@@ -0,0 +1,282 @@
+// Test entry points that drive the C++ code itself, declared in interface.h
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "interface.h"
+#include "timbre/cache.h"
+#include "timbre/compress.h"
+#include "timbre/config.h"
+#include "timbre/index.h"
+#include "timbre/matcher.h"
+#include "timbre/pipeline.h"
+#include "timbre/query.h"
+#include "timbre/reader.h"
+#include "timbre/sink.h"
+#include "timbre/timbre.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define close _close
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Runs body with stdout sent to out_path, returning what body returns
+template <typename Body>
+int to_file(const char* out_path, Body body) {
+    std::FILE* out = std::fopen(out_path, "wb");
+    if (out == nullptr) return -1;
+    std::fflush(stdout);
+    const int saved = dup(1);
+    dup2(fileno(out), 1);
+    const int result = body();
+    std::fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    std::fclose(out);
+    return result;
+}
+
+// Calls fn with each newline-separated line of input
+template <typename Fn>
+void each_line(const char* input, int input_len, Fn fn) {
+    const std::string_view text(input, static_cast<std::size_t>(input_len));
+    for (std::size_t pos = 0; pos < text.size();) {
+        const std::size_t nl = std::min(text.find('\n', pos), text.size());
+        fn(text.substr(pos, nl - pos));
+        pos = nl + 1;
+    }
+}
+
+// Routes each line of input through config into log_dir, as timbre_run() does
+int route(timbre::UserConfig& config, const char* log_dir, const char* input, int input_len) {
+    config.set_log_dir(log_dir);
+    timbre::SinkTable log_files = timbre::open_log_files(config, false);
+    if (log_files.empty()) return 0;
+    each_line(input, input_len, [&](std::string_view line) { timbre::process_line(config, line, log_files, true); });
+    timbre::close_log_files(log_files);
+    return 1;
+}
+
+} // namespace
+
+int timbre_dfa_agrees(const char* pattern, const char* text, int text_len) {
+    std::map<std::string, timbre::UserLevel> levels;
+    timbre::UserLevel& level = levels["test"];
+    level.expr = pattern;
+    level.pattern = timbre::_re_compile(level.expr);
+    const timbre::Matcher matcher(levels);
+    if (matcher.fallback_count() > 0) return -1;
+    const std::string_view line(text, static_cast<std::size_t>(text_len));
+    const bool dfa = matcher.match(line) != timbre::Matcher::NO_MATCH;
+    return dfa == timbre::match(line, level.pattern) ? 1 : 0;
+}
+
+int timbre_read_lines(const char* input_path, unsigned block_size, const char* out_path) {
+    std::FILE* in = std::fopen(input_path, "rb");
+    if (in == nullptr) return -1;
+    std::FILE* out = std::fopen(out_path, "wb");
+    if (out == nullptr) {
+        std::fclose(in);
+        return -1;
+    }
+    int count = 0;
+    {
+        timbre::LineReader reader(fileno(in), block_size);
+        std::string_view line;
+        while (reader.next(line)) {
+            std::fwrite(line.data(), 1, line.size(), out);
+            std::fputc('\n', out);
+            ++count;
+        }
+    }
+    std::fclose(out);
+    std::fclose(in);
+    return count;
+}
+
+int timbre_sink_flushes(const char* path, unsigned interval_ms, unsigned long long sizes[4]) {
+    const auto on_disk = [path]() {
+        std::error_code ec;
+        const std::uintmax_t size = std::filesystem::file_size(path, ec);
+        return ec ? 0ULL : static_cast<unsigned long long>(size);
+    };
+    const std::chrono::milliseconds interval(interval_ms);
+    timbre::Sink sink;
+    if (!sink.open(path, false)) return 0;
+    const auto start = std::chrono::steady_clock::now();
+    sink.write_line("first");
+    sizes[0] = on_disk();
+    sink.flush_if_due(start, interval);
+    sizes[1] = on_disk();
+    sink.flush_if_due(start + interval, interval);
+    sizes[2] = on_disk();
+    sink.write_line("second");
+    sink.close();
+    sizes[3] = on_disk();
+    return 1;
+}
+
+int timbre_codec_available(const char* name) {
+    timbre::Codec codec = timbre::Codec::NONE;
+    return timbre::parse_codec(name, codec) && timbre::codec_available(codec) ? 1 : 0;
+}
+
+int timbre_required_literals(const char* pattern, char* out, int out_len) {
+    std::vector<std::string> literals = timbre::required_literals(pattern);
+    std::sort(literals.begin(), literals.end());
+    std::string joined;
+    for (const auto& literal : literals) joined += (joined.empty() ? "" : ",") + literal;
+    if (joined.size() >= static_cast<std::size_t>(out_len)) return -1;
+    std::copy(joined.begin(), joined.end(), out);
+    out[joined.size()] = '\0';
+    return static_cast<int>(literals.size());
+}
+
+int timbre_first_match_agrees(const char* config_path, const char* text, int text_len) {
+    timbre::UserConfig config;
+    if (!config.load(config_path)) return -1;
+    const timbre::Matcher& matcher = config.get_matcher();
+    const std::string_view line(text, static_cast<std::size_t>(text_len));
+    // Level ids run in priority order, the first whose regex matches wins
+    int expected = timbre::Matcher::NO_MATCH;
+    for (std::size_t id = 0; id < matcher.size() && expected == timbre::Matcher::NO_MATCH; ++id) {
+        const timbre::UserLevel& level = config.get_log_levels().at(matcher.level_name(static_cast<int>(id)));
+        if (timbre::match(line, level.pattern)) expected = static_cast<int>(id);
+    }
+    return matcher.match(line) == expected ? 1 : 0;
+}
+
+int timbre_compress_file(const char* src, const char* dst, const char* codec_name) {
+    timbre::Codec codec = timbre::Codec::NONE;
+    if (!timbre::parse_codec(codec_name, codec) || !timbre::codec_available(codec)) return 0;
+    return timbre::compress_file(src, dst, codec) ? 1 : 0;
+}
+
+int timbre_level_rotation(const char* config_path, const char* level, unsigned long long* max_size,
+                          unsigned long long* max_age) {
+    timbre::UserConfig config;
+    if (!config.load(config_path)) return 0;
+    const auto& levels = config.get_log_levels();
+    const auto it = levels.find(level);
+    if (it == levels.end()) return 0;
+    *max_size = it->second.rotation.max_size;
+    *max_age = it->second.rotation.max_age;
+    return 1;
+}
+
+int timbre_run(const char* config_path, const char* log_dir, const char* input, int input_len) {
+    timbre::UserConfig config;
+    if (!config.load(config_path)) return 0;
+    return route(config, log_dir, input, input_len);
+}
+
+int timbre_run_rebind(const char* config_path, const char* next_path, const char* log_dir, const char* input,
+                      int input_len, int switch_at, int* kept_open) {
+    timbre::UserConfig config;
+    auto next = std::make_shared<timbre::UserConfig>();
+    if (!config.load(config_path) || !next->load(next_path)) return 0;
+    config.set_log_dir(log_dir);
+    next->set_log_dir(log_dir);
+    timbre::SinkTable log_files = timbre::open_log_files(config, false);
+    if (log_files.empty()) return 0;
+
+    timbre::UserConfig* rules = &config;
+    std::set<const timbre::Sink*> before;
+    int lines = 0;
+    each_line(input, input_len, [&](std::string_view line) {
+        if (lines++ == switch_at) {
+            for (const auto& file : log_files.files()) before.insert(file.get());
+            rules = next.get();
+            log_files.rebind(next);
+            // Sinks carried over are the same objects; the ones dropped are gone, never reused
+            *kept_open = 0;
+            for (const auto& file : log_files.files()) {
+                if (before.count(file.get()) > 0 && file->is_open()) ++*kept_open;
+            }
+        }
+        timbre::process_line(*rules, line, log_files, true);
+    });
+    timbre::close_log_files(log_files);
+    return 1;
+}
+
+int timbre_cache_load(const char* config_path, const char* cache_dir) {
+    timbre::UserConfig config;
+    return timbre::ConfigCache(cache_dir).load(config_path, config) ? 1 : 0;
+}
+
+int timbre_run_cached(const char* config_path, const char* cache_dir, const char* log_dir, const char* input,
+                      int input_len) {
+    timbre::UserConfig config;
+    if (!timbre::ConfigCache(cache_dir).load_or_compile(config_path, config)) return 0;
+    return route(config, log_dir, input, input_len);
+}
+
+int timbre_run_file(const char* config_path, const char* log_dir, const char* input_path, int threads,
+                    int mapped, const char* out_path) {
+    timbre::UserConfig config;
+    if (!config.load(config_path)) return -1;
+    config.set_log_dir(log_dir);
+    const auto workers = static_cast<std::size_t>(threads);
+    const bool quiet = out_path == nullptr;
+    const auto body = [&]() {
+        timbre::SinkTable log_files = timbre::open_log_files(config, false);
+        if (log_files.empty()) return -1;
+        std::size_t lines = 0;
+        if (mapped != 0) {
+            timbre::MappedFile file;
+            if (!file.open(input_path)) return -1;
+            lines = timbre::run_mapped(config, file, log_files, workers, quiet);
+        } else {
+            std::FILE* in = std::fopen(input_path, "rb");
+            if (in == nullptr) return -1;
+            {
+                // As stdin is read, compressed input included
+                timbre::LineReader reader(fileno(in));
+                reader.detect_compression();
+                if (workers > 1) {
+                    lines = timbre::run_pipeline(config, reader, log_files, workers, quiet);
+                } else {
+                    std::string_view line;
+                    for (; reader.next(line); ++lines) timbre::process_line(config, line, log_files, quiet);
+                }
+            }
+            std::fclose(in);
+        }
+        timbre::close_log_files(log_files);
+        return static_cast<int>(lines);
+    };
+    return quiet ? body() : to_file(out_path, body);
+}
+
+int timbre_seek(const char* path, unsigned long long line, const char* time, unsigned long long count,
+                const char* out_path) {
+    return to_file(out_path, [&]() { return timbre::seek_log(path, line, time, count); });
+}
+
+int timbre_query(const char* config_path, const char* log_dir, const char* pattern, const char* since,
+                 const char* until, const char* out_path) {
+    timbre::UserConfig config;
+    if (!config.load(config_path)) return 2;
+    config.set_log_dir(log_dir);
+    timbre::Query query;
+    query.pattern = pattern;
+    query.since = since;
+    query.until = until;
+    query.threads = 2;
+    std::vector<std::string> files;
+    if (!timbre::query_files(config, {}, files)) return 2;
+    return to_file(out_path, [&]() { return timbre::run_query(query, files); });
+}
@@ -34,6 +34,49 @@ void timbre_destroy_memory_output(timbre_output_buffer_t* buffer);
 void timbre_process_line(timbre_config_t* config, const char* line, timbre_output_buffer_t* output, int quiet);
 int timbre_output_contains(timbre_output_buffer_t* buffer, const char* level, const char* content);
 
+// Functions driving the C++ code itself (bridge.cpp)
+// 1 if the DFA and std::regex agree on whether pattern matches text, 0 if not, -1 if pattern isn't in the DFA
+int timbre_dfa_agrees(const char* pattern, const char* text, int text_len);
+// Read input_path with a LineReader of block_size bytes, writing each line and a newline to out_path;
+// the number of lines, -1 if a file can't be opened
+int timbre_read_lines(const char* input_path, unsigned block_size, const char* out_path);
+// Size of the file a Sink writes at path after a line, after flushing at once and after
+// interval_ms with the given flush interval, and after a second line and close(); 1 on success
+int timbre_sink_flushes(const char* path, unsigned interval_ms, unsigned long long sizes[4]);
+// 1 if this build can write the codec named, "gzip" or "zstd"
+int timbre_codec_available(const char* name);
+// The literals the prefilter requires of pattern, sorted and comma separated into out; their number,
+// -1 if out is too small
+int timbre_required_literals(const char* pattern, char* out, int out_len);
+// 1 if the matcher for the config at config_path picks the same level for text as trying each level's
+// std::regex in priority order, 0 if not, -1 if there is no such config
+int timbre_first_match_agrees(const char* config_path, const char* text, int text_len);
+// Compress the file src into dst with the codec named, 1 on success
+int timbre_compress_file(const char* src, const char* dst, const char* codec_name);
+// Rotation limits of a level as loaded from config_path, 0 if there is no such config or level
+int timbre_level_rotation(const char* config_path, const char* level, unsigned long long* max_size,
+                          unsigned long long* max_age);
+// Route newline-separated input with the config at config_path into level files under log_dir, 1 on success
+int timbre_run(const char* config_path, const char* log_dir, const char* input, int input_len);
+// timbre_run() with the config at config_path, switched with SinkTable::rebind() to the one at
+// next_path before line switch_at; kept_open is the number of files left open across the switch
+int timbre_run_rebind(const char* config_path, const char* next_path, const char* log_dir, const char* input,
+                      int input_len, int switch_at, int* kept_open);
+// 1 if the config cache in cache_dir holds a valid entry for the file at config_path
+int timbre_cache_load(const char* config_path, const char* cache_dir);
+// timbre_run() with the config loaded through the cache in cache_dir, compiled and stored on a miss
+int timbre_run_cached(const char* config_path, const char* cache_dir, const char* log_dir, const char* input,
+                      int input_len);
+// Route the file at input_path as timbre would its stdin, or with mapped set as --input, on threads
+// threads; stdout goes to out_path, or nowhere if it is null. The number of lines, -1 on errors
+int timbre_run_file(const char* config_path, const char* log_dir, const char* input_path, int threads,
+                    int mapped, const char* out_path);
+// `timbre seek` and `timbre query` with their output written to out_path, returning their exit codes
+int timbre_seek(const char* path, unsigned long long line, const char* time, unsigned long long count,
+                const char* out_path);
+int timbre_query(const char* config_path, const char* log_dir, const char* pattern, const char* since,
+                 const char* until, const char* out_path);
+
 #ifdef __cplusplus
 }
 #endif
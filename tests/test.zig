@@ -102,6 +102,808 @@ test "configuration loading" {
     try testing.expect(timbre.timbre_levels_contains(levels, "warning") == 1);
 }
 
+test "line reader across blocks" {
+    const in_file = "test_reader.in";
+    const out_file = "test_reader.out";
+    defer fs.cwd().deleteFile(in_file) catch {};
+    defer fs.cwd().deleteFile(out_file) catch {};
+
+    // With 64 byte blocks: short lines, lines that straddle blocks, a line
+    // four blocks long, an empty line and a last line without a newline
+    const long = "x" ** 256;
+    const input = "one\ntwo\n" ++ "a" ** 60 ++ "\n" ++ "b" ** 70 ++ "\n" ++ long ++ "\n\nlast";
+    try writeFile(in_file, input);
+    try testing.expectEqual(@as(c_int, 7), timbre.timbre_read_lines(in_file, 64, out_file));
+    try expectFile(out_file, input ++ "\n");
+}
+
+test "sink flushes on its interval and on close" {
+    const path = "test_sink.log";
+    defer fs.cwd().deleteFile(path) catch {};
+
+    var sizes: [4]c_ulonglong = undefined;
+    try testing.expect(timbre.timbre_sink_flushes(path, 200, &sizes) == 1);
+    // Buffered until the interval has passed, the rest goes out on close
+    try testing.expectEqual(@as(c_ulonglong, 0), sizes[0]);
+    try testing.expectEqual(@as(c_ulonglong, 0), sizes[1]);
+    try testing.expectEqual(@as(c_ulonglong, 6), sizes[2]);
+    try testing.expectEqual(@as(c_ulonglong, 13), sizes[3]);
+    try expectFile(path, "first\nsecond\n");
+}
+
+test "dfa agrees with std::regex" {
+    const patterns = [_][:0]const u8{
+        "error|exception|fail",
+        "warn(ing)?",
+        "a.b",
+        "^start",
+        "end$",
+        "x(ab|cd)*y",
+        "[^a-z]+",
+        "colou?r",
+        "[0-9]{2}-[a-z]+",
+        "(foo|bar)baz?",
+        "^$",
+    };
+    // '.' doesn't match NUL, as with std::regex
+    try testing.expect(timbre.timbre_dfa_agrees("a.b", "a\x00b", 3) == 1);
+
+    // Lines over a small alphabet the patterns care about, NUL included
+    const alphabet = "abcdxyrERoOf019-. \x00";
+    var seed: u32 = 2463534242;
+    var line: [24]u8 = undefined;
+    for (patterns) |pattern| {
+        var n: usize = 0;
+        while (n < 2000) : (n += 1) {
+            seed = seed *% 1103515245 +% 12345;
+            const len = (seed >> 16) % line.len;
+            for (line[0..len]) |*c| {
+                seed = seed *% 1103515245 +% 12345;
+                c.* = alphabet[(seed >> 16) % alphabet.len];
+            }
+            try testing.expect(timbre.timbre_dfa_agrees(pattern.ptr, &line, @intCast(len)) == 1);
+        }
+    }
+}
+
+test "prefilter agrees with the matcher" {
+    var literals: [128]u8 = undefined;
+    try testing.expectEqual(@as(c_int, 3), timbre.timbre_required_literals("error|exception|fail(ed|ure)?", &literals, literals.len));
+    try testing.expectEqualStrings("error,exception,fail", std.mem.sliceTo(&literals, 0));
+    try testing.expectEqual(@as(c_int, 2), timbre.timbre_required_literals("time ?out", &literals, literals.len));
+    try testing.expectEqualStrings("time out,timeout", std.mem.sliceTo(&literals, 0));
+    // Nothing every match contains, the level is always a candidate
+    try testing.expectEqual(@as(c_int, 0), timbre.timbre_required_literals("[0-9]+", &literals, literals.len));
+
+    const tmp_file = "test_prefilter.toml";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\error = "error|exception|fail(ed|ure)?"
+        \\warn = "warn(ing)?"
+        \\timeout = { pattern = "time ?out", priority = 5 }
+        \\reset = "(conn|sock)et? reset"
+        \\digits = "[0-9]{4}"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+
+    // Lines made of the literals, pieces of them and their case variants, so
+    // the prefilter both hits and misses, and hits where the DFA then fails
+    const words = [_][]const u8{
+        "err",  "error",   "ERROR",    "exce", "exception",    "ExCePtIoN",    "fail",  "failure", "warn", "WARNING", "time",
+        "tim",  "timeout", "time out", "conn", "connet reset", "socket reset", "reset", "12",      "2026", " ",       "x",
+    };
+    var seed: u32 = 1;
+    var line: [256]u8 = undefined;
+    var n: usize = 0;
+    while (n < 2000) : (n += 1) {
+        var len: usize = 0;
+        seed = seed *% 1103515245 +% 12345;
+        var k = (seed >> 16) % 5;
+        while (k > 0) : (k -= 1) {
+            seed = seed *% 1103515245 +% 12345;
+            const word = words[(seed >> 16) % words.len];
+            @memcpy(line[len..][0..word.len], word);
+            len += word.len;
+        }
+        try testing.expect(timbre.timbre_first_match_agrees(tmp_file, &line, @intCast(len)) == 1);
+    }
+}
+
+test "threads keep input order" {
+    const tmp_file = "test_threads.toml";
+    const in_file = "test_threads.in";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\error = "error"
+        \\warn = "warn"
+        \\info = "info"
+        \\debug = "debug"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteFile(in_file) catch {};
+    defer fs.cwd().deleteTree("test_threads_1") catch {};
+    defer fs.cwd().deleteTree("test_threads_4") catch {};
+    defer fs.cwd().deleteFile("test_threads_1.out") catch {};
+    defer fs.cwd().deleteFile("test_threads_4.out") catch {};
+
+    // Some dozens of batches for four workers to finish out of order
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try mixedLines(&input, 100000);
+    try writeFile(in_file, input.items);
+
+    try testing.expectEqual(@as(c_int, 100000), timbre.timbre_run_file(tmp_file, "test_threads_1", in_file, 1, 0, "test_threads_1.out"));
+    try testing.expectEqual(@as(c_int, 100000), timbre.timbre_run_file(tmp_file, "test_threads_4", in_file, 4, 0, "test_threads_4.out"));
+    try expectSameFile("test_threads_1.out", "test_threads_4.out");
+    try expectFile("test_threads_4.out", input.items);
+    for ([_][]const u8{ "error.log", "warn.log", "info.log", "debug.log" }) |name| {
+        const one = try fs.path.join(testing.allocator, &.{ "test_threads_1", name });
+        defer testing.allocator.free(one);
+        const four = try fs.path.join(testing.allocator, &.{ "test_threads_4", name });
+        defer testing.allocator.free(four);
+        try expectSameFile(one, four);
+    }
+}
+
+test "input files route as stdin does" {
+    const tmp_file = "test_mapped.toml";
+    const in_file = "test_mapped.in";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\error = "error"
+        \\warn = "warn"
+        \\info = "info"
+        \\debug = "debug"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteFile(in_file) catch {};
+    const dirs = [_][]const u8{ "test_mapped_stdin", "test_mapped_1", "test_mapped_4" };
+    defer {
+        for (dirs) |dir| fs.cwd().deleteTree(dir) catch {};
+        for ([_][]const u8{ "test_mapped_stdin.out", "test_mapped_1.out", "test_mapped_4.out" }) |out| {
+            fs.cwd().deleteFile(out) catch {};
+        }
+    }
+
+    // An empty line and a last line without a newline, as well
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try mixedLines(&input, 50000);
+    try input.appendSlice("\nERROR no newline");
+    try writeFile(in_file, input.items);
+
+    try testing.expectEqual(@as(c_int, 50002), timbre.timbre_run_file(tmp_file, "test_mapped_stdin", in_file, 1, 0, "test_mapped_stdin.out"));
+    try testing.expectEqual(@as(c_int, 50002), timbre.timbre_run_file(tmp_file, "test_mapped_1", in_file, 1, 1, "test_mapped_1.out"));
+    try testing.expectEqual(@as(c_int, 50002), timbre.timbre_run_file(tmp_file, "test_mapped_4", in_file, 4, 1, "test_mapped_4.out"));
+
+    // Byte for byte, on stdout and in every level file
+    try expectSameFile("test_mapped_stdin.out", "test_mapped_1.out");
+    try expectSameFile("test_mapped_stdin.out", "test_mapped_4.out");
+    for ([_][]const u8{ "error.log", "warn.log", "info.log", "debug.log" }) |name| {
+        const stdin = try fs.path.join(testing.allocator, &.{ dirs[0], name });
+        defer testing.allocator.free(stdin);
+        for (dirs[1..]) |dir| {
+            const mapped = try fs.path.join(testing.allocator, &.{ dir, name });
+            defer testing.allocator.free(mapped);
+            try expectSameFile(stdin, mapped);
+        }
+    }
+}
+
+test "compressed input is decompressed" {
+    const tmp_file = "test_inflate.toml";
+    const in_file = "test_inflate.in";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\error = "error"
+        \\info = "info"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteFile(in_file) catch {};
+    defer fs.cwd().deleteTree("test_inflate_plain") catch {};
+
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try mixedLines(&input, 20000);
+    try writeFile(in_file, input.items);
+    try testing.expectEqual(@as(c_int, 20000), timbre.timbre_run_file(tmp_file, "test_inflate_plain", in_file, 1, 0, null));
+
+    var tested: usize = 0;
+    for ([_][:0]const u8{ "gzip", "zstd" }) |codec| {
+        if (timbre.timbre_codec_available(codec.ptr) == 0) {
+            std.debug.print("skipping {s} input: built without it\n", .{codec});
+            continue;
+        }
+        const packed_file = try std.fmt.allocPrintZ(testing.allocator, "test_inflate.{s}", .{codec});
+        defer testing.allocator.free(packed_file);
+        defer fs.cwd().deleteFile(packed_file) catch {};
+        try testing.expect(timbre.timbre_compress_file(in_file, packed_file.ptr, codec.ptr) == 1);
+
+        // Read whole and through the pipeline, the lines come out as if never compressed
+        for ([_]c_int{ 1, 4 }) |threads| {
+            defer fs.cwd().deleteTree("test_inflate_logs") catch {};
+            defer fs.cwd().deleteFile("test_inflate.out") catch {};
+            try testing.expectEqual(@as(c_int, 20000), timbre.timbre_run_file(tmp_file, "test_inflate_logs", packed_file.ptr, threads, 0, "test_inflate.out"));
+            try expectFile("test_inflate.out", input.items);
+            try expectSameFile("test_inflate_plain/error.log", "test_inflate_logs/error.log");
+            try expectSameFile("test_inflate_plain/info.log", "test_inflate_logs/info.log");
+        }
+        tested += 1;
+    }
+    if (tested == 0) return error.SkipZigTest;
+}
+
+test "rotation limits" {
+    const tmp_file = "test_rotation.toml";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\sized = { pattern = "a", max_size = "10M", max_age = "1h" }
+        \\plain = { pattern = "b", max_size = 4096, max_age = 90 }
+        \\negative = { pattern = "c", max_size = "-1M", max_age = "-5s" }
+        \\overflow = { pattern = "d", max_size = "99999999999999999999", max_age = "999999999999999999d" }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+
+    var max_size: c_ulonglong = 0;
+    var max_age: c_ulonglong = 0;
+    try testing.expect(timbre.timbre_level_rotation(tmp_file, "sized", &max_size, &max_age) == 1);
+    try testing.expectEqual(@as(c_ulonglong, 10 * 1024 * 1024), max_size);
+    try testing.expectEqual(@as(c_ulonglong, 3600), max_age);
+
+    try testing.expect(timbre.timbre_level_rotation(tmp_file, "plain", &max_size, &max_age) == 1);
+    try testing.expectEqual(@as(c_ulonglong, 4096), max_size);
+    try testing.expectEqual(@as(c_ulonglong, 90), max_age);
+
+    // Rejected values leave the limits unset rather than wrapped around
+    try testing.expect(timbre.timbre_level_rotation(tmp_file, "negative", &max_size, &max_age) == 1);
+    try testing.expectEqual(@as(c_ulonglong, 0), max_size);
+    try testing.expectEqual(@as(c_ulonglong, 0), max_age);
+
+    try testing.expect(timbre.timbre_level_rotation(tmp_file, "overflow", &max_size, &max_age) == 1);
+    try testing.expectEqual(@as(c_ulonglong, 0), max_size);
+    try testing.expectEqual(@as(c_ulonglong, 0), max_age);
+}
+
+test "rotated segments stay within max_size" {
+    const tmp_file = "test_max_size.toml";
+    const log_dir = "test_max_size_logs";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\info = { pattern = "info", max_size = "64K" }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    // Several segments' worth, far less than one sink buffer
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try requestLines(&input, 10000);
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    var dir = try fs.cwd().openDir(log_dir, .{ .iterate = true });
+    defer dir.close();
+    var it = dir.iterate();
+    var segments: usize = 0;
+    var bytes: u64 = 0;
+    while (try it.next()) |entry| {
+        if (std.mem.endsWith(u8, entry.name, ".idx")) continue;
+        const stat = try dir.statFile(entry.name);
+        try testing.expect(stat.size <= 64 * 1024);
+        if (!std.mem.eql(u8, entry.name, "info.log")) segments += 1;
+        bytes += stat.size;
+    }
+    try testing.expect(segments >= 5);
+    // Split at line boundaries, nothing lost
+    try testing.expectEqual(@as(u64, input.items.len), bytes);
+}
+
+test "compress_level beyond the codec's range" {
+    if (timbre.timbre_codec_available("gzip") == 0) {
+        std.debug.print("skipping: built without zlib\n", .{});
+        return error.SkipZigTest;
+    }
+    const tmp_file = "test_compress_level.toml";
+    const log_dir = "test_compress_level_logs";
+    const out_file = "test_compress_level.out";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\info = { pattern = "info", compress = "gzip", compress_level = 12 }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+    defer fs.cwd().deleteFile(out_file) catch {};
+
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try requestLines(&input, 1000);
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    // zlib only goes up to 9, the level is rejected rather than the file
+    try testing.expect(timbre.timbre_seek(log_dir ++ "/info.log.gz", 1000, "", 1, out_file) == 0);
+    try expectFile(out_file, "2026-01-01 00:16:39 INFO request 999\n");
+}
+
+test "priority and all-match routing" {
+    const first_file = "test_routing_first.toml";
+    const all_file = "test_routing_all.toml";
+    const levels =
+        \\[log_level]
+        \\error = "error"
+        \\database = { pattern = "db|database", priority = 10 }
+        \\warn = "warn"
+        \\audit = "warn|error"
+        \\
+    ;
+    try writeFile(first_file, levels);
+    try writeFile(all_file, "[timbre]\nrouting = \"all\"\n\n" ++ levels);
+    defer fs.cwd().deleteFile(first_file) catch {};
+    defer fs.cwd().deleteFile(all_file) catch {};
+    defer fs.cwd().deleteTree("test_routing_first") catch {};
+    defer fs.cwd().deleteTree("test_routing_all") catch {};
+
+    const input: []const u8 =
+        \\database error
+        \\plain error
+        \\db warn
+        \\warn only
+        \\nothing
+        \\
+    ;
+    try testing.expect(timbre.timbre_run(first_file, "test_routing_first", input.ptr, @intCast(input.len)) == 1);
+    try testing.expect(timbre.timbre_run(all_file, "test_routing_all", input.ptr, @intCast(input.len)) == 1);
+
+    // First match: the highest priority, then the first name among equals
+    try expectFile("test_routing_first/database.log", "database error\ndb warn\n");
+    try expectFile("test_routing_first/audit.log", "plain error\nwarn only\n");
+    try expectFile("test_routing_first/error.log", "");
+    try expectFile("test_routing_first/warn.log", "");
+
+    // All: every level that matches
+    try expectFile("test_routing_all/database.log", "database error\ndb warn\n");
+    try expectFile("test_routing_all/audit.log", "database error\nplain error\ndb warn\nwarn only\n");
+    try expectFile("test_routing_all/error.log", "database error\nplain error\n");
+    try expectFile("test_routing_all/warn.log", "db warn\nwarn only\n");
+}
+
+test "config cache round trip" {
+    const tmp_file = "test_cache.toml";
+    const cache_dir = "test_cache";
+    const levels =
+        \\[log_level]
+        \\error = "error"
+        \\database = { pattern = "db|database", priority = 10 }
+        \\warn = "warn"
+        \\
+    ;
+    try writeFile(tmp_file, levels);
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(cache_dir) catch {};
+    defer fs.cwd().deleteTree("test_cache_parsed") catch {};
+    defer fs.cwd().deleteTree("test_cache_cold") catch {};
+    defer fs.cwd().deleteTree("test_cache_warm") catch {};
+    defer fs.cwd().deleteTree("test_cache_edited") catch {};
+
+    const input: []const u8 =
+        \\database error
+        \\plain error
+        \\db warn
+        \\warn only
+        \\
+    ;
+    try testing.expect(timbre.timbre_cache_load(tmp_file, cache_dir) == 0);
+    try testing.expect(timbre.timbre_run(tmp_file, "test_cache_parsed", input.ptr, @intCast(input.len)) == 1);
+    try testing.expect(timbre.timbre_run_cached(tmp_file, cache_dir, "test_cache_cold", input.ptr, @intCast(input.len)) == 1);
+    try testing.expect(timbre.timbre_cache_load(tmp_file, cache_dir) == 1);
+    try testing.expect(timbre.timbre_run_cached(tmp_file, cache_dir, "test_cache_warm", input.ptr, @intCast(input.len)) == 1);
+    for ([_][]const u8{ "error.log", "database.log", "warn.log" }) |name| {
+        var parsed_buf: [64]u8 = undefined;
+        var warm_buf: [64]u8 = undefined;
+        const parsed = try std.fmt.bufPrint(&parsed_buf, "test_cache_parsed/{s}", .{name});
+        try expectSameFile(try std.fmt.bufPrint(&warm_buf, "test_cache_warm/{s}", .{name}), parsed);
+    }
+    try expectFile("test_cache_warm/database.log", "database error\ndb warn\n");
+
+    // A damaged entry fails its checksum and is compiled afresh
+    {
+        var dir = try fs.cwd().openDir(cache_dir, .{ .iterate = true });
+        defer dir.close();
+        var it = dir.iterate();
+        const entry = (try it.next()).?;
+        try testing.expect(std.mem.endsWith(u8, entry.name, ".bin"));
+        const file = try dir.openFile(entry.name, .{ .mode = .read_write });
+        defer file.close();
+        const end = try file.getEndPos();
+        var byte: [1]u8 = undefined;
+        _ = try file.preadAll(&byte, end - 1);
+        byte[0] ^= 0xff;
+        try file.pwriteAll(&byte, end - 1);
+    }
+    try testing.expect(timbre.timbre_cache_load(tmp_file, cache_dir) == 0);
+    try testing.expect(timbre.timbre_run_cached(tmp_file, cache_dir, "test_cache_warm", input.ptr, @intCast(input.len)) == 1);
+    try testing.expect(timbre.timbre_cache_load(tmp_file, cache_dir) == 1);
+
+    // An edited config never picks up the entry of its old contents
+    try writeFile(tmp_file, "[log_level]\nerror = \"error\"\nwarn = \"warn\"\n");
+    try testing.expect(timbre.timbre_cache_load(tmp_file, cache_dir) == 0);
+    try testing.expect(timbre.timbre_run_cached(tmp_file, cache_dir, "test_cache_edited", input.ptr, @intCast(input.len)) == 1);
+    try expectFile("test_cache_edited/error.log", "database error\nplain error\n");
+    try expectFile("test_cache_edited/warn.log", "db warn\nwarn only\n");
+}
+
+test "rebind keeps unchanged files open" {
+    const before_file = "test_rebind_before.toml";
+    const after_file = "test_rebind_after.toml";
+    const log_dir = "test_rebind_logs";
+    try writeFile(before_file, "[log_level]\nerror = \"ERROR\"\ninfo = \"INFO\"\nwarn = \"WARN\"\n");
+    try writeFile(after_file, "[log_level]\nerror = \"ERROR\"\ninfo = \"INFO\"\ndebug = \"DEBUG|WARN\"\n");
+    defer fs.cwd().deleteFile(before_file) catch {};
+    defer fs.cwd().deleteFile(after_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    const input: []const u8 =
+        \\ERROR 1
+        \\INFO 2
+        \\WARN 3
+        \\DEBUG 4
+        \\ERROR 5
+        \\INFO 6
+        \\WARN 7
+        \\DEBUG 8
+        \\
+    ;
+    var kept_open: c_int = 0;
+    try testing.expect(timbre.timbre_run_rebind(before_file, after_file, log_dir, input.ptr, @intCast(input.len), 4, &kept_open) == 1);
+    // error.log and info.log carry on in the same sinks, warn.log is closed
+    try testing.expectEqual(@as(c_int, 2), kept_open);
+    try expectFile(log_dir ++ "/error.log", "ERROR 1\nERROR 5\n");
+    try expectFile(log_dir ++ "/info.log", "INFO 2\nINFO 6\n");
+    try expectFile(log_dir ++ "/warn.log", "WARN 3\n");
+    try expectFile(log_dir ++ "/debug.log", "WARN 7\nDEBUG 8\n");
+}
+
+test "sampling and rate limits leave drop markers" {
+    const tmp_file = "test_throttle.toml";
+    const log_dir = "test_throttle_logs";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\sampled = { pattern = "^S", sample_rate = 0.25 }
+        \\limited = { pattern = "^L", max_lines_per_sec = 5 }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    var i: usize = 0;
+    while (i < 12) : (i += 1) try input.writer().print("S {d}\n", .{i});
+    i = 0;
+    while (i < 20) : (i += 1) try input.writer().print("L {d}\n", .{i});
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    // Sampling keeps evenly spread lines, the first one included; a burst
+    // gets one second's worth. What was dropped is reported on close
+    try expectDropped(log_dir ++ "/sampled.log", "S 0\nS 3\nS 7\nS 11\n" ++
+        "timbre: dropped 8 sampled lines in the last ", "s (sample_rate 0.25, max_lines_per_sec 0)\n");
+    try expectDropped(log_dir ++ "/limited.log", "L 0\nL 1\nL 2\nL 3\nL 4\n" ++
+        "timbre: dropped 15 limited lines in the last ", "s (sample_rate 1, max_lines_per_sec 5)\n");
+}
+
+test "repeated lines collapse" {
+    const tmp_file = "test_repeats.toml";
+    const log_dir = "test_repeats_logs";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\run = { pattern = "^R", collapse_repeats = true }
+        \\window = { pattern = "^W", collapse_repeats = 8 }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    const input: []const u8 = "R x\n" ** 5 ++ "R y\n" ++ "W same\n" ** 5 ++
+        "W a\nW b\nW a\nW c\n" ++ "W same\n" ** 2;
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.ptr, @intCast(input.len)) == 1);
+
+    try expectFile(log_dir ++ "/run.log",
+        \\R x
+        \\timbre: last message repeated 4 times
+        \\R y
+        \\
+    );
+    // Repeats further back are counted until exit, after the lines in between
+    try expectFile(log_dir ++ "/window.log",
+        \\W same
+        \\timbre: last message repeated 4 times
+        \\W a
+        \\W b
+        \\W c
+        \\timbre: message repeated 2 times: W same
+        \\timbre: message repeated 1 time: W a
+        \\
+    );
+}
+
+test "multiline events stay together" {
+    const tmp_file = "test_multiline.toml";
+    const log_dir = "test_multiline_logs";
+    try writeFile(tmp_file,
+        \\[multiline]
+        \\start = "^[0-9]{4}-"
+        \\
+        \\[log_level]
+        \\error = "error"
+        \\info = "info"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    // The frames follow the ERROR line, one of them mentioning info
+    const input: []const u8 = "2026-01-01 00:00:00 ERROR boom\n" ++
+        "\tat com.example.Foo(Foo.java:1)\n" ++
+        "\tat info.Bar(Bar.java:2)\n" ++
+        "2026-01-01 00:00:01 INFO ok\n";
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.ptr, @intCast(input.len)) == 1);
+
+    try expectFile(log_dir ++ "/error.log", "2026-01-01 00:00:00 ERROR boom\n" ++
+        "\tat com.example.Foo(Foo.java:1)\n" ++
+        "\tat info.Bar(Bar.java:2)\n");
+    try expectFile(log_dir ++ "/info.log", "2026-01-01 00:00:01 INFO ok\n");
+}
+
+test "level field routing" {
+    const tmp_file = "test_level_keys.toml";
+    const log_dir = "test_level_keys_logs";
+    try writeFile(tmp_file,
+        \\[timbre]
+        \\level_keys = ["level", "severity"]
+        \\
+        \\[log_level]
+        \\error = "error"
+        \\warn = "warn"
+        \\info = "info"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    const input: []const u8 =
+        \\{"level":"warn","msg":"an error happened"}
+        \\ts=1 level=info msg="error in message"
+        \\{"severity":50,"msg":"pino error"}
+        \\{"level":"verbose","msg":"no such level, error in message"}
+        \\plain error line
+        \\
+    ;
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.ptr, @intCast(input.len)) == 1);
+
+    // The field decides when it names a level, the whole line when it doesn't
+    try expectFile(log_dir ++ "/error.log",
+        \\{"severity":50,"msg":"pino error"}
+        \\{"level":"verbose","msg":"no such level, error in message"}
+        \\plain error line
+        \\
+    );
+    try expectFile(log_dir ++ "/warn.log",
+        \\{"level":"warn","msg":"an error happened"}
+        \\
+    );
+    try expectFile(log_dir ++ "/info.log",
+        \\ts=1 level=info msg="error in message"
+        \\
+    );
+}
+
+test "severity prefixes" {
+    const tmp_file = "test_prefixes.toml";
+    const log_dir = "test_prefixes_logs";
+    try writeFile(tmp_file,
+        \\[timbre]
+        \\level_prefixes = ["glog", "syslog", "bracket"]
+        \\
+        \\[log_level]
+        \\error = "error"
+        \\warn = "warn"
+        \\info = "info"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    const input: []const u8 =
+        \\E0418 12:00:00.123456 1 main.cc:10] disk full
+        \\<4>kernel: info about the link
+        \\[WARN] the info cache is cold
+        \\[main] error occurred
+        \\I0418 12:00:01.000000 1 main.cc:11] retrying after error
+        \\
+    ;
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.ptr, @intCast(input.len)) == 1);
+
+    // A bracketed word that isn't a severity leaves the line to the patterns
+    try expectFile(log_dir ++ "/error.log",
+        \\E0418 12:00:00.123456 1 main.cc:10] disk full
+        \\[main] error occurred
+        \\
+    );
+    try expectFile(log_dir ++ "/warn.log",
+        \\<4>kernel: info about the link
+        \\[WARN] the info cache is cold
+        \\
+    );
+    try expectFile(log_dir ++ "/info.log",
+        \\I0418 12:00:01.000000 1 main.cc:11] retrying after error
+        \\
+    );
+}
+
+test "severities named differently from the default levels" {
+    const tmp_file = "test_severities.toml";
+    const log_dir = "test_severities_logs";
+    try writeFile(tmp_file,
+        \\[timbre]
+        \\level_prefixes = ["syslog", "glog"]
+        \\level_keys = ["level"]
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+
+    const input: []const u8 =
+        \\<0>panic error
+        \\<1>alert error
+        \\F0418 12:00:00.123456 1 main.cc:10] fatal error
+        \\{"level":"fatal","msg":"x"}
+        \\{"level":60,"msg":"x"}
+        \\<5>link up
+        \\{"level":"TRACE","msg":"connection error"}
+        \\
+    ;
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.ptr, @intCast(input.len)) == 1);
+
+    // None of these name a default level, each goes to the one it belongs to
+    try expectFile(log_dir ++ "/error.log",
+        \\<0>panic error
+        \\<1>alert error
+        \\F0418 12:00:00.123456 1 main.cc:10] fatal error
+        \\{"level":"fatal","msg":"x"}
+        \\{"level":60,"msg":"x"}
+        \\
+    );
+    try expectFile(log_dir ++ "/info.log", "<5>link up\n");
+    try expectFile(log_dir ++ "/debug.log",
+        \\{"level":"TRACE","msg":"connection error"}
+        \\
+    );
+}
+
+test "seek by time and line" {
+    const tmp_file = "test_seek.toml";
+    const log_dir = "test_seek_logs";
+    const out_file = "test_seek.out";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\info = "info"
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+    defer fs.cwd().deleteFile(out_file) catch {};
+
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try requestLines(&input, 20000);
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    // Several index entries, one every 4096 lines
+    try testing.expect(timbre.timbre_seek(log_dir ++ "/info.log", 0, "2026-01-01 01:00:00", 2, out_file) == 0);
+    try expectFile(out_file,
+        \\2026-01-01 01:00:00 INFO request 3600
+        \\2026-01-01 01:00:01 INFO request 3601
+        \\
+    );
+    // A bare time of day is its last occurrence in the file
+    try testing.expect(timbre.timbre_seek(log_dir ++ "/info.log", 0, "05:00", 1, out_file) == 0);
+    try expectFile(out_file, "2026-01-01 05:00:00 INFO request 18000\n");
+    try testing.expect(timbre.timbre_seek(log_dir ++ "/info.log", 10000, "", 1, out_file) == 0);
+    try expectFile(out_file, "2026-01-01 02:46:39 INFO request 9999\n");
+}
+
+test "query across rotated segments" {
+    if (timbre.timbre_codec_available("gzip") == 0) {
+        std.debug.print("skipping: built without zlib\n", .{});
+        return error.SkipZigTest;
+    }
+    const tmp_file = "test_query.toml";
+    const log_dir = "test_query_logs";
+    const out_file = "test_query.out";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\info = { pattern = "info", max_size = "64K", rotate_compress = "gzip" }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+    defer fs.cwd().deleteFile(out_file) catch {};
+
+    // A few segments of 64K
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try requestLines(&input, 10000);
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    try testing.expect(timbre.timbre_query(tmp_file, log_dir, "request [0-9]*00$", "", "", out_file) == 0);
+    const out = try fs.cwd().readFileAlloc(testing.allocator, out_file, 1 << 20);
+    defer testing.allocator.free(out);
+    // Every match in the order written, from the oldest segment on, compressed
+    try testing.expect(std.mem.startsWith(u8, out, log_dir ++ "/info.log."));
+    try testing.expect(std.mem.endsWith(u8, out[0..std.mem.indexOfScalar(u8, out, ':').?], ".gz"));
+    var expected: usize = 100;
+    var lines = std.mem.tokenizeScalar(u8, out, '\n');
+    while (lines.next()) |line| : (expected += 100) {
+        const number = line[std.mem.lastIndexOfScalar(u8, line, ' ').? + 1 ..];
+        try testing.expectEqual(expected, try std.fmt.parseInt(usize, number, 10));
+    }
+    try testing.expectEqual(@as(usize, 10000), expected);
+
+    // The time range is inclusive at both ends
+    try testing.expect(timbre.timbre_query(tmp_file, log_dir, "request", "2026-01-01 01:00:00", "2026-01-01 01:10:00", out_file) == 0);
+    const ranged = try fs.cwd().readFileAlloc(testing.allocator, out_file, 1 << 20);
+    defer testing.allocator.free(ranged);
+    try testing.expectEqual(@as(usize, 601), std.mem.count(u8, ranged, "\n"));
+}
+
+test "seek in a compressed segment" {
+    if (timbre.timbre_codec_available("gzip") == 0) {
+        std.debug.print("skipping: built without zlib\n", .{});
+        return error.SkipZigTest;
+    }
+    const tmp_file = "test_segment.toml";
+    const log_dir = "test_segment_logs";
+    const out_file = "test_segment.out";
+    try writeFile(tmp_file,
+        \\[log_level]
+        \\info = { pattern = "info", max_size = "1M", rotate_compress = "gzip" }
+        \\
+    );
+    defer fs.cwd().deleteFile(tmp_file) catch {};
+    defer fs.cwd().deleteTree(log_dir) catch {};
+    defer fs.cwd().deleteFile(out_file) catch {};
+
+    // Segments of some 27000 lines, several index entries each
+    var input = std.ArrayList(u8).init(testing.allocator);
+    defer input.deinit();
+    try requestLines(&input, 100000);
+    try testing.expect(timbre.timbre_run(tmp_file, log_dir, input.items.ptr, @intCast(input.items.len)) == 1);
+
+    // The oldest segment is the one query names first
+    try testing.expect(timbre.timbre_query(tmp_file, log_dir, "request 0$", "", "", out_file) == 0);
+    const out = try fs.cwd().readFileAlloc(testing.allocator, out_file, 1 << 20);
+    defer testing.allocator.free(out);
+    const segment = try std.fmt.allocPrintZ(testing.allocator, "{s}", .{out[0..std.mem.indexOfScalar(u8, out, ':').?]});
+    defer testing.allocator.free(segment);
+    try testing.expect(std.mem.startsWith(u8, segment, log_dir ++ "/info.log."));
+    try testing.expect(std.mem.endsWith(u8, segment, ".gz"));
+
+    // Its index is kept through compression, under the segment's new name
+    const index = try std.fmt.allocPrint(testing.allocator, "{s}.idx", .{segment});
+    defer testing.allocator.free(index);
+    try fs.cwd().access(index, .{});
+
+    try testing.expect(timbre.timbre_seek(segment.ptr, 0, "2026-01-01 00:10:00", 1, out_file) == 0);
+    try expectFile(out_file, "2026-01-01 00:10:00 INFO request 600\n");
+    try testing.expect(timbre.timbre_seek(segment.ptr, 5000, "", 1, out_file) == 0);
+    try expectFile(out_file, "2026-01-01 01:23:19 INFO request 4999\n");
+}
+
 // Helper functions that provide Zig wrappers around the C interface
 fn createRegex(pattern: []const u8, case_insensitive: bool) !*timbre.timbre_regex_t {
     const regex = timbre.timbre_regex_create(pattern.ptr, @intCast(pattern.len), @intFromBool(case_insensitive));
@@ -112,3 +914,50 @@ fn createRegex(pattern: []const u8, case_insensitive: bool) !*timbre.timbre_rege
 fn freeRegex(regex: *timbre.timbre_regex_t) void {
     timbre.timbre_regex_destroy(regex);
 }
+
+fn writeFile(path: []const u8, contents: []const u8) !void {
+    const file = try fs.cwd().createFile(path, .{});
+    defer file.close();
+    try file.writeAll(contents);
+}
+
+fn expectFile(path: []const u8, expected: []const u8) !void {
+    const contents = try fs.cwd().readFileAlloc(testing.allocator, path, 1 << 24);
+    defer testing.allocator.free(contents);
+    try testing.expectEqualStrings(expected, contents);
+}
+
+fn expectSameFile(path: []const u8, other: []const u8) !void {
+    const contents = try fs.cwd().readFileAlloc(testing.allocator, other, 1 << 24);
+    defer testing.allocator.free(contents);
+    try expectFile(path, contents);
+}
+
+// A level file ending in a drop marker, whatever number of seconds it gives
+fn expectDropped(path: []const u8, head: []const u8, tail: []const u8) !void {
+    const contents = try fs.cwd().readFileAlloc(testing.allocator, path, 1 << 20);
+    defer testing.allocator.free(contents);
+    try testing.expect(std.mem.startsWith(u8, contents, head));
+    try testing.expect(std.mem.endsWith(u8, contents, tail));
+    const seconds = contents[head.len .. contents.len - tail.len];
+    _ = try std.fmt.parseInt(u64, seconds, 10);
+}
+
+// Lines of every level and of none, "<LEVEL> event N"
+fn mixedLines(out: *std.ArrayList(u8), count: usize) !void {
+    const levels = [_][]const u8{ "ERROR", "WARN", "INFO", "DEBUG", "NOTE" };
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        try out.writer().print("2026-01-01 00:00:00 {s} event {d}\n", .{ levels[i * 7 % levels.len], i });
+    }
+}
+
+// One line a second from 2026-01-01 00:00:00 on, "INFO request N" for line N + 1
+fn requestLines(out: *std.ArrayList(u8), count: usize) !void {
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        try out.writer().print("2026-01-{d:0>2} {d:0>2}:{d:0>2}:{d:0>2} INFO request {d}\n", .{
+            1 + i / 86400, i / 3600 % 24, i / 60 % 60, i % 60, i,
+        });
+    }
+}